@@ -0,0 +1,150 @@
+/* ----------------------------------------------------------------------------------------------
+ * Copyright (C) 2023-2024 Jure Bagić
+ *
+ * This file is part of ashe.
+ * ashe is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * ashe is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ashe.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------------------------*/
+
+
+/*
+ * Input editor benchmark.
+ * Fills the input with 1KB, 1MB and 4MB of text (single
+ * line and 80 column lines) and measures the time of a key
+ * (edit + frame) typed, moved over and erased at the end
+ * of the input and typed in the middle of it. Per key time
+ * should not depend on the size of the input.
+ * Terminal is a pseudoterminal opened by the benchmark,
+ * frames written into it are drained and discarded.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "ainput.h"
+#include "apath.h"
+#include "ashell.h"
+
+/* keys measured for each size and edit */
+#define KEYS 2000
+
+ASHE_PRIVATE a_int32 master;
+
+/* results, stdout before it got replaced */
+ASHE_PRIVATE FILE *out;
+
+/* Open pseudoterminal as the standard streams. */
+ASHE_PRIVATE void openterm(void)
+{
+	struct winsize ws = { .ws_row = 24, .ws_col = 80 };
+	a_int32 slave;
+
+	if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(master) < 0 ||
+	    unlockpt(master) < 0 || (slave = open(ptsname(master), O_RDWR | O_NOCTTY)) < 0) {
+		perror("pseudoterminal");
+		exit(EXIT_FAILURE);
+	}
+	ioctl(slave, TIOCSWINSZ, &ws);
+	fcntl(master, F_SETFL, O_NONBLOCK);
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	setvbuf(out, NULL, _IONBF, 0);
+	dup2(slave, STDIN_FILENO);
+	dup2(slave, STDOUT_FILENO);
+	dup2(slave, STDERR_FILENO);
+	close(slave);
+}
+
+/* Draw the frame and discard what was written. */
+ASHE_PRIVATE void refresh(void)
+{
+	char buf[4096];
+
+	a_term_refresh();
+	while (read(master, buf, sizeof(buf)) > 0)
+		;
+}
+
+ASHE_PRIVATE double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Fill the input with 'size' bytes, lines are 'cols' wide (0 is one line). */
+ASHE_PRIVATE void fill(a_uint32 size, a_uint32 cols)
+{
+	char *text;
+	a_uint32 i;
+
+	text = malloc(size);
+	for (i = 0; i < size; i++)
+		text[i] = (cols && i % cols == cols - 1 ? '\n' : 'a' + i % 26);
+	a_input_clear();
+	ashe_insert_str(text, size);
+	refresh();
+	free(text);
+}
+
+/* Return microseconds per key of 'KEYS' calls to 'edit' followed by a frame. */
+ASHE_PRIVATE double perkey(a_ubyte (*edit)(void))
+{
+	double start;
+	a_uint32 i;
+
+	start = now();
+	for (i = 0; i < KEYS; i++) {
+		edit();
+		refresh();
+	}
+	return (now() - start) / KEYS;
+}
+
+ASHE_PRIVATE a_ubyte typechar(void)
+{
+	return ashe_insert_char('x');
+}
+
+int main(void)
+{
+	static const a_uint32 sizes[] = { 1 << 10, 1 << 20, 4 << 20 };
+	static const a_uint32 cols[] = { 0, 80 };
+	a_uint32 i, j;
+
+	openterm();
+	a_pathcache_init(&ashe.sh_path);
+	a_term_init();
+	fprintf(out, "%-8s %-6s %10s %10s %10s %10s (us/key)\n", "KB", "lines", "type", "left",
+		"erase", "middle");
+	for (i = 0; i < ASHE_ELEMENTS(sizes); i++) {
+		for (j = 0; j < ASHE_ELEMENTS(cols); j++) {
+			fill(sizes[i], cols[j]);
+			fprintf(out, "%-8u %-6s", sizes[i] >> 10, cols[j] ? "80col" : "one");
+			fprintf(out, " %10.2f", perkey(typechar));
+			fprintf(out, " %10.2f", perkey(ashe_move_left));
+			fprintf(out, " %10.2f", perkey(ashe_remove_char));
+			ashe_move_to_index(sizes[i] / 2);
+			refresh();
+			fprintf(out, " %10.2f\n", perkey(typechar));
+		}
+	}
+	a_term_free();
+	a_pathcache_free(&ashe.sh_path);
+	return 0;
+}
@@ -13,7 +13,8 @@ MANPREFIX = ${PREFIX}/share/man
 
 # Debug definitions
 #DBGDEFS = -DASHE_DBG -DASHE_DBG_ASSERT -DASHE_DBG_LEX -DASHE_DBG_LINES \
-	  -DASHE_DBG_CURSOR -DASHE_DBG_LEX -DASHE_DBG_MAIN -DASHE_DBG_AST
+	  -DASHE_DBG_CURSOR -DASHE_DBG_LEX -DASHE_DBG_MAIN -DASHE_DBG_AST \
+	  -DASHE_DBG_IO
 
 
 # Debug flags
@@ -21,7 +22,7 @@ MANPREFIX = ${PREFIX}/share/man
 
 
 # Shared libraries
-LIBS = ${ASANFLAGS}
+LIBS = -pthread ${ASANFLAGS}
 
 
 # Optimization flags
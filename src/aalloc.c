@@ -35,7 +35,7 @@ ASHE_PUBLIC void ashe_cleanup(void)
 #else
 	canfail = 1;
 #endif
-	ashe_freehistlist(&ashe.sh_history, NULL, canfail);
+	ashe_freehistlist(&ashe.sh_history, canfail);
 	a_jobcntl_harvest(&ashe.sh_jobcntl);
 	a_shell_free(&ashe);
 }
@@ -33,7 +33,6 @@ int main(int argc, char **argv)
 	ASHE_UNUSED(argc);
 	ASHE_UNUSED(argv);
 	struct a_jobcntl *jobcntl;
-	const char *cmd;
 	a_arr_char *statusbuf;
 	a_int32 status;
 
@@ -48,10 +47,14 @@ int main(int argc, char **argv)
 #if defined(ASHE_DBG_LINES)
 	logfile_create("/tmp/ashe.lines.dbg.txt", ALOG_LINES);
 #endif
+#if defined(ASHE_DBG_IO)
+	logfile_create("/tmp/ashe.io.dbg.txt", ALOG_IO);
+#endif
 
 	REPL
 	{
 		a_jobcntl_update_and_notify(jobcntl);
+		ashe_histcheck(&ashe.sh_history);
 		ashe_enable_jobcntl_updates();
 		a_term_read();
 		ashe_disable_jobcntl_updates();
@@ -62,8 +65,9 @@ int main(int argc, char **argv)
 		if (a_arr_len(A_IBF) <= 1)
 			continue;
 
-		cmd = ashe_dupstrn(a_arr_ptr(A_IBF), a_arr_len(A_IBF) - 1);
-		ashe_newhisthead(&ashe.sh_history, cmd);
+		ashe_histappend(&ashe.sh_history, a_arr_ptr(A_IBF), a_arr_len(A_IBF) - 1);
+		if (!a_term_typedahead()) /* batch lines that arrive together */
+			ashe_histflush(&ashe.sh_history);
 
 		if ((status = ashe_parse(a_arr_ptr(A_IBF))) == 1) {
 			continue;
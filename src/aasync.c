@@ -14,8 +14,12 @@
  * If not, see <https://www.gnu.org/licenses/>.
  * ----------------------------------------------------------------------------------------------*/
 
+#include <errno.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
 
 #include "aasync.h"
 #include "acommon.h"
@@ -23,26 +27,27 @@
 #include "ajobcntl.h"
 #include "ashell.h"
 #include "ahist.h"
+#include "auserstr.h"
 #ifdef ASHE_DBG
 #include "adbg.h"
 #endif
 
-/* Signals which we handle and block/unblock. */
+/*
+ * Signals which we handle, they are kept blocked
+ * and received through 'sigfd' by 'ashe_wait_fd()'
+ * instead of interrupting the shell.
+ */
 static const a_int32 signals[] = {
 	SIGINT,
 	SIGCHLD,
 	SIGWINCH,
 };
 
-ASHE_PRIVATE void SIGINT_handler(int signum);
-ASHE_PRIVATE void SIGCHLD_handler(int signum);
-ASHE_PRIVATE void SIGWINCH_handler(int signum);
+/* signalfd for 'signals' */
+static a_int32 sigfd = -1;
 
-static a_sighandler handlers[] = {
-	SIGINT_handler,
-	SIGCHLD_handler,
-	SIGWINCH_handler,
-};
+/* set if SIGCHLD updates 'JobControl' */
+static a_ubyte jobupdates = 0;
 
 /* Mask signal 'signum' by specifying 'how'.
  * 'how' can be SIG_BLOCK or SIG_UNBLOCK. */
@@ -57,102 +62,128 @@ ASHE_PUBLIC void ashe_mask_signal(int signum, int how)
 		ashe_panic_libcall(sigprocmask);
 }
 
-/* SIGWINCH signal handler */
-ASHE_PRIVATE void SIGWINCH_handler(int signum)
+/* Fill 'set' with signals in 'signals' array. */
+ASHE_PRIVATE void signals_set(sigset_t *set)
 {
-	ASHE_UNUSED(signum);
-	ashe_mask_signals(SIG_BLOCK);
-	ashe.sh_int = 1;
-	sigwinch_redraw();
-#ifdef ASHE_DBG_CURSOR
-	debug_cursor();
-#endif
-#ifdef ASHE_DBG_LINES
-	debug_lines();
-#endif
-	ashe_mask_signals(SIG_UNBLOCK);
+	a_uint32 i;
+
+	sigemptyset(set);
+	for (i = 0; i < ASHE_ELEMENTS(signals); i++)
+		sigaddset(set, signals[i]);
 }
 
-/* SIGINT signal handler */
-ASHE_PRIVATE void SIGINT_handler(int signum)
+/* Masks signals in 'signals' array. */
+ASHE_PUBLIC void ashe_mask_signals(a_int32 how)
 {
-	ASHE_UNUSED(signum);
-	ashe_mask_signals(SIG_BLOCK);
-	ashe.sh_int = 1;
-	ashe_redraw_prompt();
-	resethistcurrent();
-#ifdef ASHE_DBG_CURSOR
-	debug_cursor();
-#endif
-#ifdef ASHE_DBG_LINES
-	debug_lines();
-#endif
-	ashe_mask_signals(SIG_UNBLOCK);
+	sigset_t set;
+
+	signals_set(&set);
+	if (a_unlikely(sigprocmask(how, &set, NULL) < 0))
+		ashe_panic_libcall(sigprocmask);
 }
 
-/* SIGCHLD signal handler */
-ASHE_PRIVATE void SIGCHLD_handler(int signum)
+/*
+ * Drain 'sigfd' and handle the received signals.
+ * Burst of the same signal (many children exiting,
+ * window being resized) is handled only once.
+ */
+ASHE_PRIVATE void handle_signals(void)
 {
-	ASHE_UNUSED(signum);
-	ashe_mask_signals(SIG_BLOCK);
-	ashe.sh_int = 1;
-	a_jobcntl_update_and_notify(&ashe.sh_jobcntl);
+	struct signalfd_siginfo si[16];
+	a_ubyte chld, intr, winch;
+	a_ssize n, i;
+
+	chld = intr = winch = 0;
+	while ((n = read(sigfd, si, sizeof(si))) > 0) {
+		for (i = 0; i < n / (a_ssize)sizeof(si[0]); i++) {
+			switch (si[i].ssi_signo) {
+			case SIGCHLD:
+				chld = 1;
+				break;
+			case SIGINT:
+				intr = 1;
+				break;
+			case SIGWINCH:
+				winch = 1;
+				break;
+			}
+		}
+	}
+	if (a_unlikely(n < 0 && errno != EAGAIN && errno != EINTR))
+		ashe_panic_libcall(read);
+
+	if (chld && jobupdates)
+		a_jobcntl_update_and_notify(&ashe.sh_jobcntl);
+	if (intr) {
+		ashe_redraw_prompt();
+		resethistcurrent();
+	}
+	if (winch)
+		sigwinch_redraw();
 #ifdef ASHE_DBG_CURSOR
 	debug_cursor();
 #endif
 #ifdef ASHE_DBG_LINES
 	debug_lines();
 #endif
-	ashe_mask_signals(SIG_UNBLOCK);
 }
 
-/* Masks signals in 'signals' array. */
-ASHE_PUBLIC void ashe_mask_signals(a_int32 how)
+ASHE_PUBLIC a_ubyte ashe_wait_fd(a_int32 fd, a_int32 timeout)
 {
-	a_uint32 i;
-
-	for (i = 0; i < ASHE_ELEMENTS(signals); i++)
-		ashe_mask_signal(signals[i], how);
+	struct pollfd pfds[3];
+	a_int32 n;
+
+	pfds[0].fd = fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = sigfd;
+	pfds[1].events = POLLIN;
+	pfds[2].fd = ashe_plhfd(); /* ignored if negative */
+	pfds[2].events = POLLIN;
+	for (;;) {
+		if ((n = poll(pfds, ASHE_ELEMENTS(pfds), timeout)) < 0) {
+			if (a_unlikely(errno != EINTR))
+				ashe_panic_libcall(poll);
+			continue;
+		}
+		if (n == 0)
+			return 0;
+		if (pfds[1].revents & POLLIN)
+			handle_signals();
+		if ((pfds[2].revents & POLLIN) && ashe_plhcollect())
+			ashe_update_prompt();
+		if (pfds[0].revents) /* readable, hangup or error */
+			return 1;
+	}
 }
 
 /* Enables asynchronous 'JobControl' updates. */
 ASHE_PUBLIC void ashe_enable_jobcntl_updates(void)
 {
-	struct sigaction old_action;
-
-	sigaction(SIGCHLD, NULL, &old_action);
-	old_action.sa_handler = SIGCHLD_handler;
-	sigaction(SIGCHLD, &old_action, NULL);
+	jobupdates = 1;
 }
 
 /* disables asynchronous 'JobControl' updates. */
 ASHE_PUBLIC void ashe_disable_jobcntl_updates(void)
 {
-	struct sigaction old_action;
-
-	sigaction(SIGCHLD, NULL, &old_action);
-	old_action.sa_handler = SIG_DFL;
-	sigaction(SIGCHLD, &old_action, NULL);
+	jobupdates = 0;
 }
 
 // clang-format off
-/* Initializes signal handlers. */
+/* Initializes signal handling. */
 ASHE_PUBLIC void ashe_init_sighandlers(void)
 {
-	a_sighandler handler;
 	struct sigaction default_action;
-	a_uint32 i;
+	sigset_t set;
 
 	sigemptyset(&default_action.sa_mask);
 	default_action.sa_flags = 0;
 
-	for (i = 0; i < ASHE_ELEMENTS(signals); i++) {
-		handler = handlers[i];
-		if (signals[i] == SIGCHLD)
-			handler = SIG_DFL;
-		default_action.sa_handler = handler;
-		ashe_sigaction(signals[i], &default_action, NULL);
-	}
+	/* 'signals' stay blocked, children unblock them */
+	signals_set(&set);
+	if (a_unlikely(sigprocmask(SIG_BLOCK, &set, NULL) < 0))
+		ashe_panic_libcall(sigprocmask);
+	if (a_unlikely((sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC)) < 0))
+		ashe_panic_libcall(signalfd);
 
 	default_action.sa_handler = SIG_IGN;
 	ashe_sigaction(SIGTTIN, &default_action, NULL);
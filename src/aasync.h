@@ -25,4 +25,12 @@ void ashe_mask_signals(a_int32 how);
 void ashe_disable_jobcntl_updates(void);
 void ashe_enable_jobcntl_updates(void);
 
+/*
+ * Wait until 'fd' is ready for reading or 'timeout'
+ * milliseconds pass (negative waits forever), signals
+ * arriving while waiting are handled in here.
+ * Returns 1 if 'fd' is ready, 0 on timeout.
+ */
+a_ubyte ashe_wait_fd(a_int32 fd, a_int32 timeout);
+
 #endif
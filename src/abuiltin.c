@@ -23,11 +23,13 @@
 #include <ctype.h>
 
 #include "abuiltin.h"
+#include "ahist.h"
 #include "autils.h"
 #include "acommon.h"
 #include "ajobcntl.h"
 #include "ainput.h"
 #include "ashell.h"
+#include "auserstr.h"
 
 /* differentiate %ID (flip) and PID, check 'ashe_bi_jobs()' */
 #define FLIP_SIGN_BIT(n) ((n) ^ ((a_uint32)1 << ((sizeof(n) * 8) - 1)))
@@ -475,6 +477,7 @@ ASHE_PRIVATE a_int32 ashe_bi_cd(a_arr_ccharp *argv)
 		print_help_opts("cd");
 		a_defer(-1);
 	}
+	ashe_plhinvalidate(A_PLH_CWD);
 defer:
 	return status;
 }
@@ -700,12 +703,84 @@ ASHE_PRIVATE a_int32 ashe_bi_clear(a_arr_ccharp *argv)
 	return status;
 }
 
-ASHE_PRIVATE void print_builtins(void)
+ASHE_PRIVATE a_int32 ashe_bi_histconv(a_arr_ccharp *argv)
 {
-	static const char *builtin[] = {
-		"cd",	"pwd",	"clear", "builtin", "fg",   "bg",
-		"jobs", "exec", "exit",	 "penv",    "senv", "renv",
+	static const char *usage[] = {
+		"histconv - convert history file\r\n",
+		"histconv import SOURCE DEST\r\n",
+		"histconv export SOURCE DEST\r\n",
+		"Converts between the plain history file (one command per line) "
+		"and the indexed history file.",
+		"'import' writes indexed file DEST with commands of the plain "
+		"file SOURCE, 'export' does the opposite.",
+		"Indexed history file is loaded in the same time no matter how "
+		"many commands it holds, commands that don't fit into the "
+		"history are read from it while browsing.",
+		"SOURCE and DEST can be the same file.",
 	};
+
+	const char *mode, *src, *dst;
+	a_memmax argc;
+	a_int32 status;
+
+	status = 0;
+	argc = a_arrp_len(argv);
+
+	switch (argc) {
+	case 4:
+		mode = a_arrp_ptr(argv)[1];
+		src = a_arrp_ptr(argv)[2];
+		dst = a_arrp_ptr(argv)[3];
+		if (strcmp(mode, "import") == 0) {
+			status = ashe_histimport(src, dst);
+		} else if (strcmp(mode, "export") == 0) {
+			status = ashe_histexport(src, dst);
+		} else {
+			ashe_eprintf("histconv: invalid mode '%s'.", mode);
+			print_help_opts("histconv");
+			a_defer(-1);
+		}
+		if (status < 0)
+			ashe_perrno("histconv: %s '%s' to '%s'", mode, src, dst);
+		break;
+	case 2:
+		if (is_help_opt(a_arrp_ptr(argv)[1])) {
+			print_rows(usage, ASHE_ELEMENTS(usage));
+			break;
+		}
+		/* FALLTHRU */
+	default:
+		print_help_opts("histconv");
+		a_defer(-1);
+	}
+defer:
+	return status;
+}
+
+/* builtin command names, indexed by 'enum a_builtin_type' */
+static const char *builtin[TBI_CNT] = {
+	[TBI_BUILTIN] = "builtin",
+	[TBI_BG] = "bg",
+	[TBI_CD] = "cd",
+	[TBI_CLEAR] = "clear",
+	[TBI_FG] = "fg",
+	[TBI_HISTCONV] = "histconv",
+	[TBI_JOBS] = "jobs",
+	[TBI_PENV] = "penv",
+	[TBI_PWD] = "pwd",
+	[TBI_RENV] = "renv",
+	[TBI_SENV] = "senv",
+	[TBI_EXEC] = "exec",
+	[TBI_EXIT] = "exit",
+};
+
+ASHE_PUBLIC const char *ashe_binname(enum a_builtin_type bi)
+{
+	return builtin[bi];
+}
+
+ASHE_PRIVATE void print_builtins(void)
+{
 	a_memmax i;
 
 	for (i = 0; i < ASHE_ELEMENTS(builtin); i++)
@@ -844,6 +919,8 @@ ASHE_PUBLIC a_int32 ashe_isbin(const char *command)
 		break;
 	case 'f':
 		return builtin_match(command, 1, 1, "g", TBI_FG);
+	case 'h':
+		return builtin_match(command, 1, 7, "istconv", TBI_HISTCONV);
 	case 'j':
 		return builtin_match(command, 1, 3, "obs", TBI_JOBS);
 	case 'p':
@@ -872,8 +949,9 @@ ASHE_PUBLIC a_int32 ashe_runbin(struct a_simple_cmd *scmd, enum a_builtin_type t
 {
 	static const builtinfn table[] = {
 		ashe_bi_builtin, ashe_bi_bg,   ashe_bi_cd,   ashe_bi_clear,
-		ashe_bi_fg,	 ashe_bi_jobs, ashe_bi_penv, ashe_bi_pwd,
-		ashe_bi_renv,	 ashe_bi_senv, ashe_bi_exec, NULL /* ashe_bi_exit */,
+		ashe_bi_fg,	 ashe_bi_histconv, ashe_bi_jobs, ashe_bi_penv,
+		ashe_bi_pwd,	 ashe_bi_renv, ashe_bi_senv, ashe_bi_exec,
+		NULL /* ashe_bi_exit */,
 	};
 
 	ashe_assertf(tbi >= TBI_BUILTIN && tbi <= TBI_EXIT, "invalid tbi");
@@ -27,6 +27,7 @@ enum a_builtin_type {
 	TBI_CD,
 	TBI_CLEAR,
 	TBI_FG,
+	TBI_HISTCONV,
 	TBI_JOBS,
 	TBI_PENV,
 	TBI_PWD,
@@ -36,7 +37,13 @@ enum a_builtin_type {
 	TBI_EXIT,
 };
 
+/* number of builtin commands */
+#define TBI_CNT (TBI_EXIT + 1)
+
 a_int32 ashe_runbin(struct a_simple_cmd *scmd, enum a_builtin_type bi);
 a_int32 ashe_isbin(const char *command);
 
+/* Return name of the builtin command 'bi'. */
+const char *ashe_binname(enum a_builtin_type bi);
+
 #endif
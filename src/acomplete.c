@@ -0,0 +1,539 @@
+/* ----------------------------------------------------------------------------------------------
+ * Copyright (C) 2023-2024 Jure Bagić
+ *
+ * This file is part of ashe.
+ * ashe is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * ashe is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ashe.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------------------------*/
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "aalloc.h"
+#include "abuiltin.h"
+#include "acomplete.h"
+#include "ainput.h"
+#include "aparser.h"
+#include "ashell.h"
+#include "autf8.h"
+#include "autils.h"
+
+/* size of the buffer directory entries are read into */
+#define DENTSBUF (256 * 1024)
+
+/* directory entry as read by 'getdents64' */
+struct dent64 {
+	a_uint64 d_ino;
+	a_int64 d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/* Return 1 if input byte 'c' separates words. */
+#define wordbreak(c) \
+	((c) == ' ' || (c) == '\n' || (c) == ';' || (c) == '|' || (c) == '&' || (c) == '<' || \
+	 (c) == '>' || (c) == '(' || (c) == ')')
+
+/* Return 1 if 'c' in a name has to be inside of double quotes. */
+#define needsquotes(c) (wordbreak(c) || (c) == '\t')
+
+ASHE_PRIVATE void dirlist_init(struct a_dirlist *dl)
+{
+	a_arr_char_init(&dl->dl_names);
+	a_arr_dirname_init(&dl->dl_sorted);
+	dl->dl_dev = dl->dl_ino = 0;
+	dl->dl_sec = dl->dl_nsec = 0;
+	dl->dl_used = 0;
+}
+
+ASHE_PRIVATE void dirlist_free(struct a_dirlist *dl)
+{
+	a_arr_char_free(&dl->dl_names, NULL);
+	a_arr_dirname_free(&dl->dl_sorted, NULL);
+}
+
+/* names the sort comparison refers to */
+ASHE_PRIVATE const char *sortnames;
+
+ASHE_PRIVATE int cmp_names(const void *a, const void *b)
+{
+	return strcmp(sortnames + *(const a_uint32 *)a, sortnames + *(const a_uint32 *)b);
+}
+
+/*
+ * Read directory 'path' into 'dl', entries are read
+ * with 'getdents64' into a large buffer this way even
+ * huge directories take only a few system calls.
+ * Returns 0 if directory can't be opened.
+ */
+ASHE_PRIVATE a_ubyte dirlist_read(struct a_dirlist *dl, const char *path)
+{
+	struct dent64 *d;
+	struct stat st;
+	char *buf;
+	a_ssize n, i;
+	a_int32 fd;
+	a_ubyte isdir;
+
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return 0;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return 0;
+	}
+	dl->dl_dev = st.st_dev;
+	dl->dl_ino = st.st_ino;
+	a_arr_len(dl->dl_names) = 0;
+	a_arr_len(dl->dl_sorted) = 0;
+	dl->dl_sec = st.st_mtim.tv_sec;
+	dl->dl_nsec = st.st_mtim.tv_nsec;
+	buf = ashe_malloc(DENTSBUF);
+	while ((n = syscall(SYS_getdents64, fd, buf, DENTSBUF)) > 0) {
+		for (i = 0; i < n; i += d->d_reclen) {
+			d = (struct dent64 *)(buf + i);
+			if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+				continue;
+			isdir = (d->d_type == DT_DIR);
+			if (d->d_type == DT_LNK || d->d_type == DT_UNKNOWN)
+				isdir = (fstatat(fd, d->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode));
+			a_arr_dirname_push(&dl->dl_sorted, a_arr_len(dl->dl_names));
+			a_arr_char_push_str(&dl->dl_names, d->d_name, strlen(d->d_name));
+			if (isdir)
+				a_arr_char_push(&dl->dl_names, '/');
+			a_arr_char_push(&dl->dl_names, '\0');
+		}
+	}
+	ashe_free(buf);
+	close(fd);
+	sortnames = a_arr_ptr(dl->dl_names);
+	if (a_arr_len(dl->dl_sorted) > 0)
+		qsort(a_arr_ptr(dl->dl_sorted), a_arr_len(dl->dl_sorted), sizeof(a_uint32),
+		      cmp_names);
+	return 1;
+}
+
+/*
+ * Return listing of directory 'path', cached listing is
+ * found by device and inode (same 'path' names another
+ * directory after 'cd') and used if the directory was not
+ * modified since, otherwise the least recently used one
+ * gets replaced.
+ * Returns NULL if directory can't be read.
+ */
+ASHE_PRIVATE struct a_dirlist *dirlist_get(struct a_complete *cp, const char *path)
+{
+	struct a_dirlist *dl, *lru;
+	struct stat st;
+	a_uint32 i;
+
+	if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode))
+		return NULL;
+	lru = &cp->cp_dirs[0];
+	for (i = 0; i < A_DIRCACHE; i++) {
+		dl = &cp->cp_dirs[i];
+		if (dl->dl_used && dl->dl_dev == (a_uint64)st.st_dev &&
+		    dl->dl_ino == (a_uint64)st.st_ino) {
+			if (dl->dl_sec == st.st_mtim.tv_sec && dl->dl_nsec == st.st_mtim.tv_nsec) {
+				dl->dl_used = ++cp->cp_clock;
+				return dl;
+			}
+			lru = dl; /* stale, read it again */
+			break;
+		}
+		if (dl->dl_used < lru->dl_used)
+			lru = dl;
+	}
+	if (!dirlist_read(lru, path)) {
+		lru->dl_used = 0;
+		return NULL;
+	}
+	lru->dl_used = ++cp->cp_clock;
+	return lru;
+}
+
+/* Return input index where the word before the cursor starts. */
+ASHE_PRIVATE a_uint32 word_start(void)
+{
+	a_uint32 i;
+
+	for (i = A_IBFIDX; i > 0 && !wordbreak(A_IBFAT(i - 1)); i--)
+		;
+	return i;
+}
+
+/*
+ * Push sorted names of builtins and commands in PATH
+ * starting with 'len' bytes of 'word' into 'out'.
+ */
+ASHE_PRIVATE void commands(a_arr_ccharp *out, const char *word, a_uint32 len)
+{
+	const char *bins[TBI_CNT], *name;
+	a_uint32 nbins, first, n, i, j;
+	a_int32 cmp;
+
+	for (nbins = 0, i = 0; i < TBI_CNT; i++) {
+		name = ashe_binname(i);
+		if (strncmp(name, word, len) != 0)
+			continue;
+		for (j = nbins++; j > 0 && strcmp(bins[j - 1], name) > 0; j--)
+			bins[j] = bins[j - 1];
+		bins[j] = name;
+	}
+	n = a_pathcache_complete(&ashe.sh_path, word, len, &first);
+	a_arr_ccharp_ensure(out, nbins + n);
+	for (i = 0, j = 0; i < nbins || j < n;) { /* merge, builtin shadows command */
+		if (i == nbins)
+			cmp = 1;
+		else if (j == n)
+			cmp = -1;
+		else
+			cmp = strcmp(bins[i], a_pathcache_name(&ashe.sh_path, first + j));
+		if (cmp <= 0) {
+			a_arr_ccharp_push(out, bins[i++]);
+			j += (cmp == 0);
+		} else {
+			a_arr_ccharp_push(out, a_pathcache_name(&ashe.sh_path, first + j++));
+		}
+	}
+}
+
+/*
+ * Push sorted names in directory 'dir' starting with
+ * 'len' bytes of 'base' into 'out', hidden names are
+ * completed only if 'base' starts with '.'.
+ */
+ASHE_PRIVATE void files(a_arr_ccharp *out, const char *dir, const char *base, a_uint32 len)
+{
+	struct a_dirlist *dl;
+	const char *name;
+	a_uint32 lo, hi, mid;
+
+	if ((dl = dirlist_get(&ashe.sh_complete, dir)) == NULL)
+		return;
+	lo = 0;
+	hi = a_arr_len(dl->dl_sorted);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strncmp(a_arr_ptr(dl->dl_names) + a_arr_ptr(dl->dl_sorted)[mid], base, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < a_arr_len(dl->dl_sorted); lo++) {
+		name = a_arr_ptr(dl->dl_names) + a_arr_ptr(dl->dl_sorted)[lo];
+		if (strncmp(name, base, len) != 0)
+			break;
+		if (name[0] != '.' || base[0] == '.')
+			a_arr_ccharp_push(out, name);
+	}
+}
+
+/*
+ * Push names of the files completing 'word' into 'out'.
+ * Returns the length of the part of 'word' the names
+ * complete (without the directory).
+ */
+ASHE_PRIVATE a_uint32 paths(a_arr_ccharp *out, const char *word)
+{
+	a_arr_char dir;
+	const char *base, *home;
+
+	a_arr_char_init(&dir);
+	if ((base = strrchr(word, '/')) != NULL) {
+		base++;
+		if (word[0] == '~' && word[1] == '/' && (home = getenv("HOME")) != NULL) {
+			a_arr_char_push_str(&dir, home, strlen(home));
+			word++;
+		}
+		a_arr_char_push_str(&dir, word, base - word);
+	} else {
+		base = word;
+		a_arr_char_push(&dir, '.');
+	}
+	a_arr_char_push(&dir, '\0');
+	files(out, a_arr_ptr(dir), base, strlen(base));
+	a_arr_char_free(&dir, NULL);
+	return strlen(base);
+}
+
+/* Return length (in bytes) of the prefix shared by all 'names'. */
+ASHE_PRIVATE a_uint32 common_prefix(a_arr_ccharp *names)
+{
+	const char *first, *name;
+	a_uint32 len, i, k;
+
+	first = *a_arr_ccharp_index(names, 0);
+	len = strlen(first);
+	for (i = 1; i < a_arrp_len(names) && len > 0; i++) {
+		name = *a_arr_ccharp_index(names, i);
+		for (k = 0; k < len && name[k] == first[k]; k++)
+			;
+		len = k;
+	}
+	while (len > 0 && first[len] != '\0' && ((a_ubyte)first[len] & 0xc0) == 0x80)
+		len--; /* don't split a multibyte character */
+	return len;
+}
+
+/*
+ * List a page of 'names' in columns below the input and
+ * draw the prompt with the input again. Listing the same
+ * 'word' at input index 'start' again shows the next page.
+ */
+ASHE_PRIVATE void list(a_arr_ccharp *names, const char *word, a_uint32 start)
+{
+	struct a_complete *cp;
+	a_arr_char out;
+	const char *name;
+	a_uint32 total, first, n, width, cols, rows, r, c, i;
+
+	cp = &ashe.sh_complete;
+	total = a_arrp_len(names);
+	first = 0;
+	if (a_arr_len(cp->cp_word) > 0 && cp->cp_start == start &&
+	    strcmp(a_arr_ptr(cp->cp_word), word) == 0 && cp->cp_next < total)
+		first = cp->cp_next;
+	for (width = 0, i = 0; i < total; i++) {
+		name = *a_arr_ccharp_index(names, i);
+		width = a_max(width, a_utf8_strwidth(name, strlen(name)) + 2);
+	}
+	cols = a_max(A_TCOLMAX / width, 1);
+	rows = (A_TROWMAX > 3 ? A_TROWMAX - 2 : 1); /* room for the footer and prompt */
+	n = a_min(total - first, rows * cols);
+	rows = (n + cols - 1) / cols;
+	a_arr_char_init(&out);
+	for (r = 0; r < rows; r++) { /* sorted down the columns */
+		for (c = 0; c < cols && (i = c * rows + r) < n; c++) {
+			name = *a_arr_ccharp_index(names, first + i);
+			a_arr_char_push_str(&out, name, strlen(name));
+			if (c + 1 < cols && (c + 1) * rows + r < n)
+				for (i = a_utf8_strwidth(name, strlen(name)); i < width; i++)
+					a_arr_char_push(&out, ' ');
+		}
+		a_arr_char_push_str(&out, "\r\n", 2);
+	}
+	if (n < total) {
+		a_arr_char_push_strf(&out, "-- %n-%n of %n%s --\r\n", (a_ssize)first + 1,
+				     (a_ssize)(first + n), (a_ssize)total,
+				     (first + n < total ? ", Tab for more" : ""));
+		rows++;
+	}
+	a_arr_char_push(&out, '\0');
+	ashe_move_below_input_unsafe();
+	ashe_printf(stderr, "%s", a_arr_ptr(out));
+	A_TROW = a_min(A_TROW + rows, A_TROWMAX);
+	ashe_draw_prompt_unsafe();
+	a_arr_char_free(&out, NULL);
+	a_arr_len(cp->cp_word) = 0;
+	a_arr_char_push_str(&cp->cp_word, word, strlen(word) + 1);
+	cp->cp_start = start;
+	cp->cp_next = (first + n < total ? first + n : 0);
+}
+
+/*
+ * Insert the rest of the only completion 'name' after 'len'
+ * bytes of it that are already in the input, word starting
+ * at input index 'start' is put inside of double quotes if
+ * 'name' needs them.
+ */
+ASHE_PRIVATE void insert_name(const char *name, a_uint32 len, a_uint32 start)
+{
+	a_uint32 n, end;
+	a_ubyte quote;
+
+	n = strlen(name);
+	for (quote = 0, end = 0; end < n && !quote; end++)
+		quote = needsquotes(name[end]);
+	if (quote) {
+		end = A_IBFIDX;
+		ashe_move_to_index(start);
+		ashe_insert_char('"');
+		ashe_move_to_index(end + 1);
+	}
+	ashe_insert_str(name + len, n - len);
+	if (quote)
+		ashe_insert_char('"');
+	if (name[n - 1] != '/') /* directory can be completed further */
+		ashe_insert_char(' ');
+}
+
+ASHE_PUBLIC a_ubyte ashe_complete(void)
+{
+	a_arr_char word;
+	a_arr_ccharp names;
+	const char *first;
+	a_uint32 start, len, common, n, i;
+	a_ubyte state;
+
+	start = word_start();
+	state = a_syntax_state(&A_ISYN, start);
+	a_arr_char_init(&word);
+	for (i = start; i < A_IBFIDX; i++)
+		a_arr_char_push(&word, A_IBFAT(i));
+	a_arr_char_push(&word, '\0');
+	a_arr_ccharp_init(&names);
+	len = 0;
+	/* can't tell what expands into */
+	if (strpbrk(a_arr_ptr(word), "\"$\\") == NULL) {
+		if ((state & A_HLS_CMD) && !(state & A_HLS_REDIR) &&
+		    strchr(a_arr_ptr(word), '/') == NULL) {
+			len = a_arr_len(word) - 1;
+			if (strchr(a_arr_ptr(word), '=') == NULL)
+				commands(&names, a_arr_ptr(word), len);
+		} else {
+			len = paths(&names, a_arr_ptr(word));
+		}
+	}
+	if ((n = a_arr_len(names)) == 1) {
+		insert_name(*a_arr_ccharp_index(&names, 0), len, start);
+	} else if (n > 1) {
+		first = *a_arr_ccharp_index(&names, 0);
+		common = common_prefix(&names);
+		for (i = len; i < common && !needsquotes(first[i]); i++)
+			;
+		if (i > len)
+			ashe_insert_str(first + len, i - len);
+		else
+			list(&names, a_arr_ptr(word), start);
+	}
+	if (n <= 1 || i > len) /* input changed, next listing starts over */
+		a_arr_len(ashe.sh_complete.cp_word) = 0;
+	a_arr_char_free(&word, NULL);
+	a_arr_ccharp_free(&names, NULL);
+	return (n > 0);
+}
+
+/*
+ * Bit-parallel edit distance (Myers/Hyyro) between 'text'
+ * and pattern whose character masks are in 'peq', each
+ * bit is a row (pattern character) and all rows of a
+ * column are computed at once.
+ * Returns distance or 'maxd' + 1 if it exceeds 'maxd'.
+ */
+ASHE_PRIVATE a_uint32 distance(const a_uint64 *peq, a_uint32 m, const char *text, a_uint32 n,
+			       a_uint32 maxd)
+{
+	a_uint64 vp, vn, hp, hn, x, d0, tr, eq, preveq, last;
+	a_uint32 score, j;
+
+	vp = ~(a_uint64)0;
+	vn = 0;
+	d0 = 0;
+	preveq = 0;
+	last = (a_uint64)1 << (m - 1);
+	score = m;
+	for (j = 0; j < n; j++) {
+		eq = peq[(unsigned char)text[j]];
+		tr = (((~d0) & eq) << 1) & preveq; /* transposition */
+		x = eq | vn;
+		d0 = (((x & vp) + vp) ^ vp) | x | tr;
+		hp = vn | ~(d0 | vp);
+		hn = vp & d0;
+		score += ((hp & last) != 0);
+		score -= ((hn & last) != 0);
+		if (score > maxd + (n - j - 1)) /* can't get back under 'maxd' */
+			return maxd + 1;
+		x = (hp << 1) | 1;
+		vn = x & d0;
+		vp = (hn << 1) | ~(x | d0);
+		preveq = eq;
+	}
+	return (score <= maxd ? score : maxd + 1);
+}
+
+/* names nearest to the searched one found so far */
+struct a_nearest {
+	a_uint64 peq[256]; /* character masks of the searched name */
+	a_uint32 m; /* length of the searched name */
+	a_uint32 maxd; /* farthest distance kept */
+	const char *names[A_NEAREST]; /* ordered by distance, then by name */
+	a_uint32 dist[A_NEAREST];
+	a_uint32 count;
+};
+
+/*
+ * Keep 'cand' in 'nr' if it is near enough, a builtin
+ * also found in PATH is kept only once.
+ */
+ASHE_PRIVATE void nearest_add(struct a_nearest *nr, const char *cand)
+{
+	a_uint32 d, n, i, j;
+
+	n = strlen(cand);
+	if (n + nr->maxd < nr->m || nr->m + nr->maxd < n)
+		return;
+	if ((d = distance(nr->peq, nr->m, cand, n, nr->maxd)) > nr->maxd)
+		return;
+	for (i = nr->count; i > 0 && (nr->dist[i - 1] > d ||
+				      (nr->dist[i - 1] == d && strcmp(nr->names[i - 1], cand) > 0));
+	     i--)
+		;
+	if (i == A_NEAREST || (i > 0 && nr->dist[i - 1] == d && strcmp(nr->names[i - 1], cand) == 0))
+		return;
+	if (nr->count < A_NEAREST)
+		nr->count++;
+	for (j = nr->count - 1; j > i; j--) {
+		nr->names[j] = nr->names[j - 1];
+		nr->dist[j] = nr->dist[j - 1];
+	}
+	nr->names[i] = cand;
+	nr->dist[i] = d;
+}
+
+ASHE_PUBLIC void ashe_nearest_commands(a_arr_ccharp *out, const char *name)
+{
+	struct a_nearest nr;
+	a_uint32 first, n, i;
+
+	nr.m = strlen(name);
+	if (nr.m == 0 || nr.m > 64)
+		return;
+	nr.maxd = (nr.m < 6 ? 1 : 2);
+	nr.count = 0;
+	memset(nr.peq, 0, sizeof(nr.peq));
+	for (i = 0; i < nr.m; i++)
+		nr.peq[(unsigned char)name[i]] |= (a_uint64)1 << i;
+	/* builtins and the sorted PATH names are walked in place */
+	for (i = 0; i < TBI_CNT; i++)
+		nearest_add(&nr, ashe_binname(i));
+	n = a_pathcache_complete(&ashe.sh_path, "", 0, &first);
+	for (i = 0; i < n; i++)
+		nearest_add(&nr, a_pathcache_name(&ashe.sh_path, first + i));
+	for (i = 0; i < nr.count; i++)
+		a_arr_ccharp_push(out, nr.names[i]);
+}
+
+ASHE_PUBLIC void a_complete_init(struct a_complete *cp)
+{
+	a_uint32 i;
+
+	for (i = 0; i < A_DIRCACHE; i++)
+		dirlist_init(&cp->cp_dirs[i]);
+	cp->cp_clock = 0;
+	a_arr_char_init(&cp->cp_word);
+	cp->cp_start = 0;
+	cp->cp_next = 0;
+}
+
+ASHE_PUBLIC void a_complete_free(struct a_complete *cp)
+{
+	a_uint32 i;
+
+	for (i = 0; i < A_DIRCACHE; i++)
+		dirlist_free(&cp->cp_dirs[i]);
+	a_arr_char_free(&cp->cp_word, NULL);
+}
@@ -0,0 +1,87 @@
+/* ----------------------------------------------------------------------------------------------
+ * Copyright (C) 2023-2024 Jure Bagić
+ *
+ * This file is part of ashe.
+ * ashe is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * ashe is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ashe.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------------------------*/
+
+#ifndef ACOMPLETE_H
+#define ACOMPLETE_H
+
+#include "acommon.h"
+#include "aarray.h"
+#include "atoken.h"
+
+/* number of directory listings kept in the cache */
+#define A_DIRCACHE 8
+
+/* most commands suggested in place of unknown command */
+#define A_NEAREST 3
+
+/* offset of a name in 'dl_names' */
+ARRAY_NEW(a_arr_dirname, a_uint32)
+
+/*
+ * Listing of a directory, valid as long as the
+ * modification time of the directory is the same.
+ * Names of directories end with '/'.
+ */
+struct a_dirlist {
+	a_uint64 dl_dev; /* directory identity */
+	a_uint64 dl_ino;
+	a_arr_char dl_names; /* '\0' terminated names */
+	a_arr_dirname dl_sorted; /* names sorted */
+	a_int64 dl_sec; /* modification time */
+	a_int64 dl_nsec;
+	a_uint64 dl_used; /* last use (0 if unused) */
+};
+
+/* completion state */
+struct a_complete {
+	struct a_dirlist cp_dirs[A_DIRCACHE];
+	a_uint64 cp_clock; /* incremented on each use of a listing */
+	/*
+	 * Completions are listed a page at a time, Tab
+	 * on the same word lists the next page.
+	 */
+	a_arr_char cp_word; /* listed word ('\0' if none) */
+	a_uint32 cp_start; /* input index of the listed word */
+	a_uint32 cp_next; /* first completion on the next page */
+};
+
+void a_complete_init(struct a_complete *cp);
+void a_complete_free(struct a_complete *cp);
+
+/*
+ * Complete the word before the cursor, names of
+ * builtins and commands in PATH are completed in
+ * command position and file names elsewhere (or
+ * if the word contains '/').
+ * Single completion is inserted followed by a space,
+ * otherwise the longest common prefix is inserted and
+ * if there is none the completions are listed below
+ * the input, a page at a time.
+ * Returns 0 if there is nothing to complete.
+ */
+a_ubyte ashe_complete(void);
+
+/*
+ * Push into 'out' up to 'A_NEAREST' names of builtins
+ * and commands in PATH closest to 'name' (by edit
+ * distance where transposition of adjacent characters
+ * counts as a single edit), nearest ones first.
+ * Only names that are at most 1 edit away (2 for
+ * names of 6 or more characters) are pushed.
+ */
+void ashe_nearest_commands(a_arr_ccharp *out, const char *name);
+
+#endif
@@ -22,6 +22,7 @@
  * or are contributor... */
 #if defined(__linux__)
 #include <linux/limits.h>
+#include <stddef.h>
 #define HOME 		"HOME"
 #else
 #error "Ashe is only compatible with linux platforms."
@@ -86,10 +87,29 @@
  * In case any of the placeholders return NULL then
  * the placeholder won't get expanded and it will
  * remain unchanged.
+ * Placeholder values are computed again each time the
+ * prompt is drawn, unless the function calls 'ashe_plhcache()'
+ * telling when its value expires or which events ('A_PLH_*')
+ * invalidate it.
+ *
+ * Placeholders that are slow to compute go into the
+ * 'asyncplaceholders' array, their indices continue after
+ * the last one in 'placeholders'. They are computed on a
+ * worker thread (starting already while a foreground job
+ * runs), each function gets the current directory and
+ * writes the value into 'buf' of 'size' bytes. It must not
+ * allocate memory nor touch any of the shell state.
+ * Prompt waits for them at most 'ASHE_PLH_DEADLINE'
+ * milliseconds, placeholder that is not ready by then
+ * is drawn as 'ASHE_PLH_PENDING' and the value is drawn
+ * as soon as it arrives.
  */
-#define ASHE_PLH_SIGN 	'%'
+#define ASHE_PLH_SIGN 	  '%'
+#define ASHE_PLH_DEADLINE 50
+#define ASHE_PLH_PENDING  "…"
 
 typedef const char *(*a_promptfn)(void);
+typedef void (*a_asyncfn)(const char *cwd, char *buf, size_t size);
 
 #ifdef ASHE_USE_PLACEHOLDERS_ARRAY /* include guard */
 extern const char *ashe_host(void);
@@ -110,6 +130,12 @@ static a_promptfn placeholders[] = {
 	ashe_date, /* 6: current date (YYYY-MM-DD) */
 	ashe_uptime, /* 7: system uptime (HHh MMm) */
 };
+extern void ashe_gitbranch(const char *cwd, char *buf, size_t size);
+extern void ashe_loadavg(const char *cwd, char *buf, size_t size);
+static a_asyncfn asyncplaceholders[] = {
+	ashe_gitbranch, /* 8: git branch (or commit) of the current directory */
+	ashe_loadavg, /* 9: system load average (last minute) */
+};
 #endif
 
 
@@ -124,13 +150,39 @@ static a_promptfn placeholders[] = {
 /* ---- Prompt ---- */
 /*
  * Note:
- * tabs for now are not supported and will be unescaped,
  * new line characters, carriage retrun, vertical tabs,
- * form feed are also prohibited and will be unescaped.
+ * form feed are prohibited and will be unescaped.
  */
 #define ASHE_PROMPT 	"%1@%0 %3$ "
 
 
+/* ---- Commands in PATH ---- */
+/*
+ * File keeping the index of commands found in PATH
+ * directories between sessions, only directories
+ * modified since the file was written are read again.
+ * Env variables ('$') are expanded appropriately,
+ * empty string disables the file.
+ */
+#define ASHE_PATHCACHEFILEPATH 	"$HOME/.ashe_pathcache"
+
+
+/* ---- Syntax highlighting ---- */
+/*
+ * SGR sequences used to colour the input,
+ * empty string leaves the text uncoloured.
+ */
+#define ASHE_HL_CMD 		"\033[32m" /* existing command */
+#define ASHE_HL_NOCMD 		"\033[31m" /* unknown command */
+#define ASHE_HL_STRING 		"\033[33m" /* argument with double quotes */
+#define ASHE_HL_KVPAIR 		"\033[36m" /* key=value before command */
+#define ASHE_HL_REDIR 		"\033[35m" /* redirection */
+#define ASHE_HL_OPERATOR 	"\033[1m" /* ';', '|', '&&'... */
+#define ASHE_HL_COMMENT 	"\033[90m"
+#define ASHE_HL_ERROR 		"\033[4;31m" /* unterminated string */
+#define ASHE_HL_SUGGEST 	"\033[90m" /* history suggestion */
+
+
 /* ---- Shell exit ---- */
 /*
  * Sleep time in-between shell sending a kill signal
@@ -145,11 +197,19 @@ static a_promptfn placeholders[] = {
 /*
  * Default location where the command history file is saved.
  * Env variables ('$') are expanded appropriately.
+ * Commands are appended to the file as they are accepted,
+ * it is loaded in the background when the shell starts.
  */
 #define ASHE_HISTFILEPATH 	"$HOME/.ashe_hist"
 
 /*
- * Limit of how many commands history can hold.
+ * Default limit of how many commands history can hold,
+ * overridden by '$ASHE_HISTLIMIT' when the shell starts.
+ * Plain history file is rewritten in the background with
+ * only the last 'ASHE_HISTLIMIT' commands once it holds
+ * twice as many. Indexed history file (see 'histconv'
+ * builtin) keeps all of the commands, the ones over the
+ * limit are read from the file while browsing.
  */
 #define ASHE_HISTLIMIT 		1000
 
@@ -66,6 +66,7 @@
 const char *logfiles[] = {
 	NULL,
 	NULL,
+	NULL,
 };
 
 static const char *tokenstr[] = {
@@ -583,7 +584,7 @@ ASHE_PUBLIC void debug_lines(void)
 {
 	a_arr_char buffer;
 	struct a_line *line;
-	a_uint32 i;
+	a_uint32 i, j, start;
 	a_int32 fd;
 
 	a_arr_char_init(&buffer);
@@ -591,16 +592,20 @@ ASHE_PUBLIC void debug_lines(void)
 	if (a_unlikely((fd = ashe_open(logfiles[ALOG_LINES], AHOW_W, 0)) < 0))
 		ashe_panic_libwcall(ashe_open, "can't open logfile for logging lines");
 
-	a_arr_char_push_strf(&buffer, "[A_TPLEN:%n] -> [", A_TPLEN);
-	a_arr_char_push_str(&buffer, a_arr_ptr(A_TP), A_TPLEN);
-	a_arr_char_push_strf(&buffer, "]\n[IBFLEN:%n] -> [", a_arr_len(A_IBF));
-	a_arr_char_push_str(&buffer, a_arr_ptr(A_IBF), a_arr_len(A_IBF));
+	a_arr_char_push_strf(&buffer, "[A_TPLEN:%n] -> [", (a_ssize)A_TPLEN);
+	a_arr_char_push_str(&buffer, a_arr_ptr(A_TP), strlen(a_arr_ptr(A_TP)));
+	a_arr_char_push_strf(&buffer, "]\n[IBFLEN:%n][GAP:%n] -> [",
+			     (a_ssize)a_arr_len(A_IBF), (a_ssize)A_IGAP);
+	for (i = 0; i < a_arr_len(A_IBF); i++)
+		a_arr_char_push(&buffer, A_IBFAT(i));
 	a_arr_char_push_strlit(&buffer, "]\n");
-	for (i = 0; i < A_ILINES.len; i++) {
+	for (start = 0, i = 0; i < A_ILINES.len; i++) {
 		line = a_arr_line_index(&A_ILINES, i);
 		a_arr_char_push_strf(&buffer, "[A_ILINE:%n][LEN:%n] -> [", i, line->len);
-		a_arr_char_push_str(&buffer, line->start, line->len);
+		for (j = start; j < start + line->len; j++)
+			a_arr_char_push(&buffer, A_IBFAT(j));
 		a_arr_char_push_strlit(&buffer, "]\n");
+		start += line->len;
 	}
 
 	ashe_write(fd, a_arr_ptr(buffer), a_arr_len(buffer));
@@ -608,6 +613,33 @@ ASHE_PUBLIC void debug_lines(void)
 	a_arr_char_free(&buffer, NULL);
 }
 
+/* Debug terminal io syscalls per decoded key */
+ASHE_PUBLIC void debug_iostat(void)
+{
+	a_arr_char buffer;
+	struct a_iostat *st;
+	a_uint64 syscalls;
+	a_int32 fd;
+
+	a_arr_char_init(&buffer);
+
+	if (a_unlikely((fd = ashe_open(logfiles[ALOG_IO], AHOW_RW, 1)) < 0))
+		ashe_panic_libwcall(ashe_open, "can't open logfile for io logging");
+	st = &A_TSTAT;
+	syscalls = st->io_reads + st->io_writes + st->io_ioctls;
+	a_arr_char_push_strf(&buffer,
+			     "[KEYS:%n][FRAMES:%n][READS:%n][WRITES:%n][IOCTLS:%n][SYSCALLS/KEY:%f]"
+			     "[IBFLEN:%n][BATCHNS:%n]\n",
+			     (a_ssize)st->io_keys, (a_ssize)st->io_frames, (a_ssize)st->io_reads,
+			     (a_ssize)st->io_writes, (a_ssize)st->io_ioctls,
+			     st->io_keys ? (double)syscalls / st->io_keys : 0.0,
+			     (a_ssize)a_arr_len(A_IBF), (a_ssize)st->io_batchns);
+	ashe_write(fd, a_arr_ptr(buffer), a_arr_len(buffer));
+
+	ashe_close(fd);
+	a_arr_char_free(&buffer, NULL);
+}
+
 ASHE_PUBLIC void remove_logfiles(void)
 {
 	DIR *root;
@@ -623,7 +655,8 @@ ASHE_PUBLIC void remove_logfiles(void)
 
 	for (errno = 0; (entry = readdir(root)) != NULL;) {
 		if ((strcmp(entry->d_name, logfiles[ALOG_CURSOR]) == 0 ||
-		     strcmp(entry->d_name, logfiles[ALOG_LINES]) == 0) &&
+		     strcmp(entry->d_name, logfiles[ALOG_LINES]) == 0 ||
+		     strcmp(entry->d_name, logfiles[ALOG_IO]) == 0) &&
 		    entry->d_type == DT_REG) {
 			if (unlink(entry->d_name) < 0)
 				ashe_perrno("couldn't unlink %n", entry->d_name);
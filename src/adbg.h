@@ -28,9 +28,11 @@
 /* debug terminal input */
 #define ALOG_CURSOR 0
 #define ALOG_LINES  1
+#define ALOG_IO	    2
 extern const char *logfiles[];
 void debug_cursor(void);
 void debug_lines(void);
+void debug_iostat(void);
 void logfile_create(const char *logfile, a_int32 which);
 void remove_logfiles(void);
 
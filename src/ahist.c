@@ -3,87 +3,331 @@
 #include "autils.h"
 #include "aalloc.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
-ASHE_PRIVATE struct a_histnode *newnode(const char *contents)
+
+/* -------------------------------------------------------------------------
+ * Prefix tree
+ * ------------------------------------------------------------------------- */
+
+#define histat(hl, seq) 	(&(hl)->ring[(seq) & ((hl)->ringcap - 1)])
+#define histseqstr(hl, seq) 	a_histstr(hl, histat(hl, seq))
+
+#define pfxnode(hl, i) 	a_arr_histprefix_index(&(hl)->prefixes, i)
+#define pfxlabel(hl, node) 	(histseqstr(hl, (node)->newest) + (node)->off)
+
+
+ASHE_PRIVATE a_uint32 pfx_new(struct a_histlist *hl, a_uint32 seq, a_uint32 off, a_uint32 len)
 {
-	struct a_histnode *hnode;
+	struct a_histprefix *node;
+	a_uint32 i;
 
-	hnode = ashe_malloc(sizeof(*hnode));
-	hnode->contents = contents;
-	hnode->len = strlen(contents);
-	return hnode;
+	if (hl->freeprefix) {
+		i = hl->freeprefix;
+		hl->freeprefix = pfxnode(hl, i)->next;
+	} else {
+		i = a_arr_len(hl->prefixes);
+		a_arr_histprefix_push(&hl->prefixes, (struct a_histprefix){ 0 });
+	}
+	node = pfxnode(hl, i);
+	node->newest = seq;
+	node->off = off;
+	node->len = len;
+	node->count = 0;
+	node->child = 0;
+	node->next = 0;
+	return i;
 }
 
 
-ASHE_PRIVATE void freenode(struct a_histnode *node)
+/* Return child of node 'i' with label starting with 'c' (0 if none). */
+ASHE_PRIVATE a_uint32 pfx_child(struct a_histlist *hl, a_uint32 i, char c)
 {
-	ashe_free((void*)node->contents);
-	ashe_free(node);
+	for (i = pfxnode(hl, i)->child; i; i = pfxnode(hl, i)->next)
+		if (*pfxlabel(hl, pfxnode(hl, i)) == c)
+			break;
+	return i;
 }
 
 
-ASHE_PRIVATE inline void checknodelimit(struct a_histlist *hl)
+/*
+ * Add entry 'seq' to the prefix tree, 'newest' is set if
+ * it was added to the head of the list.
+ */
+ASHE_PRIVATE void pfx_insert(struct a_histlist *hl, a_uint32 seq, a_ubyte newest)
 {
-	struct a_histnode *hnode;
+	struct a_histprefix *node;
+	const char *label, *contents;
+	a_uint32 i, c, d, k, n, len, lower;
+
+	if (a_arr_len(hl->prefixes) == 0)
+		pfx_new(hl, 0, 0, 0); /* root */
+	contents = histseqstr(hl, seq);
+	len = histat(hl, seq)->len;
+	for (i = 0, d = 0; d < len; i = c, d += k) {
+		if (!(c = pfx_child(hl, i, contents[d]))) {
+			c = pfx_new(hl, seq, d, len - d);
+			pfxnode(hl, c)->count = 1;
+			pfxnode(hl, c)->next = pfxnode(hl, i)->child;
+			pfxnode(hl, i)->child = c;
+			return;
+		}
+		node = pfxnode(hl, c);
+		label = pfxlabel(hl, node);
+		n = a_min(node->len, len - d);
+		for (k = 1; k < n && label[k] == contents[d + k]; k++)
+			;
+		if (k < node->len) { /* split the edge, lower part keeps the children */
+			lower = pfx_new(hl, 0, 0, 0);
+			node = pfxnode(hl, c); /* 'pfx_new()' might have moved it */
+			*pfxnode(hl, lower) = (struct a_histprefix){
+				.newest = node->newest,
+				.off = node->off + k,
+				.len = node->len - k,
+				.count = node->count,
+				.child = node->child,
+				.next = 0,
+			};
+			node->len = k;
+			node->child = lower;
+		}
+		node->count++;
+		if (newest)
+			node->newest = seq;
+	}
+}
+
+
+/*
+ * Remove entry 'seq' from the prefix tree, it must be
+ * the oldest entry in the list.
+ */
+ASHE_PRIVATE void pfx_remove(struct a_histlist *hl, a_uint32 seq)
+{
+	struct a_histprefix *node;
+	const char *contents;
+	a_uint32 i, c, d, len, *link;
+
+	contents = histseqstr(hl, seq);
+	len = histat(hl, seq)->len;
+	for (i = 0, d = 0; d < len; i = c, d += node->len) {
+		c = pfx_child(hl, i, contents[d]);
+		ashe_assert(c != 0);
+		node = pfxnode(hl, c);
+		if (--node->count > 0)
+			continue;
+		/* only entry 'seq' passes through, rest of its path is a chain */
+		for (link = &pfxnode(hl, i)->child; *link != c; link = &pfxnode(hl, *link)->next)
+			;
+		*link = node->next;
+		for (; c; c = i) {
+			node = pfxnode(hl, c);
+			i = node->child;
+			node->newest = 0;
+			node->next = hl->freeprefix;
+			hl->freeprefix = c;
+		}
+		return;
+	}
+}
+
+
+ASHE_PRIVATE a_ubyte histloaded(struct a_histlist *hl, a_ubyte wait);
+
+
+/*
+ * Return the newest entry starting with 'len' bytes
+ * of 'prefix' or NULL if there is none.
+ * Cost depends only on the length of the prefix.
+ * Entries still being loaded are not suggested.
+ */
+ASHE_PUBLIC const struct a_histnode *ashe_histsuggest(struct a_histlist *hl, const char *prefix,
+						       a_uint32 len)
+{
+	struct a_histprefix *node;
+	a_uint32 i, d, n;
 
-	if (a_unlikely(hl->nnodes >= ASHE_HISTLIMIT)) {
-		ashe_assert(hl->nnodes > 0 && hl->tail != NULL);
-		hnode = hl->tail;
-		hl->tail = hl->tail->next;
-		hl->tail->prev = NULL;
-		freenode(hnode);
-		hl->nnodes--;
+	histloaded(hl, 0);
+	if (len == 0 || a_arr_len(hl->prefixes) == 0)
+		return NULL;
+	for (i = 0, d = 0; d < len; d += n) {
+		if (!(i = pfx_child(hl, i, prefix[d])))
+			return NULL;
+		node = pfxnode(hl, i);
+		n = a_min(node->len, len - d);
+		if (memcmp(pfxlabel(hl, node), prefix + d, n) != 0)
+			return NULL;
 	}
+	return histat(hl, pfxnode(hl, i)->newest);
+}
+
+
+
+/* -------------------------------------------------------------------------
+ * History list
+ * ------------------------------------------------------------------------- */
+
+/* initial number of slots in the ring (power of 2) */
+#define HISTRINGSIZE 	64
+
+
+/* Double the ring, entries move into their slots in the new ring. */
+ASHE_PRIVATE void growring(struct a_histlist *hl)
+{
+	struct a_histnode *ring;
+	a_uint32 cap, seq, end;
+
+	cap = (hl->ringcap ? hl->ringcap * 2 : HISTRINGSIZE);
+	ring = ashe_malloc(cap * sizeof(*ring));
+	end = hl->oldest + hl->nnodes;
+	for (seq = hl->oldest; seq != end; seq++)
+		ring[seq & (cap - 1)] = *histat(hl, seq);
+	ashe_free(hl->ring);
+	hl->ring = ring;
+	hl->ringcap = cap;
 }
 
 
-ASHE_PUBLIC struct a_histnode *ashe_newhisthead(struct a_histlist *hl, const char *contents)
+/*
+ * Copy contents of live entries into a new arena
+ * (oldest first) dropping the evicted bytes.
+ */
+ASHE_PRIVATE void compactarena(struct a_histlist *hl)
 {
 	struct a_histnode *hnode;
+	a_arr_char arena;
+	a_uint32 seq, end;
+
+	a_arr_char_init_cap(&arena, a_arr_len(hl->arena) - hl->dead);
+	end = hl->oldest + hl->nnodes;
+	for (seq = hl->oldest; seq != end; seq++) {
+		hnode = histat(hl, seq);
+		memcpy(a_arr_ptr(arena) + a_arr_len(arena), a_histstr(hl, hnode), hnode->len + 1);
+		hnode->off = a_arr_len(arena);
+		a_arr_len(arena) += hnode->len + 1;
+	}
+	a_arr_char_free(&hl->arena, NULL);
+	hl->arena = arena;
+	hl->dead = 0;
+}
 
-	checknodelimit(hl);
-	hnode = newnode(contents);
-	hnode->prev = hl->head;
-	hnode->next = NULL;
-	if (!hl->head)
-		hl->tail = hnode;
-	else
-		hl->head->next = hnode;
-	hl->head = hnode;
-	hl->nnodes++;
-	return hnode;
+
+/* Evict the oldest entry. */
+ASHE_PRIVATE void removetail(struct a_histlist *hl)
+{
+	ashe_assert(hl->nnodes > 0);
+	pfx_remove(hl, hl->oldest);
+	hl->dead += histat(hl, hl->oldest)->len + 1;
+	hl->oldest++;
+	hl->nnodes--;
+	if (hl->xloaded) { /* still in the index */
+		hl->xloaded--;
+		hl->xlazy++;
+	}
+	if (hl->dead > a_arr_len(hl->arena) / 2)
+		compactarena(hl);
+}
+
+
+/* Make room for a new entry, returns the arena offset for its contents. */
+ASHE_PRIVATE a_uint32 newnode(struct a_histlist *hl, const char *contents, a_uint32 len)
+{
+	a_uint32 off;
+
+	if (a_unlikely(hl->nnodes == hl->ringcap))
+		growring(hl);
+	off = a_arr_len(hl->arena);
+	a_arr_char_ensure(&hl->arena, len + 1);
+	memcpy(a_arr_ptr(hl->arena) + off, contents, len);
+	a_arr_ptr(hl->arena)[off + len] = '\0';
+	a_arr_len(hl->arena) += len + 1;
+	return off;
 }
 
 
-ASHE_PUBLIC struct a_histnode *ashe_newhisttail(struct a_histlist *hl, const char *contents)
+ASHE_PUBLIC void ashe_newhisthead(struct a_histlist *hl, const char *contents, a_uint32 len)
 {
 	struct a_histnode *hnode;
+	a_uint32 seq, off;
+
+	if (a_unlikely(hl->nnodes >= hl->limit))
+		removetail(hl);
+	off = newnode(hl, contents, len);
+	seq = hl->oldest + hl->nnodes;
+	hnode = histat(hl, seq);
+	hnode->off = off;
+	hnode->len = len;
+	hl->nnodes++;
+	pfx_insert(hl, seq, 1);
+}
 
-	checknodelimit(hl);
-	hnode = newnode(contents);
-	hnode->next = hl->tail;
-	hnode->prev = NULL;
-	if (!hl->tail)
-		hl->head = hnode;
-	else
-		hl->tail->prev = hnode;
-	hl->tail = hnode;
+
+/* Add entry older than all of the entries, dropped if history is full. */
+ASHE_PUBLIC void ashe_newhisttail(struct a_histlist *hl, const char *contents, a_uint32 len)
+{
+	struct a_histnode *hnode;
+	a_uint32 off;
+
+	if (a_unlikely(hl->nnodes >= hl->limit))
+		return;
+	off = newnode(hl, contents, len);
+	hnode = histat(hl, --hl->oldest);
+	hnode->off = off;
+	hnode->len = len;
 	hl->nnodes++;
-	return hnode;
+	pfx_insert(hl, hl->oldest, 0);
 }
 
 
-ASHE_PUBLIC const char *ashe_histprev(struct a_histlist *hl)
+ASHE_PRIVATE a_int32 readrecord(struct a_histlist *hl, a_uint64 i);
+
+
+/* Return entry being browsed (storing its length into 'len') or NULL. */
+ASHE_PUBLIC const char *ashe_histcurrent(struct a_histlist *hl, a_uint32 *len)
 {
-	if (!hl->current) {
-		hl->current = hl->head;
-		if (hl->current)
-			return hl->current->contents;
-	} else if (hl->current->prev) {
-		hl->current = hl->current->prev;
-		return hl->current->contents;
+	const struct a_histnode *hnode;
+
+	if (hl->current == 0)
+		return NULL;
+	if (hl->current > hl->nnodes) { /* read from the index */
+		*len = a_arr_len(hl->xbuf);
+		return a_arr_ptr(hl->xbuf);
 	}
+	hnode = histat(hl, hl->oldest + hl->nnodes - hl->current);
+	*len = hnode->len;
+	return a_histstr(hl, hnode);
+}
+
+
+/*
+ * Browse entry 'current' entries back from the head,
+ * entries older than the ones in the ring are read from
+ * the index. Returns NULL if the entry can't be read.
+ */
+ASHE_PRIVATE const char *histbrowse(struct a_histlist *hl, a_uint32 current)
+{
+	a_uint32 len;
+
+	if (current > hl->nnodes && readrecord(hl, hl->xlazy - (current - hl->nnodes)) < 0)
+		return NULL;
+	hl->current = current;
+	return ashe_histcurrent(hl, &len);
+}
+
+
+/* Return the previous entry, waits for the history to load. */
+ASHE_PUBLIC const char *ashe_histprev(struct a_histlist *hl)
+{
+	histloaded(hl, 1);
+	if (hl->current < hl->nnodes + hl->xlazy)
+		return histbrowse(hl, hl->current + 1);
 	return NULL;
 }
 
@@ -91,13 +335,11 @@ ASHE_PUBLIC const char *ashe_histprev(struct a_histlist *hl)
 ASHE_PUBLIC const char *ashe_histnext(struct a_histlist *hl)
 {
 	if (hl->current) {
-		if (!hl->current->next) {
-			hl->current = NULL;
+		if (hl->current == 1) {
+			hl->current = 0;
 			return "";
-		} else {
-			hl->current = hl->current->next;
-			return hl->current->contents;
 		}
+		return histbrowse(hl, hl->current - 1);
 	}
 	return NULL;
 }
@@ -105,107 +347,275 @@ ASHE_PUBLIC const char *ashe_histnext(struct a_histlist *hl)
 
 
 /* -------------------------------------------------------------------------
- * histbuff
+ * Indexed history file
  * ------------------------------------------------------------------------- */
 
 /*
- * Size of 'buffer' in 'histbuff'.
- * The size is equal to 'MAXCMDSIZE' which is the
- * maximum size of command + one byte for newline
- * character (that is how each line is saved inside
- * of history file).
- * This value ideally should be page size aligned.
+ * Indexed history file layout:
+ *
+ *   header | contents of entries | index | tail
+ *
+ * Index holds a 'struct histrecord' for each entry (oldest
+ * first) so entry 'i' is read without reading the ones
+ * before it. Tail holds commands appended (as lines) after
+ * the file was written, it is folded into the index when it
+ * grows as large as the history.
+ * Integers are in the host byte order, header with the byte
+ * order swapped fails the version check.
  */
-#define HISTBUFFSIZE 	(MAXCMDSIZE + 1)
+#define HISTMAGIC 	"ashehidx"
+#define HISTVERSION 	1
+
+struct histheader {
+	char magic[8];
+	a_uint32 version;
+	a_uint32 sum; /* checksum of the header with 'sum' set to 0 */
+	a_uint64 count; /* entries in the index */
+	a_uint64 index; /* file offset of the index */
+};
 
-struct histbuff {
-	FILE *fp;
-	a_ssize nread; /* unread bytes */
-	a_int32 pos; /* position in 'buffer' */
-	char buffer[HISTBUFFSIZE];
+struct histrecord {
+	a_uint64 off; /* file offset of contents */
+	a_uint32 len;
+	a_uint32 sum; /* checksum of contents */
 };
 
+ARRAY_NEW(a_arr_histrecord, struct histrecord)
 
-ASHE_PRIVATE void inithistbuff(struct histbuff *buff)
-{
-	buff->fp = NULL;
-	buff->pos = 0;
-	buff->nread = 0;
-}
+/* size of chunks copied between files */
+#define HISTCHUNK 	(1 << 16)
 
 
-ASHE_PRIVATE void fillhistbuff(struct histbuff *buff)
+/* FNV-1a hash of 'len' bytes of 'p' */
+ASHE_PRIVATE a_uint32 checksum(const void *p, a_memmax len)
 {
-	a_ssize rsize;
-	a_int32 saverrno;
+	const a_ubyte *s;
+	a_uint32 hash;
+
+	hash = 2166136261u;
+	for (s = p; len--; s++) {
+		hash ^= *s;
+		hash *= 16777619u;
+	}
+	return hash;
+}
 
-	ashe_assert(buff->fp != NULL);
-	ashe_assert(buff->nread == 0);
 
-	rsize = HISTBUFFSIZE - buff->pos;
-	buff->nread = fread(&buff->buffer[buff->pos], 1, rsize, buff->fp);
-	if (a_unlikely(buff->nread != rsize && ferror(buff->fp))) {
-		saverrno = errno; /* in case 'fclose' fails */
-		fclose(buff->fp);
-		errno = saverrno;
-		ashe_panic_libcall("fread");
+/* Read exactly 'len' bytes at 'off', returns -1 on error or EOF. */
+ASHE_PRIVATE a_int32 preadall(a_int32 fd, void *buf, a_memmax len, a_uint64 off)
+{
+	a_ssize n;
+
+	while (len > 0) {
+		if ((n = pread(fd, buf, len, off)) <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n == 0)
+				errno = EINVAL; /* truncated */
+			return -1;
+		}
+		buf = (char *)buf + n;
+		len -= n;
+		off += n;
 	}
+	return 0;
 }
 
 
-ASHE_PRIVATE const char *gethistline(struct histbuff *buff)
+ASHE_PRIVATE a_int32 pwriteall(a_int32 fd, const void *buf, a_memmax len, a_uint64 off)
 {
-	const char *buffp;
-	const char *base;
-	a_int32 len;
-	a_int32 toread;
-	a_ubyte haveline;
+	a_ssize n;
 
-	ashe_assert(buff->pos > 0 || buff->nread > 0);
+	while (len > 0) {
+		if ((n = pwrite(fd, buf, len, off)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf = (const char *)buf + n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
 
-	haveline = 0;
-	toread = buff->nread;
-	base = buff->buffer + buff->pos;
-	buffp = base;
-	len = 0;
 
-	while (buff->nread > 0 && (buffp = ashe_strnchr(buffp, buff->nread, '\n'))) {
-		buff->pos = (buffp - buff->buffer) + 1; /* +1 to skip newline */
-		len = buffp - base;
-		buff->nread = toread - len - 1;
-		if (!ashe_isescaped(base, len) && !ashe_indq(base, len)) {
-			haveline = 1;
+/* Copy 'len' bytes at 'from' in 'src' to 'to' in 'dst'. */
+ASHE_PRIVATE a_int32 copyrange(a_int32 src, a_uint64 from, a_int32 dst, a_uint64 to, a_uint64 len)
+{
+	char *buf;
+	a_memmax n;
+	a_int32 status;
+
+	status = 0;
+	buf = ashe_malloc(HISTCHUNK);
+	for (; len > 0; len -= n, from += n, to += n) {
+		n = a_min(len, HISTCHUNK);
+		if (preadall(src, buf, n, from) < 0 || pwriteall(dst, buf, n, to) < 0) {
+			status = -1;
 			break;
 		}
-		buffp++; /* skip newline */
 	}
+	ashe_free(buf);
+	return status;
+}
 
-	if (!haveline && !feof(buff->fp)) {
-		if (a_unlikely(base == buff->buffer)) { /* command overflows ? */
-			fclose(buff->fp);
-			ashe_panicf("Unescaped quotes ('\"') in history file, "
-				"please remove or clear the history file! "
-				"According to the 'aconf.h' history file "
-				"is located at '%s'.", ASHE_HISTFILEPATH);
-		}
-		buff->pos += buff->nread;
-		buff->nread = 0;
-		len = HISTBUFFSIZE - (base - buff->buffer);
-		memmove(buff->buffer, base, len);
-		buff->pos = len;
-		fillhistbuff(buff);
-		return gethistline(buff);
-	} else {
-		if (!haveline) { /* file ends without newline char ? */
-			buff->pos += buff->nread;
-			ashe_assert(buff->pos <= HISTBUFFSIZE);
-			ashe_assert(&base[toread-1] == &buff->buffer[buff->pos-1]);
-			buff->nread = 0;
-			len = toread;
-		}
-		if (len > 0) return ashe_dupstrn(base, len);
-		return NULL;
+
+/*
+ * Read and validate the header of the indexed history
+ * file 'fd' of 'size' bytes.
+ * Returns 0 if it is valid, 1 if the file is not indexed
+ * and -1 if it is damaged or on read error.
+ */
+ASHE_PRIVATE a_int32 readheader(a_int32 fd, a_uint64 size, struct histheader *hdr)
+{
+	a_uint32 sum;
+
+	if (size < sizeof(*hdr) || preadall(fd, hdr, sizeof(*hdr), 0) < 0 ||
+	    memcmp(hdr->magic, HISTMAGIC, sizeof(hdr->magic)) != 0)
+		return 1;
+	sum = hdr->sum;
+	hdr->sum = 0;
+	if (hdr->version != HISTVERSION || checksum(hdr, sizeof(*hdr)) != sum ||
+	    hdr->index < sizeof(*hdr) || hdr->index > size ||
+	    hdr->count > (size - hdr->index) / sizeof(struct histrecord)) {
+		errno = EINVAL;
+		return -1;
 	}
+	hdr->sum = sum;
+	return 0;
+}
+
+
+/* Check that record 'rec' is before the index at 'index'. */
+#define validrecord(index, rec) \
+	((rec)->off >= sizeof(struct histheader) && (rec)->off <= (index) && \
+	 (rec)->len <= (index) - (rec)->off)
+
+
+/*
+ * Writer of the indexed history file, contents of entries
+ * are buffered and the index is kept in memory until
+ * 'hw_finish()'.
+ */
+struct histwriter {
+	a_int32 fd;
+	a_int32 status;
+	a_uint64 off; /* file offset of 'buf' */
+	a_arr_char buf;
+	a_arr_histrecord index;
+};
+
+
+ASHE_PRIVATE void hw_init(struct histwriter *hw, a_int32 fd)
+{
+	hw->fd = fd;
+	hw->status = 0;
+	hw->off = sizeof(struct histheader);
+	a_arr_char_init(&hw->buf);
+	a_arr_histrecord_init(&hw->index);
+}
+
+
+ASHE_PRIVATE void hw_flush(struct histwriter *hw)
+{
+	if (hw->status == 0 && pwriteall(hw->fd, a_arr_ptr(hw->buf), a_arr_len(hw->buf), hw->off) < 0)
+		hw->status = -1;
+	hw->off += a_arr_len(hw->buf);
+	a_arr_len(hw->buf) = 0;
+}
+
+
+/* Add entry, signature matches 'histentryfn'. */
+ASHE_PRIVATE void hw_add(void *ctx, const char *entry, a_uint32 len)
+{
+	struct histwriter *hw;
+
+	hw = ctx;
+	a_arr_histrecord_push(&hw->index, (struct histrecord){
+		.off = hw->off + a_arr_len(hw->buf),
+		.len = len,
+		.sum = checksum(entry, len),
+	});
+	a_arr_char_push_str(&hw->buf, entry, len);
+	if (a_arr_len(hw->buf) >= HISTCHUNK)
+		hw_flush(hw);
+}
+
+
+/*
+ * Add all of the entries in the index of 'src', must be
+ * called before any other entry is added. Contents are
+ * copied as is so the records stay valid.
+ */
+ASHE_PRIVATE void hw_addindexed(struct histwriter *hw, a_int32 src, const struct histheader *hdr)
+{
+	a_uint64 len;
+
+	ashe_assert(a_arr_len(hw->index) == 0 && a_arr_len(hw->buf) == 0);
+	len = hdr->index - hw->off;
+	if (hw->status == 0 && copyrange(src, hw->off, hw->fd, hw->off, len) < 0)
+		hw->status = -1;
+	hw->off += len;
+	if (a_unlikely(hdr->count > UINT32_MAX)) {
+		hw->status = -1;
+		return;
+	}
+	a_arr_histrecord_ensure(&hw->index, hdr->count);
+	if (hw->status == 0 && preadall(src, a_arr_ptr(hw->index), hdr->count * sizeof(struct histrecord),
+					hdr->index) < 0)
+		hw->status = -1;
+	a_arr_len(hw->index) = hdr->count;
+}
+
+
+/*
+ * Write the index and the header, returns -1 if anything
+ * failed, 'hdr' (if not NULL) receives the header.
+ */
+ASHE_PRIVATE a_int32 hw_finish(struct histwriter *hw, struct histheader *hdr)
+{
+	struct histheader h;
+
+	hw_flush(hw);
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, HISTMAGIC, sizeof(h.magic));
+	h.version = HISTVERSION;
+	h.count = a_arr_len(hw->index);
+	h.index = hw->off;
+	h.sum = checksum(&h, sizeof(h));
+	if (hw->status == 0 && (pwriteall(hw->fd, a_arr_ptr(hw->index),
+					  h.count * sizeof(struct histrecord), h.index) < 0 ||
+				pwriteall(hw->fd, &h, sizeof(h), 0) < 0))
+		hw->status = -1;
+	a_arr_char_free(&hw->buf, NULL);
+	a_arr_histrecord_free(&hw->index, NULL);
+	if (hdr)
+		*hdr = h;
+	return hw->status;
+}
+
+
+
+/*
+ * Read entry 'i' of the index into 'xbuf', returns -1
+ * if it can't be read or it is damaged.
+ */
+ASHE_PRIVATE a_int32 readrecord(struct a_histlist *hl, a_uint64 i)
+{
+	struct histrecord rec;
+
+	if (preadall(hl->fd, &rec, sizeof(rec), hl->xindex + i * sizeof(rec)) < 0 ||
+	    !validrecord(hl->xindex, &rec))
+		return -1;
+	a_arr_len(hl->xbuf) = 0;
+	a_arr_char_ensure(&hl->xbuf, rec.len + 1);
+	if (preadall(hl->fd, a_arr_ptr(hl->xbuf), rec.len, rec.off) < 0 ||
+	    checksum(a_arr_ptr(hl->xbuf), rec.len) != rec.sum)
+		return -1;
+	a_arr_len(hl->xbuf) = rec.len;
+	a_arr_ptr(hl->xbuf)[rec.len] = '\0';
+	return 0;
 }
 
 
@@ -222,95 +632,827 @@ ASHE_PRIVATE void getrealfilepath(a_arr_char *buffer, const char *filepath)
 }
 
 
-ASHE_PRIVATE a_int32 readhistoryfile(struct a_histlist *hl, const char *filepath)
+/* upper bound of '$ASHE_HISTLIMIT', sequence numbers must not wrap */
+#define HISTLIMITMAX 	(1u << 24)
+
+
+/* Return history limit, '$ASHE_HISTLIMIT' or the default. */
+ASHE_PRIVATE a_uint32 histlimit(void)
 {
-	const char *cmd;
-	struct histbuff buff;
-	a_arr_char filebuff;
-	a_int32 status;
+	const char *s;
+	char *end;
+	unsigned long n;
+
+	if ((s = getenv("ASHE_HISTLIMIT")) != NULL) {
+		errno = 0;
+		n = strtoul(s, &end, 10);
+		if (errno == 0 && *s != '\0' && *end == '\0' && n > 0 && n <= HISTLIMITMAX)
+			return n;
+	}
+	return ASHE_HISTLIMIT;
+}
 
-	status = 0;
-	inithistbuff(&buff);
-	a_arr_char_init(&filebuff);
 
-	if (!filepath)
-		filepath = ASHE_HISTFILEPATH;
+/* called for each entry found by 'splithistory()' */
+typedef void (*histentryfn)(void *ctx, const char *entry, a_uint32 len);
+
+
+/*
+ * Split lines in 'buf' of 'size' bytes into entries, a
+ * newline ends an entry unless it is escaped or inside of
+ * double quotes. Lines and quotes are found with 'memchr()'
+ * and quote state carries over lines of the same entry, so
+ * every byte is looked at once.
+ * Calls 'fn' (if not NULL) for each entry and returns the
+ * number of entries.
+ */
+ASHE_PRIVATE a_memmax splithistory(const char *buf, a_memmax size, histentryfn fn, void *ctx)
+{
+	const char *p, *q, *nl, *entry, *end;
+	a_memmax n;
+	a_ubyte dq;
+
+	n = 0;
+	dq = 0;
+	end = buf + size;
+	for (p = entry = buf; p < end; p = nl + 1) {
+		if (!(nl = memchr(p, '\n', end - p)))
+			nl = end;
+		for (q = p; (q = memchr(q, '"', nl - q)); q++)
+			dq ^= 1;
+		if (nl < end && (dq || (nl > entry && nl[-1] == '\\')))
+			continue; /* newline is part of the entry */
+		if (nl > entry) {
+			if (fn)
+				fn(ctx, entry, nl - entry);
+			n++;
+		}
+		entry = nl + 1;
+		dq = 0;
+	}
+	if (entry < end) { /* unterminated entry */
+		if (fn)
+			fn(ctx, entry, end - entry);
+		n++;
+	}
+	return n;
+}
+
+
+/* the last 'cap' entries found by 'splithistory()' */
+struct histspans {
+	struct histspan {
+		const char *entry;
+		a_uint32 len;
+	} *spans; /* ring */
+	a_memmax cap;
+	a_memmax n; /* entries seen */
+};
+
+
+ASHE_PRIVATE void addspan(void *ctx, const char *entry, a_uint32 len)
+{
+	struct histspans *hs;
+
+	hs = ctx;
+	hs->spans[hs->n++ % hs->cap] = (struct histspan){ entry, len };
+}
+
+
+/*
+ * Add the last 'limit' entries of 'buf' to the history,
+ * evicted ones are never copied. Returns the number of
+ * entries in 'buf'.
+ */
+ASHE_PRIVATE a_memmax addlines(struct a_histlist *hl, const char *buf, a_memmax size, a_uint32 limit)
+{
+	struct histspans hs;
+	struct histspan *span;
+	a_memmax i, first, len;
+
+	if (limit == 0)
+		return splithistory(buf, size, NULL, NULL);
+	hs.spans = ashe_malloc(limit * sizeof(*hs.spans));
+	hs.cap = limit;
+	hs.n = 0;
+	splithistory(buf, size, addspan, &hs);
+	first = (hs.n > limit ? hs.n - limit : 0);
+	for (len = 0, i = first; i < hs.n; i++) /* size the arena upfront */
+		len += hs.spans[i % limit].len + 1;
+	a_arr_char_ensure(&hl->arena, len);
+	for (i = first; i < hs.n; i++) {
+		span = &hs.spans[i % limit];
+		ashe_newhisthead(hl, span->entry, span->len);
+	}
+	ashe_free(hs.spans);
+	return hs.n;
+}
+
 
-	getrealfilepath(&filebuff, filepath);
-	filepath = a_arr_ptr(filebuff);
+/*
+ * Load indexed history file, only the newest entries
+ * that fit into the history are read from the index.
+ */
+ASHE_PRIVATE a_int32 readindexed(struct a_histlist *hl, a_int32 fd, a_uint64 size,
+				 const struct histheader *hdr)
+{
+	struct histrecord *recs;
+	a_arr_char lines, contents;
+	a_uint64 tail, first, start, end, i, k;
+	a_memmax ntail;
+	a_int32 status;
 
-	if (a_unlikely((buff.fp = fopen(filepath, "r")) == NULL))
+	status = 0;
+	recs = NULL;
+	a_arr_char_init(&lines);
+	a_arr_char_init(&contents);
+	tail = hdr->index + hdr->count * sizeof(struct histrecord);
+	if (a_unlikely(size - tail > UINT32_MAX))
 		a_defer(-1);
 
-	fillhistbuff(&buff); /* prime buffer */
-	while (!feof(buff.fp) || buff.nread > 0) {
-		if ((cmd = gethistline(&buff)) != NULL)
-			ashe_newhisthead(hl, cmd);
+	/* tail goes in last, count its entries first */
+	a_arr_char_ensure(&lines, size - tail);
+	if (preadall(fd, a_arr_ptr(lines), size - tail, tail) < 0)
+		a_defer(-1);
+	ntail = splithistory(a_arr_ptr(lines), size - tail, NULL, NULL);
+	k = a_min(hdr->count, hl->limit - a_min(ntail, hl->limit));
+	first = hdr->count - k;
+
+	if (k > 0) { /* newest entries in the index */
+		recs = ashe_malloc(k * sizeof(*recs));
+		if (preadall(fd, recs, k * sizeof(*recs), hdr->index + first * sizeof(*recs)) < 0)
+			a_defer(-1);
+		for (i = 0; i < k; i++) {
+			if (!validrecord(hdr->index, &recs[i]) || (i > 0 && recs[i].off < recs[i - 1].off))
+				a_defer(-1);
+		}
+		start = recs[0].off;
+		end = a_max(recs[k - 1].off + recs[k - 1].len, start);
+		if (a_unlikely(end - start > UINT32_MAX))
+			a_defer(-1);
+		a_arr_char_ensure(&contents, end - start);
+		if (preadall(fd, a_arr_ptr(contents), end - start, start) < 0)
+			a_defer(-1);
+		for (i = 0; i < k; i++) { /* check all before adding any */
+			if (recs[i].off + recs[i].len > end ||
+			    checksum(a_arr_ptr(contents) + recs[i].off - start, recs[i].len) != recs[i].sum)
+				a_defer(-1);
+		}
+		a_arr_char_ensure(&hl->arena, end - start + k);
+		for (i = 0; i < k; i++)
+			ashe_newhisthead(hl, a_arr_ptr(contents) + recs[i].off - start, recs[i].len);
 	}
+	addlines(hl, a_arr_ptr(lines), size - tail, hl->limit);
+	hl->indexed = 1;
+	hl->xcount = hdr->count;
+	hl->xindex = hdr->index;
+	hl->xloaded = k;
+	hl->xlazy = first;
+	hl->nlines = ntail;
 
 defer:
-	if (buff.fp) fclose(buff.fp);
-	a_arr_char_free(&filebuff, NULL);
+	if (status < 0)
+		errno = EINVAL; /* truncated or damaged */
+	ashe_free(recs);
+	a_arr_char_free(&lines, NULL);
+	a_arr_char_free(&contents, NULL);
 	return status;
 }
 
 
+/*
+ * Map the history file 'fd' and add the entries within
+ * its first 'size' bytes that fit into the history,
+ * evicted ones are never copied.
+ */
+ASHE_PRIVATE a_int32 readhistoryfile(struct a_histlist *hl, a_int32 fd, a_uint64 size)
+{
+	struct histheader hdr;
+	const char *map;
+	a_int32 status;
+
+	if (size == 0)
+		return 0;
+	if ((status = readheader(fd, size, &hdr)) <= 0)
+		return (status == 0 ? readindexed(hl, fd, size, &hdr) : -1);
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	if (a_unlikely(map == MAP_FAILED))
+		return -1;
+	hl->nlines = addlines(hl, map, size, hl->limit);
+	munmap((void *)map, size);
+	return 0;
+}
+
+
+/* Start thread running 'fn', signals stay with the main thread. */
+ASHE_PRIVATE void startthread(pthread_t *thread, void *(*fn)(void *))
+{
+	sigset_t set, old;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old);
+	if (a_unlikely(pthread_create(thread, NULL, fn, NULL) != 0))
+		ashe_panic_libcall(pthread_create);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+
+/*
+ * History file being loaded by the thread into 'hl', its
+ * entries replace the ones in the history once the thread
+ * is done.
+ */
+ASHE_PRIVATE struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	struct a_histlist hl;
+	a_uint64 size; /* bytes to read, the rest was appended by us */
+	a_int32 fd;
+	a_int32 status;
+	a_int32 err; /* 'errno' if 'status' is -1 */
+	a_ubyte canfail;
+	a_ubyte failed; /* load failed and wasn't reported yet */
+	a_ubyte running; /* thread was started and its entries not taken */
+	a_ubyte done; /* thread finished (protected by 'lock') */
+} load = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+ASHE_PRIVATE void *loadworker(void *arg)
+{
+	a_int32 status;
+
+	ASHE_UNUSED(arg);
+	status = readhistoryfile(&load.hl, load.fd, load.size);
+	load.err = errno;
+	close(load.fd);
+	pthread_mutex_lock(&load.lock);
+	load.status = status;
+	load.done = 1;
+	pthread_mutex_unlock(&load.lock);
+	return NULL;
+}
+
+
+/*
+ * Take the entries loaded by the thread if it is done (or
+ * wait for it if 'wait' is set), entries added meanwhile
+ * go on top of them. Returns 0 if history is still loading.
+ */
+ASHE_PRIVATE a_ubyte histloaded(struct a_histlist *hl, a_ubyte wait)
+{
+	struct a_histlist *ld;
+	struct a_histnode *hnode;
+	a_uint32 seq, end;
+	a_ubyte done;
+
+	if (!load.running)
+		return 1;
+	pthread_mutex_lock(&load.lock);
+	done = load.done;
+	pthread_mutex_unlock(&load.lock);
+	if (!done && !wait)
+		return 0;
+	pthread_join(load.thread, NULL);
+	load.running = 0;
+	ld = &load.hl;
+	if (a_unlikely(load.status < 0)) { /* same as if it couldn't be opened */
+		load.failed = 1; /* reported by ashe_histcheck() */
+		ashe_freehistnodes(ld);
+		if (hl->fd >= 0)
+			close(hl->fd);
+		hl->fd = -1;
+		a_arr_len(hl->pending) = 0;
+		return 1;
+	}
+	end = hl->oldest + hl->nnodes;
+	for (seq = hl->oldest; seq != end; seq++) {
+		hnode = histat(hl, seq);
+		ashe_newhisthead(ld, a_histstr(hl, hnode), hnode->len);
+	}
+	ashe_free(hl->ring);
+	a_arr_char_free(&hl->arena, NULL);
+	a_arr_histprefix_free(&hl->prefixes, NULL);
+	hl->nnodes = ld->nnodes;
+	hl->ring = ld->ring;
+	hl->ringcap = ld->ringcap;
+	hl->oldest = ld->oldest;
+	hl->current = a_min(hl->current, ld->nnodes);
+	hl->arena = ld->arena;
+	hl->dead = ld->dead;
+	hl->prefixes = ld->prefixes;
+	hl->freeprefix = ld->freeprefix;
+	hl->nlines += ld->nlines;
+	hl->indexed = ld->indexed;
+	hl->xcount = ld->xcount;
+	hl->xindex = ld->xindex;
+	hl->xlazy = ld->xlazy;
+	hl->xloaded = ld->xloaded;
+	return 1;
+}
+
+
+/*
+ * Called before reading each input, takes the entries
+ * if the history finished loading and reports if that
+ * failed. When failing isn't allowed the load is waited
+ * for, so a bad history file panics before the first
+ * prompt instead of inside some history access.
+ */
+ASHE_PUBLIC void ashe_histcheck(struct a_histlist *hl)
+{
+	histloaded(hl, !load.canfail);
+	if (a_likely(!load.failed))
+		return;
+	load.failed = 0;
+	errno = load.err;
+	if (!load.canfail)
+		ashe_panic_libcall(read);
+	ashe_perrno("history file '%s'", a_arr_ptr(hl->path));
+}
+
+
+/*
+ * Open history file 'filepath' (default if NULL) for
+ * appending, file is created if it doesn't exist.
+ * Its entries are loaded in the background, so the
+ * time it takes doesn't depend on the size of the file.
+ */
 ASHE_PUBLIC void ashe_inithist(struct a_histlist *hl, const char *filepath, int canfail)
 {
+	struct stat st;
+	a_int32 fd;
+
 	memset(hl, 0, sizeof(*hl));
-	if (readhistoryfile(hl, filepath) < 0) {
+	hl->fd = -1;
+	hl->limit = histlimit();
+	getrealfilepath(&hl->path, (filepath ? filepath : ASHE_HISTFILEPATH));
+	if ((fd = open(a_arr_ptr(hl->path), O_RDONLY | O_CLOEXEC)) >= 0 && fstat(fd, &st) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0 && errno != ENOENT) {
 		if (canfail) {
 			ashe_freehistnodes(hl);
 			memset(hl, 0, sizeof(*hl));
-		} else {
-			ashe_panic_libcall("fopen");
+			hl->fd = -1;
+			hl->limit = histlimit();
+			return;
 		}
+		ashe_panic_libcall("fopen");
+	}
+	hl->fd = open(a_arr_ptr(hl->path), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (a_unlikely(hl->fd < 0 && !canfail))
+		ashe_panic_libcall("open");
+	if (fd >= 0) {
+		memset(&load.hl, 0, sizeof(load.hl));
+		load.hl.fd = -1;
+		load.hl.limit = hl->limit;
+		load.fd = fd;
+		load.size = st.st_size;
+		load.canfail = canfail;
+		load.failed = 0;
+		load.done = 0;
+		startthread(&load.thread, loadworker);
+		load.running = 1;
 	}
 }
 
 
-
 /* -------------------------------------------------------------------------
- * Save to history file
+ * Append to history file
  * ------------------------------------------------------------------------- */
 
-ASHE_PRIVATE a_int32 savehistoryfile(struct a_histlist *hl, const char *filepath)
+/*
+ * Rewrite of the history file, written into 'fd' by the
+ * thread while the shell keeps appending into the old file.
+ * Plain history file gets lines of entries in the ring,
+ * indexed one gets its tail up to 'size' folded into the
+ * index. Lines appended past 'size' meanwhile are copied
+ * to the new file once the thread is done.
+ */
+ASHE_PRIVATE struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	a_arr_char buf; /* lines to write */
+	a_arr_char tmppath; /* new file, renamed over the old one when done */
+	a_int32 fd;
+	a_int32 src; /* old indexed file */
+	struct histheader hdr; /* header of 'src', then of the new file */
+	a_uint64 size; /* size of the old file when the rewrite started */
+	a_uint64 len; /* bytes written into the new plain file */
+	a_memmax nlines; /* entries in them */
+	a_ubyte indexed;
+	a_ubyte running; /* thread was started and not joined */
+	a_ubyte done; /* thread finished (protected by 'lock') */
+	a_ubyte failed;
+} compact = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+/* Write all 'len' bytes of 'buf' into 'fd', returns -1 on error. */
+ASHE_PRIVATE a_int32 writeall(a_int32 fd, const char *buf, a_memmax len)
+{
+	a_ssize n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+/* Push lines of entries from 'seq' up to the head into 'out'. */
+ASHE_PRIVATE void pushlines(struct a_histlist *hl, a_arr_char *out, a_uint32 seq)
+{
+	struct a_histnode *hnode;
+	a_uint32 end;
+
+	end = hl->oldest + hl->nnodes;
+	for (; seq != end; seq++) {
+		hnode = histat(hl, seq);
+		a_arr_char_ensure(out, hnode->len + 1);
+		memcpy(a_arr_ptr(*out) + a_arr_len(*out), a_histstr(hl, hnode), hnode->len);
+		a_arr_len(*out) += hnode->len;
+		a_arr_ptr(*out)[a_arr_len(*out)++] = '\n';
+	}
+}
+
+
+/* Write the index of 'src' followed by entries in its tail. */
+ASHE_PRIVATE a_int32 rebuildindexed(void)
+{
+	struct histwriter hw;
+	a_uint64 tail;
+
+	hw_init(&hw, compact.fd);
+	hw_addindexed(&hw, compact.src, &compact.hdr);
+	tail = compact.hdr.index + compact.hdr.count * sizeof(struct histrecord);
+	a_arr_len(compact.buf) = 0;
+	a_arr_char_ensure(&compact.buf, compact.size - tail);
+	if (preadall(compact.src, a_arr_ptr(compact.buf), compact.size - tail, tail) < 0)
+		hw.status = -1;
+	else
+		splithistory(a_arr_ptr(compact.buf), compact.size - tail, hw_add, &hw);
+	return hw_finish(&hw, &compact.hdr);
+}
+
+
+ASHE_PRIVATE void *compactworker(void *arg)
+{
+	a_ubyte failed;
+
+	ASHE_UNUSED(arg);
+	if (compact.indexed)
+		failed = (rebuildindexed() < 0);
+	else
+		failed = (writeall(compact.fd, a_arr_ptr(compact.buf), a_arr_len(compact.buf)) < 0);
+	failed = (failed || fsync(compact.fd) < 0);
+	pthread_mutex_lock(&compact.lock);
+	compact.failed = failed;
+	compact.done = 1;
+	pthread_mutex_unlock(&compact.lock);
+	return NULL;
+}
+
+
+/*
+ * Start rewriting the history file, plain one keeps only
+ * the entries in 'hl' and indexed one gets its tail moved
+ * into the index. Nothing is done if the new file can't be
+ * created.
+ */
+ASHE_PRIVATE void startcompact(struct a_histlist *hl)
+{
+	struct stat st;
+	a_uint32 len;
+
+	a_arr_len(compact.tmppath) = 0;
+	len = a_arr_len(hl->path) - 1;
+	a_arr_char_push_str(&compact.tmppath, a_arr_ptr(hl->path), len);
+	a_arr_char_push_str(&compact.tmppath, ".XXXXXX", sizeof(".XXXXXX"));
+	if (fstat(hl->fd, &st) < 0)
+		return;
+	if ((compact.fd = mkstemp(a_arr_ptr(compact.tmppath))) < 0)
+		return;
+	fcntl(compact.fd, F_SETFD, FD_CLOEXEC);
+	a_arr_len(compact.buf) = 0;
+	compact.indexed = hl->indexed;
+	compact.size = st.st_size;
+	if (hl->indexed) {
+		compact.src = hl->fd;
+		memset(&compact.hdr, 0, sizeof(compact.hdr));
+		compact.hdr.count = hl->xcount;
+		compact.hdr.index = hl->xindex;
+	} else {
+		pushlines(hl, &compact.buf, hl->oldest);
+		compact.len = a_arr_len(compact.buf);
+		compact.nlines = hl->nnodes;
+	}
+	compact.done = 0;
+	compact.failed = 0;
+	startthread(&compact.thread, compactworker);
+	compact.running = 1;
+}
+
+
+/*
+ * Copy lines appended to the old file after the rewrite
+ * started, by us or by other shells, to 'tail' in the new
+ * file, returns the number of entries in them or -1 on error.
+ */
+ASHE_PRIVATE a_ssize copytail(struct a_histlist *hl, a_uint64 tail)
+{
+	struct stat st;
+
+	if (fstat(hl->fd, &st) < 0)
+		return -1;
+	a_arr_len(compact.buf) = 0;
+	a_arr_char_ensure(&compact.buf, st.st_size - compact.size);
+	if (preadall(hl->fd, a_arr_ptr(compact.buf), st.st_size - compact.size, compact.size) < 0 ||
+	    pwriteall(compact.fd, a_arr_ptr(compact.buf), st.st_size - compact.size, tail) < 0)
+		return -1;
+	return splithistory(a_arr_ptr(compact.buf), st.st_size - compact.size, NULL, NULL);
+}
+
+
+/*
+ * Finish the rewrite if the thread is done (or wait for it
+ * if 'wait' is set). Lines appended to the old file after
+ * the rewrite started are copied to the new file which then
+ * replaces the old one, history file is left as is if
+ * anything fails.
+ */
+ASHE_PRIVATE a_int32 finishcompact(struct a_histlist *hl, a_ubyte wait)
+{
+	a_ssize ntail;
+	a_ubyte done;
+
+	if (!compact.running)
+		return 0;
+	pthread_mutex_lock(&compact.lock);
+	done = compact.done;
+	pthread_mutex_unlock(&compact.lock);
+	if (!done && !wait)
+		return 0;
+	pthread_join(compact.thread, NULL);
+	compact.running = 0;
+	ntail = 0;
+	if (a_likely(!compact.failed)) {
+		/* queued entries go into the old file and get copied with it */
+		if (a_arr_len(hl->pending) &&
+		    writeall(hl->fd, a_arr_ptr(hl->pending), a_arr_len(hl->pending)) == 0)
+			a_arr_len(hl->pending) = 0;
+		if (compact.indexed)
+			ntail = copytail(hl, compact.hdr.index +
+					     compact.hdr.count * sizeof(struct histrecord));
+		else
+			ntail = copytail(hl, compact.len);
+		if (ntail >= 0 && fcntl(compact.fd, F_SETFL, O_APPEND) == 0 &&
+		    rename(a_arr_ptr(compact.tmppath), a_arr_ptr(hl->path)) == 0) {
+			close(hl->fd);
+			hl->fd = compact.fd;
+			a_arr_len(compact.buf) = 0;
+			if (compact.indexed) {
+				/* ring entries before the tail are the newest in the index */
+				hl->nlines = ntail;
+				hl->xcount = compact.hdr.count;
+				hl->xindex = compact.hdr.index;
+				hl->xloaded = (hl->nnodes > (a_memmax)ntail ? hl->nnodes - ntail : 0);
+				hl->xlazy = hl->xcount - a_min(hl->xloaded, hl->xcount);
+			} else {
+				hl->nlines = compact.nlines + ntail;
+			}
+			return 0;
+		}
+	}
+	close(compact.fd);
+	unlink(a_arr_ptr(compact.tmppath));
+	a_arr_len(compact.buf) = 0;
+	return -1;
+}
+
+
+/*
+ * Add accepted command to the head and queue it for
+ * appending into the history file, it gets written
+ * by the next 'ashe_histflush()'.
+ */
+ASHE_PUBLIC void ashe_histappend(struct a_histlist *hl, const char *contents, a_uint32 len)
+{
+	ashe_newhisthead(hl, contents, len);
+	if (hl->fd >= 0) {
+		pushlines(hl, &hl->pending, hl->oldest + hl->nnodes - 1);
+		hl->nlines++;
+	}
+}
+
+
+/*
+ * Append queued entries to the history file with a single
+ * write, each write is appended atomically so commands of
+ * other shells using the same file don't interleave with
+ * ours. Plain history file is rewritten in the background
+ * once it holds twice as many entries as the history can,
+ * indexed one once its tail holds as many (not before the
+ * history is loaded).
+ */
+ASHE_PUBLIC a_int32 ashe_histflush(struct a_histlist *hl)
 {
-	FILE *fp;
-	a_arr_char buffer;
-	struct a_histnode *node;
-	size_t len;
 	a_int32 status;
+	a_ubyte loaded;
+
+	status = finishcompact(hl, 0);
+	loaded = histloaded(hl, 0);
+	if (a_arr_len(hl->pending) == 0 || hl->fd < 0)
+		return status;
+	if (writeall(hl->fd, a_arr_ptr(hl->pending), a_arr_len(hl->pending)) < 0)
+		status = -1;
+	a_arr_len(hl->pending) = 0;
+	if (loaded && !compact.running && hl->nlines >= (hl->indexed ? 1 : 2) * (a_memmax)hl->limit)
+		startcompact(hl);
+	return status;
+}
 
 
-	status = 0;
-	a_arr_char_init(&buffer);
 
-	/* early return if no history */
-	if (!hl->head) return status;
+/* -------------------------------------------------------------------------
+ * Convert history file
+ * ------------------------------------------------------------------------- */
 
-	if (!filepath) filepath = ASHE_HISTFILEPATH;
+/*
+ * Create temporary file next to 'dst' storing its path
+ * into 'tmppath', returns its descriptor or -1.
+ */
+ASHE_PRIVATE a_int32 createtmp(a_arr_char *tmppath, const char *dst)
+{
+	a_int32 fd;
 
-	getrealfilepath(&buffer, filepath);
-	filepath = a_arr_ptr(buffer);
+	a_arr_char_push_str(tmppath, dst, strlen(dst));
+	a_arr_char_push_str(tmppath, ".XXXXXX", sizeof(".XXXXXX"));
+	if ((fd = mkstemp(a_arr_ptr(*tmppath))) >= 0)
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	return fd;
+}
 
-	if (a_unlikely((fp = fopen(filepath, "w")) == NULL))
-		a_defer(-1);
 
-	a_arr_len(buffer) = 0;
+/*
+ * Sync temporary file 'fd' and rename it to 'dst' if
+ * 'status' is 0, otherwise (or if it fails) remove it.
+ */
+ASHE_PRIVATE a_int32 committmp(a_int32 fd, a_arr_char *tmppath, const char *dst, a_int32 status)
+{
+	a_int32 saverrno;
 
-	for (node = hl->tail; node; node = node->next) {
-		len = node->len;
-		a_arr_char_push_str(&buffer, node->contents, len++);
-		a_arr_char_push(&buffer, '\n');
-		if (a_unlikely(fwrite(a_arr_ptr(buffer), 1, len, fp) != len))
-			a_defer(-1);
-		a_arr_len(buffer) = 0;
+	if (status == 0 && (fsync(fd) < 0 || rename(a_arr_ptr(*tmppath), dst) < 0))
+		status = -1;
+	saverrno = errno;
+	close(fd);
+	if (status < 0)
+		unlink(a_arr_ptr(*tmppath));
+	errno = saverrno;
+	return status;
+}
+
+
+/*
+ * Open history file 'path' for reading, 'hdr' receives
+ * its header. Returns the descriptor or -1 on error,
+ * 'indexed' is set if the file is indexed.
+ */
+ASHE_PRIVATE a_int32 openhistory(const char *path, struct stat *st, struct histheader *hdr,
+				 a_int32 *indexed)
+{
+	a_int32 fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	if (fstat(fd, st) < 0 || (*indexed = readheader(fd, st->st_size, hdr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	*indexed = !*indexed;
+	return fd;
+}
+
+
+/*
+ * Write indexed history file 'dst' with entries of the
+ * plain history file 'src'.
+ * Returns -1 and sets errno on error (EINVAL if 'src' is
+ * already indexed).
+ */
+ASHE_PUBLIC a_int32 ashe_histimport(const char *src, const char *dst)
+{
+	struct histwriter hw;
+	struct histheader hdr;
+	struct stat st;
+	a_arr_char tmppath;
+	const char *map;
+	a_int32 fd, out, indexed, status;
+
+	if ((fd = openhistory(src, &st, &hdr, &indexed)) < 0)
+		return -1;
+	if (indexed) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
 	}
+	map = NULL;
+	if (st.st_size > 0 &&
+	    (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	a_arr_char_init(&tmppath);
+	status = -1;
+	if ((out = createtmp(&tmppath, dst)) >= 0) {
+		hw_init(&hw, out);
+		splithistory(map, st.st_size, hw_add, &hw);
+		status = committmp(out, &tmppath, dst, hw_finish(&hw, NULL));
+	}
+	a_arr_char_free(&tmppath, NULL);
+	if (map)
+		munmap((void *)map, st.st_size);
+	return status;
+}
+
 
+/* Write lines of entries in the index of 'fd' to 'out'. */
+ASHE_PRIVATE a_int32 exportindex(a_int32 fd, const struct histheader *hdr, a_int32 out)
+{
+	struct histrecord *recs, *rec;
+	a_arr_char buf;
+	a_uint64 i, k, n;
+	a_int32 status;
+
+	status = 0;
+	a_arr_char_init(&buf);
+	recs = ashe_malloc(HISTCHUNK);
+	for (i = 0; i < hdr->count; i += k) {
+		k = a_min(hdr->count - i, HISTCHUNK / sizeof(*recs));
+		if (preadall(fd, recs, k * sizeof(*recs), hdr->index + i * sizeof(*recs)) < 0)
+			a_defer(-1);
+		for (rec = recs, n = 0; n < k; n++, rec++) {
+			a_arr_char_ensure(&buf, rec->len + 1);
+			if (!validrecord(hdr->index, rec) ||
+			    preadall(fd, a_arr_ptr(buf) + a_arr_len(buf), rec->len, rec->off) < 0 ||
+			    checksum(a_arr_ptr(buf) + a_arr_len(buf), rec->len) != rec->sum) {
+				errno = (errno ? errno : EINVAL);
+				a_defer(-1);
+			}
+			a_arr_len(buf) += rec->len;
+			a_arr_ptr(buf)[a_arr_len(buf)++] = '\n';
+		}
+		if (writeall(out, a_arr_ptr(buf), a_arr_len(buf)) < 0)
+			a_defer(-1);
+		a_arr_len(buf) = 0;
+	}
 defer:
-	if (fp) fclose(fp);
-	a_arr_char_free(&buffer, NULL);
+	ashe_free(recs);
+	a_arr_char_free(&buf, NULL);
+	return status;
+}
+
+
+/*
+ * Write plain history file 'dst' with entries of the
+ * indexed history file 'src'.
+ * Returns -1 and sets errno on error (EINVAL if 'src' is
+ * not indexed or it is damaged).
+ */
+ASHE_PUBLIC a_int32 ashe_histexport(const char *src, const char *dst)
+{
+	struct histheader hdr;
+	struct stat st;
+	a_arr_char tmppath;
+	a_uint64 tail;
+	a_int32 fd, out, indexed, status;
+
+	if ((fd = openhistory(src, &st, &hdr, &indexed)) < 0)
+		return -1;
+	if (!indexed) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	a_arr_char_init(&tmppath);
+	status = -1;
+	if ((out = createtmp(&tmppath, dst)) >= 0) {
+		errno = 0;
+		tail = hdr.index + hdr.count * sizeof(struct histrecord);
+		status = exportindex(fd, &hdr, out);
+		if (status == 0 && copyrange(fd, tail, out, lseek(out, 0, SEEK_CUR), st.st_size - tail) < 0)
+			status = -1;
+		status = committmp(out, &tmppath, dst, status);
+	}
+	close(fd);
+	a_arr_char_free(&tmppath, NULL);
 	return status;
 }
 
@@ -322,21 +1464,28 @@ defer:
 
 ASHE_PUBLIC void ashe_freehistnodes(struct a_histlist *hl)
 {
-	struct a_histnode *curr;
-	struct a_histnode *prev;
-
-	curr = hl->head;
-	while (curr) {
-		prev = curr->prev;
-		freenode(curr);
-		curr = prev;
-	}
+	ashe_free(hl->ring);
+	a_arr_char_free(&hl->arena, NULL);
+	a_arr_histprefix_free(&hl->prefixes, NULL);
+	a_arr_char_free(&hl->pending, NULL);
+	a_arr_char_free(&hl->path, NULL);
+	a_arr_char_free(&hl->xbuf, NULL);
 }
 
 
-ASHE_PUBLIC void ashe_freehistlist(struct a_histlist *hl, const char *filepath, a_ubyte canfail)
+ASHE_PUBLIC void ashe_freehistlist(struct a_histlist *hl, a_ubyte canfail)
 {
-	if (savehistoryfile(hl, filepath) < 0 && !canfail)
+	a_int32 status;
+
+	histloaded(hl, 1);
+	status = ashe_histflush(hl);
+	if (finishcompact(hl, 1) < 0)
+		status = -1;
+	if (hl->fd >= 0)
+		close(hl->fd);
+	if (status < 0 && !canfail)
 		ashe_panic("failed writing history file");
+	a_arr_char_free(&compact.buf, NULL);
+	a_arr_char_free(&compact.tmppath, NULL);
 	ashe_freehistnodes(hl);
 }
@@ -2,35 +2,91 @@
 #define AHIST_H
 
 #include "acommon.h"
+#include "aarray.h"
+#include "atoken.h"
 
 
-#define resethistcurrent() 	(ashe.sh_history.current = NULL)
+#define resethistcurrent() 	(ashe.sh_history.current = 0)
 
 
- /* commands history */
+ /* commands history entry */
 struct a_histnode {
-	struct a_histnode *prev;
-	struct a_histnode *next;
-	const char *contents;
-	a_int32 len; /* len of 'contents' */
+	a_uint32 off; /* offset of contents in 'arena' */
+	a_int32 len; /* len of contents */
 };
 
 
-/* list of commands */
+/* contents of entry 'node' ('\0' terminated) */
+#define a_histstr(hl, node) 	(a_arr_ptr((hl)->arena) + (node)->off)
+
+
+/*
+ * Node of the prefix tree over history contents (radix tree),
+ * every entry ends on a node boundary. Label of the edge leading
+ * into the node is taken from the newest entry passing through
+ * the node, that entry outlives the node because entries are
+ * only ever removed from the tail (oldest first).
+ */
+struct a_histprefix {
+	a_uint32 newest; /* sequence number of the newest entry with this prefix */
+	a_uint32 off; /* label is contents of 'newest' at [off..off+len) */
+	a_uint32 len;
+	a_uint32 count; /* entries passing through this node */
+	a_uint32 child; /* first child (0 if none) */
+	a_uint32 next; /* next sibling or next free node */
+};
+
+ARRAY_NEW(a_arr_histprefix, struct a_histprefix)
+
+
+/*
+ * List of commands.
+ * Entries are fixed size records in a ring, entry with
+ * sequence number 'seq' is in slot 'seq & (ringcap - 1)',
+ * sequence numbers of live entries are consecutive starting
+ * from 'oldest'. Contents of all entries are packed into
+ * 'arena', bytes of evicted entries are reclaimed once
+ * they make up the most of it.
+ * When history file is indexed, entries older than the
+ * ones in the ring are read from its index while browsing.
+ */
 struct a_histlist {
 	a_memmax nnodes; /* total number of nodes in this list */
-	struct a_histnode *head;
-	struct a_histnode *tail;
-	struct a_histnode *current;
+	struct a_histnode *ring;
+	a_uint32 ringcap; /* power of 2 (or 0) */
+	a_uint32 oldest; /* sequence number of the oldest entry */
+	a_uint32 current; /* entries back from the head while browsing (0 if not) */
+	a_arr_char arena; /* contents of entries */
+	a_uint32 dead; /* bytes in 'arena' of evicted entries */
+	a_arr_histprefix prefixes; /* prefix tree, root is at index 0 */
+	a_uint32 freeprefix; /* first free node in 'prefixes' (0 if none) */
+	a_arr_char path; /* history file path */
+	a_int32 fd; /* history file opened for appending (-1 if none) */
+	a_arr_char pending; /* lines queued for appending */
+	a_memmax nlines; /* entries in the history file (in its tail if indexed) */
+	a_uint32 limit; /* max entries in the ring */
+	a_ubyte indexed; /* set if history file is indexed */
+	a_uint64 xcount; /* entries in the index */
+	a_uint64 xindex; /* file offset of the index */
+	a_uint64 xlazy; /* entries in the index older than the ones in the ring */
+	a_uint32 xloaded; /* oldest entries in the ring that are also in the index */
+	a_arr_char xbuf; /* contents of entry read from the index */
 };
 
 
-struct a_histnode *ashe_newhisthead(struct a_histlist *hl, const char *contents);
-struct a_histnode *ashe_newhisttail(struct a_histlist *hl, const char *contents);
+void ashe_newhisthead(struct a_histlist *hl, const char *contents, a_uint32 len);
+void ashe_newhisttail(struct a_histlist *hl, const char *contents, a_uint32 len);
+void ashe_histappend(struct a_histlist *hl, const char *contents, a_uint32 len);
+a_int32 ashe_histflush(struct a_histlist *hl);
 const char *ashe_histprev(struct a_histlist *hl);
 const char *ashe_histnext(struct a_histlist *hl);
+const char *ashe_histcurrent(struct a_histlist *hl, a_uint32 *len);
+const struct a_histnode *ashe_histsuggest(struct a_histlist *hl, const char *prefix, a_uint32 len);
 void ashe_inithist(struct a_histlist *hl, const char *filepath, int canfail);
-void ashe_freehistlist(struct a_histlist *hl, const char *filepath, a_ubyte canfail);
+void ashe_histcheck(struct a_histlist *hl);
+void ashe_freehistlist(struct a_histlist *hl, a_ubyte canfail);
 void ashe_freehistnodes(struct a_histlist *hl);
+a_int32 ashe_histimport(const char *src, const char *dst);
+a_int32 ashe_histexport(const char *src, const char *dst);
 
 #endif
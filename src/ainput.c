@@ -21,8 +21,10 @@
 #include <errno.h>
 #include <pwd.h>
 #include <string.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/utsname.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "acommon.h"
@@ -32,6 +34,9 @@
 #include "ashell.h"
 #include "aasync.h"
 #include "auserstr.h"
+#include "ascreen.h"
+#include "acomplete.h"
+#include "autf8.h"
 #ifdef ASHE_DBG
 #include "adbg.h"
 #endif
@@ -40,11 +45,6 @@
 #define ASHE_IBF_MAX ASHE_USERSTR_MAX
 
 
-/* control sequence introducer */
-#define A_CSI	   "\033["
-#define A_ESC(seq) A_CSI #seq
-
-
 /* cursor control sequences */
 #define a_csi_cursor_home	    A_ESC(H)
 #define a_csi_cursor_left(n)	    A_ESC(n) "D"
@@ -61,6 +61,12 @@
 #define a_csi_scroll_down A_ESC(M)
 
 
+/* bracketed paste control sequences */
+#define a_csi_paste_on	A_ESC(?2004h)
+#define a_csi_paste_off A_ESC(?2004l)
+#define a_csi_paste_end A_ESC(201~)
+
+
 /* clear control sequences */
 #define a_csi_clear_down       A_ESC(0J)
 #define a_csi_clear_up	       A_ESC(1J)
@@ -77,48 +83,60 @@
 #define IMPLEMENTED(c) (c != ESCAPE)
 
 
-/* terminal column position */
-#define tcol(x) ((((x)-1) % (A_TCOLMAX)) + 1)
-
-
 /* terminal row diff */
 #define trowdiff(x, y) (((x) / A_TCOLMAX) - ((y) / A_TCOLMAX))
 #define trowdiffx(x)   ((x) / A_TCOLMAX)
 
 
-/* draw buffer */
-#define dbf_pushc(c)	     a_arr_char_push(&A_TDBF, c)
-#define dbf_push(s)	     a_arr_char_push_str(&A_TDBF, s, strlen(s))
-#define dbf_push_len(s, len) a_arr_char_push_str(&A_TDBF, s, len)
-#define dbf_push_movecol(n)  a_arr_char_push_strf(&A_TDBF, A_CSI "%nG", n)
-#define dbf_push_moveup(n)   a_arr_char_push_strf(&A_TDBF, A_CSI "%nA", n)
-#define dbf_push_movedown(n) a_arr_char_push_strf(&A_TDBF, A_CSI "%nB", n)
-#define dbf_pushlit(strlit)  dbf_push_len(strlit, SS(strlit))
+/* columns taken by the prompt in the first row of line 'i' */
+#define line_off(i) ((i) == 0 ? A_TPLEN : 0)
 
 
-/* draw without buffering */
-#define draw_lit(strlit) ashe_write(STDERR_FILENO, strlit, SS(strlit))
+/* bytes in line 'i' (excluding '\n') */
+#define line_bytes(i) \
+	(a_arr_line_index(&A_ILINES, i)->len - ((i) < a_arr_len(A_ILINES) - 1))
 
 
-/* turn on OPOST in raw mode */
-#define opost_on() \
-	{ ashe.sh_term.tm_rawtermios.c_oflag |= OPOST; \
-	  ashe_tcsetattr(TCSAFLUSH, &A_TIORAW); }
+/* columns taken by line 'i' (excluding the prompt) */
+#define line_width(i) (a_arr_line_index(&A_ILINES, i)->width)
 
 
-/* turn off OPOST in raw mode */
-#define opost_off() \
-	{ ashe.sh_term.tm_rawtermios.c_oflag &= ~(OPOST); \
-	  ashe_tcsetattr(TCSAFLUSH, &A_TIORAW); }
+/* terminal rows taken by line 'i' */
+#define line_rows(i) (trowdiffx(line_off(i) + line_width(i)) + 1)
 
 
-/*
- * shift lines starting from 'row', 'n' bytes
- * to right or left depending on the 'sign'
- */
-#define shift_lines_from(row, n, sign) \
-	for (a_uint32 i = row; i < A_ILINES.len; i++) \
-		a_arr_line_index(&A_ILINES, i)->start sign## = (n);
+/* lines were added or removed, rebuild wrapped rows index */
+#define rows_invalidate() (A_TI.in_rowsdirty = 1)
+
+
+/* width flags of a character (in 'in_wbf') */
+#define W_LEAD 0x40 /* first byte of a character */
+#define W_VARY 0x80 /* width depends on the column (tab or wide character) */
+#define W_COLS 0x3f /* columns taken by the character */
+
+
+/* columns taken by the character at input index 'b' */
+#define wcols(b) (A_IWAT(b) & W_COLS)
+
+
+/* columns taken by a tab or a wide character in column 'p' */
+#define tab_width(p)  (A_TABSTOP - (p) % A_TABSTOP)
+#define wide_width(p) (A_TCOLMAX > 1 && (p) % A_TCOLMAX == A_TCOLMAX - 1 ? 3 : 2)
+
+
+/* character at input index 'b' is a wide character padded onto the next row */
+#define padded(b) ((A_IWAT(b) & W_VARY) && wcols(b) > 2 && A_IBFAT(b) != '\t')
+
+
+/* draw buffer */
+#define dbf_pushc(c)	     a_arr_char_push(&A_TDBF, c)
+#define dbf_push(s)	     a_arr_char_push_str(&A_TDBF, s, strlen(s))
+#define dbf_push_len(s, len) a_arr_char_push_str(&A_TDBF, s, len)
+#define dbf_pushlit(strlit)  dbf_push_len(strlit, SS(strlit))
+
+
+/* draw without buffering */
+#define draw_lit(strlit) term_write(strlit, SS(strlit))
 
 
 /* Implemented keys */
@@ -131,13 +149,37 @@ enum termkey {
 	HOME_KEY,
 	END_KEY,
 	DEL_KEY,
+	PASTE_START,
+	UTF8_CHAR, /* multibyte character */
 };
 
+/*
+ * Write 'len' bytes of 'buf' to the terminal.
+ * Output is never post-processed by the terminal
+ * driver (OPOST is off in raw mode), so whatever
+ * gets written must already contain '\r' where
+ * the cursor needs to return to the first column.
+ */
+ASHE_PRIVATE void term_write(const char *buf, a_memmax len)
+{
+	a_ssize n;
+
+	while (len > 0) {
+		n = write(STDERR_FILENO, buf, len);
+		A_TSTAT.io_writes++;
+		if (a_unlikely(n < 0)) {
+			if (errno == EINTR)
+				continue;
+			ashe_panic_libcall(write);
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
 ASHE_PRIVATE inline void dbf_flush()
 {
-	opost_on();
-	ashe_write(STDERR_FILENO, a_arr_ptr(A_TDBF), a_arr_len(A_TDBF));
-	opost_off();
+	term_write(a_arr_ptr(A_TDBF), a_arr_len(A_TDBF));
 	a_arr_len(A_TDBF) = 0;
 }
 
@@ -149,9 +191,13 @@ ASHE_PRIVATE void get_winsize_fallback(void)
 			 a_csi_cursor_down(99999));
 	oldrow = A_TROW;
 	oldcol = A_TCOL;
-	a_term_sync_cursor();
-	A_TROWMAX = A_TROW;
-	A_TCOLMAX = A_TCOL;
+	if (a_term_sync_cursor()) {
+		A_TROWMAX = A_TROW;
+		A_TCOLMAX = A_TCOL;
+	} else {
+		A_TROWMAX = 24;
+		A_TCOLMAX = 80;
+	}
 	A_TROW = oldrow;
 	A_TCOL = oldcol;
 	draw_lit(a_csi_cursor_load a_csi_cursor_show);
@@ -169,225 +215,1020 @@ ASHE_PRIVATE void init_rawterm(struct termios *rawterm)
 	rawterm->c_cc[VTIME] = 0;
 }
 
-ASHE_PRIVATE void a_input_init()
+ASHE_PUBLIC void ashe_clearinput(void)
 {
-	a_arr_char_init_cap(&A_IBF, 8);
+	a_arr_len(A_IBF) = 0;
+	A_IGAP = 0;
+	a_arr_len(A_ILINES) = 0;
+	a_arr_line_push(&A_ILINES, (struct a_line){ .len = 0, .width = 0, .vary = 0 });
+	rows_invalidate();
+	a_syntax_clear(&A_ISYN);
+	A_TI.in_done = 0;
+	A_ITOP = 0;
 	A_IBFIDX = 0;
-	/* input lines */
-	a_arr_line_init(&A_ILINES);
-	a_arr_line_push(&A_ILINES, (struct a_line){ .len = 0, .start = a_arr_ptr(A_IBF) });
 	A_ICOL = 0;
+	A_IX = 0;
 	A_IROW = 0;
+}
+
+ASHE_PRIVATE void a_input_init()
+{
+	a_arr_char_init_cap(&A_IBF, 8);
+	A_TI.in_wbf = ashe_malloc(a_arr_cap(A_IBF));
+	a_arr_line_init(&A_ILINES);
+	a_arr_uint32_init(&A_TI.in_lrows);
+	a_arr_uint32_init(&A_TI.in_rowsum);
+	a_arr_uint32_init(&A_TI.in_lensum);
+	a_syntax_init(&A_ISYN);
+	ashe_clearinput();
 	/* rest is set dynamically */
 }
 
 ASHE_PRIVATE void a_input_free(void)
 {
 	a_arr_char_free(&A_IBF, NULL);
+	ashe_free(A_TI.in_wbf);
 	a_arr_line_free(&A_ILINES, NULL);
+	a_arr_uint32_free(&A_TI.in_lrows, NULL);
+	a_arr_uint32_free(&A_TI.in_rowsum, NULL);
+	a_arr_uint32_free(&A_TI.in_lensum, NULL);
+	a_syntax_free(&A_ISYN);
+}
+
+/* Move the input buffer gap to 'idx'. */
+ASHE_PRIVATE void ibf_gapto(a_uint32 idx)
+{
+	char *buf;
+	a_ubyte *wbf;
+	a_uint32 gaplen;
+
+	buf = a_arr_ptr(A_IBF);
+	wbf = A_TI.in_wbf;
+	gaplen = A_IGAPLEN;
+	if (idx < A_IGAP) {
+		memmove(buf + idx + gaplen, buf + idx, A_IGAP - idx);
+		memmove(wbf + idx + gaplen, wbf + idx, A_IGAP - idx);
+	} else if (idx > A_IGAP) {
+		memmove(buf + A_IGAP, buf + A_IGAP + gaplen, idx - A_IGAP);
+		memmove(wbf + A_IGAP, wbf + A_IGAP + gaplen, idx - A_IGAP);
+	}
+	A_IGAP = idx;
 }
 
 /*
- * Re-links the slices (lines) to the input buffer.
- * This should be called after inserting bytes into
- * the input buffer because buffer might reallocate
- * to a different memory address.
+ * Insert 'n' bytes of 's' into the input buffer at 'idx',
+ * their widths are set by 'measure()'.
  */
-ASHE_PRIVATE void relink_lines(void)
+ASHE_PRIVATE void ibf_insert(a_uint32 idx, const char *s, a_uint32 n)
 {
-	struct a_line *prev;
-	struct a_line *curr;
-	a_uint32 i, lines;
+	a_uint32 oldcap, after;
+
+	ibf_gapto(idx);
+	if (a_unlikely(A_IGAPLEN < n)) { /* grow, bytes after the gap go to the end */
+		oldcap = a_arr_cap(A_IBF);
+		after = a_arr_len(A_IBF) - A_IGAP;
+		a_arr_char_ensure(&A_IBF, n);
+		memmove(a_arr_ptr(A_IBF) + a_arr_cap(A_IBF) - after,
+			a_arr_ptr(A_IBF) + oldcap - after, after);
+		A_TI.in_wbf = ashe_realloc(A_TI.in_wbf, a_arr_cap(A_IBF));
+		memmove(A_TI.in_wbf + a_arr_cap(A_IBF) - after, A_TI.in_wbf + oldcap - after,
+			after);
+	}
+	memcpy(a_arr_ptr(A_IBF) + A_IGAP, s, n);
+	A_IGAP += n;
+	a_arr_len(A_IBF) += n;
+	a_syntax_edit(&A_ISYN, idx, 0, n);
+}
 
-	lines = a_arr_len(A_ILINES);
-	prev = a_arr_line_index(&A_ILINES, 0);
-	prev->start = a_arr_ptr(A_IBF);
+/* Remove 'n' bytes from the input buffer starting at 'idx'. */
+ASHE_PRIVATE void ibf_remove(a_uint32 idx, a_uint32 n)
+{
+	ibf_gapto(idx);
+	a_arr_len(A_IBF) -= n; /* gap grows over the removed bytes */
+	a_syntax_edit(&A_ISYN, idx, n, 0);
+}
+
+/*
+ * Return width flags of the character in at most 'len' bytes
+ * of 's' that starts in column 'p' of its line (prompt included)
+ * and set 'n' to its length. Wide character that would start
+ * in the last column of a row is padded onto the next row.
+ * Bytes that are not valid UTF-8 and characters that are not
+ * printable are drawn as '?'.
+ */
+ASHE_PRIVATE a_ubyte width_at(const char *s, a_uint32 len, a_uint32 p, a_uint32 *n)
+{
+	a_uint32 cp;
+	a_int32 w;
+	a_ubyte c;
+
+	c = *s;
+	*n = 1;
+	if (a_likely(c >= ' ' && c < 0x7f))
+		return W_LEAD | 1;
+	if (c == '\n')
+		return W_LEAD;
+	if (c == '\t')
+		return W_LEAD | W_VARY | tab_width(p);
+	if (c < 0x80 || (*n = a_utf8_decode(s, len, &cp)) == 0 || (w = a_utf8_width(cp)) < 0) {
+		*n = a_max(*n, 1);
+		return W_LEAD | 1;
+	}
+	if (w == 2)
+		return W_LEAD | W_VARY | wide_width(p);
+	return W_LEAD | w;
+}
+
+/*
+ * Copy at most 4 bytes of the input from index 'b' (but
+ * not past 'end') into 's', returns how many were copied.
+ */
+ASHE_PRIVATE a_uint32 ibf_peek(a_uint32 b, a_uint32 end, char *s)
+{
+	a_uint32 n, i;
+
+	n = a_min(end - b, 4);
+	for (i = 0; i < n; i++)
+		s[i] = A_IBFAT(b + i);
+	return n;
+}
+
+/* Return input index of the character before index 'b'. */
+ASHE_PRIVATE a_uint32 char_prev(a_uint32 b)
+{
+	do {
+		b--;
+	} while (b > 0 && !(A_IWAT(b) & W_LEAD));
+	return b;
+}
+
+/* Return input index of the character after the one at index 'b'. */
+ASHE_PRIVATE a_uint32 char_next(a_uint32 b)
+{
+	do {
+		b++;
+	} while (b < a_arr_len(A_IBF) && !(A_IWAT(b) & W_LEAD));
+	return b;
+}
+
+/*
+ * Set widths of the characters in the input from index 'b'
+ * up to 'end', first one starts in column 'p' of its line
+ * (prompt included). Characters with width depending on the
+ * column are counted into 'vary'.
+ * Returns the column after the last character.
+ */
+ASHE_PRIVATE a_uint32 measure(a_uint32 b, a_uint32 end, a_uint32 p, a_uint32 *vary)
+{
+	char s[4];
+	a_uint32 n, i;
+	a_ubyte w, c;
+
+	while (b < end) {
+		c = A_IBFAT(b);
+		if (a_likely(c >= ' ' && c < 0x7f)) { /* most of the input */
+			A_IWAT(b) = W_LEAD | 1;
+			b++;
+			p++;
+			continue;
+		}
+		w = width_at(s, ibf_peek(b, end, s), p, &n);
+		A_IWAT(b) = w;
+		for (i = 1; i < n; i++)
+			A_IWAT(b + i) = 0;
+		*vary += ((w & W_VARY) != 0);
+		p += w & W_COLS;
+		b += n;
+	}
+	return p;
+}
+
+/*
+ * Return columns taken by the input from index 'b' up to
+ * 'end', characters with width depending on the column are
+ * counted into 'vary'.
+ */
+ASHE_PRIVATE a_uint32 span_width(a_uint32 b, a_uint32 end, a_uint32 *vary)
+{
+	a_uint32 width;
+	a_ubyte w;
 
-	for (i = 1; i < lines; i++) {
-		curr = a_arr_line_index(&A_ILINES, i);
-		curr->start = prev->start + prev->len;
-		prev = curr;
+	for (width = 0; b < end; b++) {
+		w = A_IWAT(b);
+		width += w & W_COLS;
+		*vary += ((w & W_VARY) != 0);
 	}
+	return width;
 }
 
-/* Redraw prompt, do not update cursor. */
-ASHE_PUBLIC void ashe_redraw_prompt_unsafe(void)
+/*
+ * Characters in the input from index 'b' up to 'end' moved
+ * from column 'pold' into column 'pnew', update the widths
+ * depending on the column up to the first character that
+ * stays in the same column (all of them if 'all' is set).
+ * Returns how many columns the end of the characters moved.
+ */
+ASHE_PRIVATE a_int32 reflow(a_uint32 b, a_uint32 end, a_uint32 pold, a_uint32 pnew, a_ubyte all)
 {
-	dbf_pushlit(a_csi_cursor_hide);
-	dbf_push_len(a_arr_ptr(A_TP), A_TPLEN);
-	dbf_pushlit(a_csi_cursor_show);
-	dbf_flush();
+	a_ubyte w, nw;
+
+	for (; b < end && (all || pold != pnew); b++) {
+		nw = w = A_IWAT(b);
+		if (w & W_VARY) {
+			nw = W_LEAD | W_VARY |
+			     (A_IBFAT(b) == '\t' ? tab_width(pnew) : wide_width(pnew));
+			A_IWAT(b) = nw;
+		}
+		pold += w & W_COLS;
+		pnew += nw & W_COLS;
+	}
+	return (a_int32)(pnew - pold);
 }
 
 /*
- * Return number of rows between the current row
- * and the first row where the prompt resides
- * if the 'prompt' is non zero value.
- * Otherwise return the number of rows between the
- * current row and the first terminal row where the
- * input buffer begins.
+ * Terminal width or prompt width changed, update widths
+ * of the characters depending on the column.
  */
-ASHE_PRIVATE a_uint32 first_row_diff(a_ubyte prompt)
+ASHE_PRIVATE void layout_lines(void)
 {
 	struct a_line *line;
-	a_ssize temp;
-	a_uint32 idx, rows;
+	a_uint32 i, start, off;
+	a_int32 shift;
 
-	prompt = (prompt != 0);
-	idx = A_IROW;
-	line = &A_ILINE;
-	temp = line->len;
+	for (start = 0, i = 0; i < a_arr_len(A_ILINES); start += line->len, i++) {
+		line = a_arr_line_index(&A_ILINES, i);
+		if (line->vary == 0)
+			continue;
+		off = line_off(i);
+		if (i != A_IROW) {
+			line->width += reflow(start, start + line->len, off, off, 1);
+			continue;
+		}
+		shift = reflow(start, A_IBFIDX, off, off, 1); /* cursor column moves too */
+		line->width += reflow(A_IBFIDX, start + line->len, off + A_IX, off + A_IX + shift, 1);
+		A_IX += shift;
+	}
+}
+
+/* Fenwick tree index of the least significant set bit. */
+#define lsb(i) ((i) & (~(i) + 1))
+
+/* Rebuild wrapped rows and line lengths index. */
+ASHE_PRIVATE void rows_build(void)
+{
+	a_uint32 *sum, *lsum, i, j, n;
+
+	n = a_arr_len(A_ILINES);
+	a_arr_len(A_TI.in_lrows) = 0;
+	a_arr_len(A_TI.in_rowsum) = 0;
+	a_arr_len(A_TI.in_lensum) = 0;
+	a_arr_uint32_ensure(&A_TI.in_lrows, n);
+	a_arr_uint32_ensure(&A_TI.in_rowsum, n + 1);
+	a_arr_uint32_ensure(&A_TI.in_lensum, n + 1);
+	sum = a_arr_ptr(A_TI.in_rowsum);
+	lsum = a_arr_ptr(A_TI.in_lensum);
+	sum[0] = lsum[0] = 0;
+	for (i = 0; i < n; i++) {
+		sum[i + 1] = a_arr_ptr(A_TI.in_lrows)[i] = line_rows(i);
+		lsum[i + 1] = a_arr_line_index(&A_ILINES, i)->len;
+	}
+	for (i = 1; i <= n; i++) {
+		if ((j = i + lsb(i)) <= n) {
+			sum[j] += sum[i];
+			lsum[j] += lsum[i];
+		}
+	}
+	a_arr_len(A_TI.in_lrows) = n;
+	a_arr_len(A_TI.in_rowsum) = n + 1;
+	a_arr_len(A_TI.in_lensum) = n + 1;
+	A_TI.in_rowscols = A_TCOLMAX;
+	A_TI.in_rowsoff = A_TPLEN;
+	A_TI.in_rowsdirty = 0;
+}
 
-	for (rows = 0; 0 < idx; idx--) {
-		rows += trowdiffx(temp - 1) + 1;
-		line = a_arr_line_index(&A_ILINES, idx);
-		temp = line->len;
+/* terminal width or prompt width changed since the last layout */
+#define layout_stale() (A_TI.in_rowscols != A_TCOLMAX || A_TI.in_rowsoff != A_TPLEN)
+
+/* Make sure widths and wrapped rows index are up to date. */
+ASHE_PRIVATE inline void rows_sync(void)
+{
+	if (layout_stale()) {
+		layout_lines();
+		rows_build();
+	} else if (A_TI.in_rowsdirty) {
+		rows_build();
 	}
+}
 
-	rows += trowdiffx(temp - 1 + (prompt * A_TPLEN));
+/* Make sure widths are up to date before editing. */
+ASHE_PRIVATE inline void layout_sync(void)
+{
+	if (layout_stale())
+		rows_sync();
+}
+
+/* Line 'i' got 'dlen' bytes longer (shorter if negative). */
+ASHE_PRIVATE void rows_update(a_uint32 i, a_int32 dlen)
+{
+	a_uint32 *lrows, n, delta, j;
+
+	if (A_TI.in_rowsdirty)
+		return;
+	n = a_arr_len(A_ILINES);
+	for (j = i + 1; j <= n; j += lsb(j)) /* unsigned wraparound handles negative 'dlen' */
+		a_arr_ptr(A_TI.in_lensum)[j] += (a_uint32)dlen;
+	lrows = a_arr_ptr(A_TI.in_lrows);
+	if ((delta = line_rows(i) - lrows[i]) == 0)
+		return;
+	lrows[i] += delta;
+	for (i++; i <= n; i += lsb(i))
+		a_arr_ptr(A_TI.in_rowsum)[i] += delta;
+}
+
+/* Return number of terminal rows taken by lines before line 'i'. */
+ASHE_PRIVATE a_uint32 rows_before(a_uint32 i)
+{
+	a_uint32 rows;
 
+	rows_sync();
+	for (rows = 0; i > 0; i -= lsb(i))
+		rows += a_arr_ptr(A_TI.in_rowsum)[i];
 	return rows;
 }
 
 /*
- * Return number of rows between the current row
- * and the last input buffer row.
+ * Descend Fenwick tree 'sum' of 'n' entries, return
+ * the entry containing 'val' and set 'val' to the
+ * offset within that entry, 'n' if 'val' is past
+ * the total.
  */
-ASHE_PRIVATE a_uint32 last_row_diff(void)
+ASHE_PRIVATE a_uint32 sum_find(const a_uint32 *sum, a_uint32 n, a_uint32 *val)
 {
-	a_ssize temp;
-	a_uint32 idx, rows, lines, extra;
+	a_uint32 pos, step;
+
+	for (step = 1; step * 2 <= n; step *= 2)
+		;
+	for (pos = 0; step > 0; step /= 2) {
+		if (pos + step <= n && sum[pos + step] <= *val) {
+			pos += step;
+			*val -= sum[pos];
+		}
+	}
+	return pos;
+}
 
-	lines = a_arr_len(A_ILINES);
-	idx = A_IROW;
-	extra = (idx == 0) * A_TPLEN;
-	temp = a_arr_line_index(&A_ILINES, idx)->len;
-	temp += extra;
-	temp -= trowdiffx(A_ICOL + extra);
-
-	for (rows = 0; idx < lines; idx++) {
-		rows += trowdiffx(temp - 1) + 1;
-		temp = a_arr_line_index(&A_ILINES, idx)->len;
+/*
+ * Return the line containing terminal 'row' (relative
+ * to the first prompt row) and set 'row' to the row
+ * within that line, rows past the input map onto the
+ * last line.
+ */
+ASHE_PRIVATE a_uint32 rows_find(a_uint32 *row)
+{
+	a_uint32 pos, n;
+
+	rows_sync();
+	n = a_arr_len(A_ILINES);
+	pos = sum_find(a_arr_ptr(A_TI.in_rowsum), n, row);
+	if (pos >= n) { /* past the input */
+		pos = n - 1;
+		*row += a_arr_ptr(A_TI.in_lrows)[pos];
 	}
-	if (idx != 0)
-		rows--; /* we overshoot by one row always */
+	return pos;
+}
 
-	return rows;
+/*
+ * Return the line containing input index 'idx' and
+ * set 'idx' to the index within that line.
+ */
+ASHE_PRIVATE a_uint32 line_find(a_uint32 *idx)
+{
+	a_uint32 pos, n;
+
+	rows_sync();
+	n = a_arr_len(A_ILINES);
+	pos = sum_find(a_arr_ptr(A_TI.in_lensum), n, idx);
+	if (pos >= n) { /* end of the last line */
+		pos = n - 1;
+		*idx += a_arr_line_index(&A_ILINES, pos)->len;
+	}
+	return pos;
 }
 
-ASHE_PUBLIC void ashe_clearinput(void)
+/*
+ * Return column of the cursor in its line (prompt included),
+ * cursor on a wide character padded onto the next row is
+ * drawn after the padding.
+ */
+ASHE_PRIVATE a_uint32 cursor_pos(void)
 {
-	ashe_move_to_start();
-	a_arr_len(A_IBF) = 0;
-	a_arr_line_free(&A_ILINES, NULL);
-	a_arr_line_init(&A_ILINES);
-	a_arr_line_push(&A_ILINES, (struct a_line){.len = 0, .start = a_arr_ptr(A_IBF)});
-	draw_lit(a_csi_cursor_hide a_csi_clear_line_right a_csi_clear_down a_csi_cursor_show);
+	a_uint32 p;
+
+	rows_sync(); /* cursor column might change */
+	p = line_off(A_IROW) + A_IX;
+	if (A_IBFIDX < a_arr_len(A_IBF) && padded(A_IBFIDX))
+		p++;
+	return p;
 }
 
-ASHE_PUBLIC void ashe_deletefront(void)
+/*
+ * Return number of terminal rows between the
+ * first prompt row and the cursor.
+ */
+ASHE_PRIVATE a_uint32 cursor_row(void)
+{
+	a_uint32 pos;
+
+	pos = cursor_pos();
+	return rows_before(A_IROW) + trowdiffx(pos);
+}
+
+/* Return terminal column of the cursor (0 based). */
+#define cursor_col() (cursor_pos() % A_TCOLMAX)
+
+/* Return number of terminal rows taken by the prompt and input. */
+#define input_rows() rows_before(a_arr_len(A_ILINES))
+
+/* Return input index where line 'i' starts. */
+ASHE_PRIVATE a_uint32 line_start(a_uint32 i)
 {
 	a_uint32 idx;
 
-	idx = A_IBFIDX;
-	while (ashe_move_right());
-	while (A_IBFIDX > idx)
-		ashe_remove_char();
+	rows_sync();
+	for (idx = 0; i > 0; i -= lsb(i))
+		idx += a_arr_ptr(A_TI.in_lensum)[i];
+	return idx;
+}
+
+/* distance between columns 'a' and 'b' */
+#define coldist(a, b) ((a) > (b) ? (a) - (b) : (b) - (a))
+
+/*
+ * Return input index of the character drawn in column 'col'
+ * (prompt included) of line 'i' that starts at index 'start',
+ * or of the closest character before it. Sets 'x' to the
+ * column of the character (prompt excluded).
+ * Walk starts from the closest column with known index,
+ * start or end of the line or the cursor, this way it is
+ * bounded by the distance in columns.
+ */
+ASHE_PRIVATE a_uint32 seek(a_uint32 i, a_uint32 start, a_uint32 col, a_uint32 *x)
+{
+	a_uint32 off, end, b, p, w;
+
+	rows_sync();
+	off = line_off(i);
+	end = start + line_bytes(i);
+	if (col <= off) {
+		*x = 0;
+		return start;
+	} else if (col >= off + line_width(i)) {
+		*x = line_width(i);
+		return end;
+	}
+	b = start;
+	p = off;
+	if (i == A_IROW && coldist(off + A_IX, col) < col - off) {
+		b = A_IBFIDX;
+		p = off + A_IX;
+	}
+	if (off + line_width(i) - col < coldist(p, col)) {
+		b = end;
+		p = off + line_width(i);
+	}
+	while (p > col && b > start) {
+		b = char_prev(b);
+		p -= wcols(b);
+	}
+	while (b < end && p + (w = wcols(b)) <= col) {
+		p += w;
+		b = char_next(b);
+	}
+	if (p == col && b > start && padded(b)) { /* 'col' is the padding */
+		do {
+			b = char_prev(b);
+			p -= wcols(b);
+		} while (b > start && wcols(b) == 0);
+	}
+	*x = p - off;
+	return b;
+}
+
+/*
+ * Move cursor into terminal 'row' (relative to the first
+ * prompt row) as close as possible to the column 'col'.
+ */
+ASHE_PRIVATE void move_to_row(a_uint32 row, a_uint32 col)
+{
+	a_uint32 i, idx, b, x;
+
+	i = rows_find(&row);
+	idx = line_start(i);
+	b = seek(i, idx, row * A_TCOLMAX + col, &x);
+	A_IROW = i;
+	A_ICOL = b - idx;
+	A_IBFIDX = b;
+	A_IX = x;
+}
+
+/*
+ * Scroll the viewport (input rows that get drawn) so
+ * that the cursor is visible, viewport is at most as
+ * tall as the terminal.
+ */
+ASHE_PRIVATE void scroll_viewport(void)
+{
+	a_uint32 row, rows;
+
+	row = cursor_row();
+	rows = input_rows();
+	if (row < A_ITOP)
+		A_ITOP = row;
+	else if (row >= A_ITOP + A_TROWMAX)
+		A_ITOP = row - A_TROWMAX + 1;
+	if (A_ITOP + A_TROWMAX > rows) /* don't leave empty rows at the bottom */
+		A_ITOP = (rows > A_TROWMAX ? rows - A_TROWMAX : 0);
+}
+
+/*
+ * Return history entry suggested for the input or NULL.
+ * Suggestion is the newest entry starting with the input,
+ * it is offered only while the cursor is at the end.
+ */
+ASHE_PRIVATE const struct a_histnode *suggestion(void)
+{
+	const struct a_histnode *hist;
+	a_uint32 len;
+
+	len = a_arr_len(A_IBF);
+	if (len == 0 || A_IBFIDX != len || A_TI.in_done)
+		return NULL;
+	ibf_gapto(len); /* prefix must be contiguous */
+	hist = ashe_histsuggest(&ashe.sh_history, a_arr_ptr(A_IBF), len);
+	return (hist && (a_uint32)hist->len > len ? hist : NULL);
+}
+
+/* Insert the rest of the suggestion, returns 0 if there is none. */
+ASHE_PRIVATE a_ubyte accept_suggestion(void)
+{
+	const struct a_histnode *hist;
+	a_uint32 len;
+
+	if (!(hist = suggestion()))
+		return 0;
+	len = a_arr_len(A_IBF);
+	ashe_insert_str(a_histstr(&ashe.sh_history, hist) + len, hist->len - len);
+	return 1;
+}
+
+/*
+ * Build cells of the character of 'n' bytes at 's' with width
+ * flags 'w' that starts in the position 'p', only the cells in
+ * positions from 'from' up to 'lim' are built. Cursor is placed
+ * onto the character if 'cur' is set.
+ */
+ASHE_PRIVATE void build_char(const char *s, a_uint32 n, a_ubyte w, a_uint32 p, a_uint32 from,
+			     a_uint32 lim, a_ubyte attr, a_ubyte cur)
+{
+	a_uint32 cols, glyph, cp, q;
+	a_ubyte c;
+
+	cols = w & W_COLS;
+	c = *s;
+	if (c == '\t') { /* spaces up to the tab stop */
+		for (q = p; q < p + cols; q++) {
+			if (q < from || q >= lim)
+				continue;
+			if (cur && q == p)
+				a_frame_cursor(&A_TSCR);
+			a_frame_put(&A_TSCR, (struct a_cell){ .c = " ", .attr = attr });
+		}
+		return;
+	}
+	glyph = a_min(cols, 2);
+	for (q = p; q < p + cols - glyph; q++) /* padding of the wide character */
+		if (q >= from && q < lim)
+			a_frame_put(&A_TSCR, (struct a_cell){ .c = " " });
+	if (q < from || q >= lim)
+		return;
+	if (cur)
+		a_frame_cursor(&A_TSCR);
+	if (c < ' ' || c == 0x7f ||
+	    (c >= 0x80 && (a_utf8_decode(s, n, &cp) == 0 || a_utf8_width(cp) < 0)))
+		a_frame_putc(&A_TSCR, "?", 1, 1, attr);
+	else
+		a_frame_putc(&A_TSCR, s, n, glyph, attr);
+}
+
+/*
+ * Build the rest of the suggestion 'hist' after the input,
+ * 'p' is the position after the last input line and cells
+ * are built only up to the position 'lim'.
+ */
+ASHE_PRIVATE void build_suggestion(const struct a_histnode *hist, a_uint32 p, a_uint32 lim)
+{
+	const char *s;
+	a_uint32 i, n, start;
+	a_ubyte w;
+
+	s = a_histstr(&ashe.sh_history, hist);
+	start = 0; /* position where the line starts */
+	for (i = a_arr_len(A_IBF); i < (a_uint32)hist->len && p < lim; i += n) {
+		if (s[i] == '\n') {
+			start = p = (p / A_TCOLMAX + 1) * A_TCOLMAX;
+			if (p < lim)
+				a_frame_newline(&A_TSCR);
+			n = 1;
+			continue;
+		}
+		w = width_at(s + i, hist->len - i, p - start, &n);
+		build_char(s + i, n, w, p, 0, lim, A_THLATTR[HL_SUGGEST], 0);
+		p += w & W_COLS;
+	}
+}
+
+/*
+ * Build new screen frame from the prompt and the input.
+ * Only the rows inside the viewport are built, this
+ * way the cost doesn't depend on the size of the input.
+ */
+ASHE_PRIVATE void build_frame(void)
+{
+	const struct a_histnode *hist;
+	a_uint32 i, r, row, bottom, lines, idx, off, p, from, lim, end, b, next, x, n;
+	a_uint32 t, tstart, tend;
+	a_ubyte hl, attr, tvalid;
+	char s[4], c;
+
+	hist = suggestion();
+	scroll_viewport();
+	r = A_ITOP;
+	i = rows_find(&r); /* first visible line and its first visible row */
+	idx = line_start(i);
+
+	/* first visible character */
+	off = line_off(i);
+	from = r * A_TCOLMAX;
+	b = seek(i, idx, from, &x);
+	p = off + x;
+
+	/* highlighted token containing the first visible byte */
+	a_syntax_sync(&A_ISYN);
+	t = a_syntax_find(&A_ISYN, b);
+	tvalid = a_syntax_tok(&A_ISYN, t, &tstart, &tend, &hl);
+
+	a_frame_begin(&A_TSCR, A_TCOLMAX);
+	lines = a_arr_len(A_ILINES);
+	bottom = A_ITOP + A_TROWMAX;
+	for (row = A_ITOP; i < lines; i++) {
+		/* positions in line 'i', prompt cells come first in line 0 */
+		off = line_off(i);
+		end = idx + line_bytes(i);
+		lim = (r + bottom - row) * A_TCOLMAX;
+		for (; from < off && from < lim; from++)
+			a_frame_put(&A_TSCR, *a_arr_cell_index(&A_TPC, from));
+		for (; b < end && p < lim; p += wcols(b), b = next) {
+			while (tvalid && b >= tend)
+				tvalid = a_syntax_tok(&A_ISYN, ++t, &tstart, &tend, &hl);
+			attr = (tvalid && b >= tstart ? A_THLATTR[hl] : 0);
+			c = A_IBFAT(b);
+			if (a_likely(c >= ' ' && c < 0x7f)) { /* most of the input */
+				if (b == A_IBFIDX)
+					a_frame_cursor(&A_TSCR);
+				a_frame_put(&A_TSCR, (struct a_cell){ .c = { c }, .attr = attr });
+				next = b + 1;
+				continue;
+			}
+			next = a_min(char_next(b), end);
+			n = ibf_peek(b, next, s);
+			build_char(s, n, A_IWAT(b), p, from, lim, attr, b == A_IBFIDX);
+		}
+		if (b == end && b == A_IBFIDX)
+			a_frame_cursor(&A_TSCR);
+		if (hist && i == lines - 1)
+			build_suggestion(hist, p, lim);
+		if ((row += line_rows(i) - r) >= bottom || i == lines - 1)
+			break;
+		a_frame_newline(&A_TSCR);
+		idx += a_arr_line_index(&A_ILINES, i)->len;
+		b = idx;
+		p = from = r = 0;
+	}
+}
+
+/* Flush the draw buffer and update terminal cursor position. */
+ASHE_PRIVATE void screen_flush(a_uint32 oldrow)
+{
+	a_int64 row;
+
+	row = (a_int64)A_TROW + A_TSCR.sc_row - oldrow;
+	A_TROW = a_max(a_min(row, A_TROWMAX), 1);
+	A_TCOL = a_min(A_TSCR.sc_col, A_TCOLMAX - 1) + 1;
+	if (a_arr_len(A_TDBF) > 0) {
+		A_TSTAT.io_frames++;
+		dbf_flush();
+	}
+}
+
+/*
+ * Make sure the prompt starts in the first column even
+ * if the output of the last command did not end with a
+ * newline. Row full of spaces leaves the cursor on the
+ * same row if it was in the first column, otherwise it
+ * wraps onto the next row keeping the unterminated output.
+ */
+ASHE_PRIVATE void prompt_sp(void)
+{
+	a_uint32 i;
+
+	for (i = 0; i < A_TCOLMAX; i++)
+		dbf_pushc(' ');
+	dbf_pushlit("\r" a_csi_clear_line_right);
+	A_TCOL = 1;
+}
+
+ASHE_PUBLIC void a_term_refresh(void)
+{
+	a_uint32 oldrow;
+
+	oldrow = A_TSCR.sc_row;
+	build_frame();
+	a_screen_update(&A_TSCR, &A_TDBF);
+	screen_flush(oldrow);
+}
+
+ASHE_PUBLIC void ashe_move_below_input_unsafe(void)
+{
+	A_TROW = a_min(A_TROW + a_screen_leave(&A_TSCR, &A_TDBF), A_TROWMAX);
+	A_TCOL = 1;
+	if (a_arr_len(A_TDBF) > 0)
+		dbf_flush();
+}
+
+ASHE_PUBLIC void ashe_deletefront(void)
+{
+	ashe_remove_bytes(-1);
 }
 
 ASHE_PRIVATE void setinput2history(void)
 {
-	struct a_histnode *hist;
-	a_int32 i;
+	const char *hist;
+	a_uint32 len;
 
 	ashe_clearinput();
-	hist = ashe.sh_history.current;
-	/* This code is very very very slow, but I
-	 * am very very very lazy. */
-	if (hist) {
-		draw_lit(a_csi_cursor_hide);
-		for (i = 0; i < hist->len; i++)
-			ashe_insert_char(hist->contents[i], 0);
-		draw_lit(a_csi_cursor_show);
-	}
+	hist = ashe_histcurrent(&ashe.sh_history, &len);
+	if (hist)
+		ashe_insert_str(hist, len);
 }
 
-ASHE_PRIVATE enum termkey read_key(void)
+/*
+ * Read all of the pending terminal input into the
+ * key buffer, blocks until at least one byte is read.
+ * Signals received while waiting are handled before
+ * the read. Nothing is read if the buffer is full,
+ * 'decode_key()' always decodes a key from it.
+ */
+ASHE_PRIVATE void fill_keys(void)
 {
-	a_ubyte seq[3];
-	a_int32 nread;
-	a_byte c;
+	struct a_keybuf *kb;
+	a_ssize nread;
 
-	ashe_mask_signals(SIG_UNBLOCK);
-	while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-		if (a_unlikely(nread == -1 && (errno != EINTR && !ashe.sh_int)))
+	kb = &A_TKBF;
+	if (kb->kb_pos > 0) { /* move undecoded bytes to the front */
+		kb->kb_len -= kb->kb_pos;
+		memmove(kb->kb_buf, kb->kb_buf + kb->kb_pos, kb->kb_len);
+		kb->kb_pos = 0;
+	}
+
+	if (a_unlikely(kb->kb_len == A_KBUFSIZE))
+		return;
+	ashe_histflush(&ashe.sh_history); /* idle, write what was batched */
+	do {
+		ashe_wait_fd(STDIN_FILENO, -1);
+		nread = read(STDIN_FILENO, kb->kb_buf + kb->kb_len, A_KBUFSIZE - kb->kb_len);
+		if (a_unlikely(nread == -1 && errno != EINTR && errno != EAGAIN))
 			ashe_panic_libcall(read);
-		ashe.sh_int = 0;
+	} while (nread <= 0);
+	A_TSTAT.io_reads++;
+	kb->kb_len += nread;
+}
+
+/*
+ * Read input that was typed ahead while in canonical
+ * mode into the key buffer without blocking.
+ * Terminal driver already translated '\r' into '\n'
+ * (ICRNL) for these bytes, translation is reverted so
+ * typed ahead lines are accepted.
+ */
+ASHE_PRIVATE void read_typeahead(void)
+{
+	struct a_keybuf *kb;
+	struct pollfd pfd;
+	a_ssize nread;
+	a_uint32 i;
+
+	kb = &A_TKBF;
+	if (kb->kb_pos > 0) {
+		kb->kb_len -= kb->kb_pos;
+		memmove(kb->kb_buf, kb->kb_buf + kb->kb_pos, kb->kb_len);
+		kb->kb_pos = 0;
 	}
-	ashe_mask_signals(SIG_BLOCK);
-
-	if (c == ESCAPE) {
-		if (read(STDIN_FILENO, &seq[0], 1) != 1)
-			return ESCAPE;
-		if (read(STDIN_FILENO, &seq[1], 1) != 1)
-			return ESCAPE;
-		if (seq[0] == '[') {
-			if (isdigit(seq[1])) {
-				if (read(STDIN_FILENO, &seq[2], 1) != 1)
-					return ESCAPE;
-				if (seq[2] == '~') {
-					switch (seq[1]) {
-					case '3':
-						return DEL_KEY;
-					case '1':
-					case '7':
-						return HOME_KEY;
-					case '4':
-					case '8':
-						return END_KEY;
-					default:
-						break;
-					}
-				}
-			} else {
-				switch (seq[1]) {
-				case 'C':
-					return R_ARW;
-				case 'D':
-					return L_ARW;
-				case 'B':
-					return D_ARW;
-				case 'A':
-					return U_ARW;
-				case 'H':
-					return HOME_KEY;
-				case 'F':
-					return END_KEY;
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	while (kb->kb_len < A_KBUFSIZE && poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN)) {
+		nread = read(STDIN_FILENO, kb->kb_buf + kb->kb_len, A_KBUFSIZE - kb->kb_len);
+		A_TSTAT.io_reads++;
+		if (nread <= 0)
+			break;
+		for (i = kb->kb_len; i < kb->kb_len + nread; i++)
+			if (kb->kb_buf[i] == '\n' && (A_TIODFL.c_iflag & ICRNL))
+				kb->kb_buf[i] = CR;
+		kb->kb_len += nread;
+	}
+}
+
+/*
+ * Decode the next key from the key buffer into 'key'.
+ * Returns the number of bytes the key takes in the
+ * buffer or 0 if the buffer does not contain a whole key.
+ */
+ASHE_PRIVATE a_uint32 decode_key(a_int32 *key)
+{
+	const a_ubyte *seq;
+	a_uint32 len, i, n, cp;
+
+	seq = (const a_ubyte *)A_TKBF.kb_buf + A_TKBF.kb_pos;
+	len = A_TKBF.kb_len - A_TKBF.kb_pos;
+	if (len == 0)
+		return 0;
+	*key = seq[0];
+	if (seq[0] >= 0x80) { /* multibyte character, wait until it is whole */
+		n = a_utf8_seqlen(seq[0]);
+		for (i = 1; i < n && i < len && (seq[i] & 0xc0) == 0x80; i++)
+			;
+		if (i < n && i == len)
+			return 0;
+		*key = ESCAPE; /* ignored unless valid and printable */
+		if (i < n || a_utf8_decode((const char *)seq, n, &cp) == 0)
+			return 1;
+		if (a_utf8_width(cp) >= 0)
+			*key = UTF8_CHAR;
+		return n;
+	}
+	if (seq[0] != ESCAPE)
+		return 1;
+	if (len < 3)
+		return 0;
+	*key = ESCAPE;
+	if (seq[1] == '[') {
+		/* parameter and intermediate bytes up to the final byte */
+		for (i = 2; i < len && seq[i] >= 0x20 && seq[i] <= 0x3f; i++)
+			;
+		if (i >= len) /* never completes if it fills the buffer, ignore it */
+			return (len < A_KBUFSIZE ? 0 : len);
+		if (seq[i] == '~') {
+			if (i == 3) {
+				switch (seq[2]) {
+				case '3':
+					*key = DEL_KEY;
+					break;
+				case '1':
+				case '7':
+					*key = HOME_KEY;
+					break;
+				case '4':
+				case '8':
+					*key = END_KEY;
+					break;
 				default:
 					break;
 				}
+			} else if (i - 2 == SS("200") && memcmp(seq + 2, "200", SS("200")) == 0) {
+				*key = PASTE_START;
 			}
-		} else if (seq[0] == 'O') {
-			switch (seq[1]) {
+		} else if (i == 2) {
+			switch (seq[2]) {
+			case 'C':
+				*key = R_ARW;
+				break;
+			case 'D':
+				*key = L_ARW;
+				break;
+			case 'B':
+				*key = D_ARW;
+				break;
+			case 'A':
+				*key = U_ARW;
+				break;
 			case 'H':
-				return HOME_KEY;
+				*key = HOME_KEY;
+				break;
 			case 'F':
-				return HOME_KEY;
+				*key = END_KEY;
+				break;
 			default:
 				break;
 			}
 		}
-		return ESCAPE;
-	} else {
-		return c;
+		return i + 1;
+	} else if (seq[1] == 'O') {
+		switch (seq[2]) {
+		case 'H':
+			*key = HOME_KEY;
+			break;
+		case 'F':
+			*key = END_KEY;
+			break;
+		default:
+			break;
+		}
+	}
+	return 3;
+}
+
+
+/*
+ * Remove bytes that are not valid UTF-8 and multibyte
+ * characters that are not printable from 'buf'.
+ */
+ASHE_PRIVATE void drop_unprintable(a_arr_char *buf)
+{
+	char *s;
+	a_uint32 i, j, n, cp, len;
+
+	s = a_arr_ptr(*buf);
+	len = a_arr_len(*buf);
+	for (i = j = 0; i < len; i += n) {
+		n = 1;
+		if ((a_ubyte)s[i] < 0x80)
+			s[j++] = s[i];
+		else if ((n = a_utf8_decode(s + i, len - i, &cp)) == 0)
+			n = 1;
+		else if (a_utf8_width(cp) >= 0)
+			for (cp = 0; cp < n; cp++)
+				s[j++] = s[i + cp];
 	}
+	a_arr_len(*buf) = j;
 }
 
-ASHE_PRIVATE a_ubyte process_key(void)
+/*
+ * Insert pasted text, invoked after the start of the
+ * paste was decoded. Everything up to the end of the
+ * paste is read into a buffer (in as large reads as
+ * the key buffer allows) and inserted at once, newlines
+ * are inserted as they are so pasted lines never run.
+ */
+ASHE_PRIVATE void paste(void)
 {
-	a_int32 c;
+	struct a_keybuf *kb;
+	a_arr_char pbf;
+	const char *start, *end;
+	a_uint32 n, take, i;
+	a_ubyte c, prev;
+
+	kb = &A_TKBF;
+	prev = 0;
+	a_arr_char_init(&pbf);
+	for (;;) {
+		start = kb->kb_buf + kb->kb_pos;
+		n = kb->kb_len - kb->kb_pos;
+		for (end = start; (end = memchr(end, ESCAPE, start + n - end)); end++)
+			if ((a_uint32)(start + n - end) >= SS(a_csi_paste_end) &&
+			    memcmp(end, a_csi_paste_end, SS(a_csi_paste_end)) == 0)
+				break;
+		if (end) /* what could be the start of the end marker is kept */
+			take = end - start;
+		else
+			take = (n < SS(a_csi_paste_end) ? 0 : n - SS(a_csi_paste_end) + 1);
+		a_arr_char_ensure(&pbf, take);
+		for (i = 0; i < take; prev = c, i++) {
+			c = start[i];
+			if (c == '\r') /* terminals send lines ending with '\r' */
+				a_arr_char_push(&pbf, '\n');
+			else if (c == '\n' && prev != '\r')
+				a_arr_char_push(&pbf, '\n');
+			else if (isgraph(c) || c == ' ' || c == '\t' || c >= 0x80)
+				a_arr_char_push(&pbf, c);
+		}
+		kb->kb_pos += take;
+		if (end) {
+			kb->kb_pos += SS(a_csi_paste_end);
+			break;
+		}
+		fill_keys();
+	}
+	drop_unprintable(&pbf);
+	ashe_insert_str(a_arr_ptr(pbf), a_arr_len(pbf));
+	a_arr_char_free(&pbf, NULL);
+}
 
-	if (IMPLEMENTED((c = read_key()))) {
+/*
+ * Apply key 'c' decoded from 'n' bytes to the input,
+ * returns 0 if the input got accepted (stop reading).
+ */
+ASHE_PRIVATE a_ubyte process_key(a_int32 c, a_uint32 n)
+{
+	if (IMPLEMENTED(c)) {
 		switch (c) {
 		case CR:
 			if (ashe_cr()) break;
@@ -398,7 +1239,8 @@ ASHE_PRIVATE a_ubyte process_key(void)
 			break;
 		case END_KEY:
 		case CTRL_KEY('e'):
-			ashe_move_to_eol();
+			if (!accept_suggestion())
+				ashe_move_to_eol();
 			break;
 		case HOME_KEY:
 		case CTRL_KEY('s'):
@@ -410,7 +1252,8 @@ ASHE_PRIVATE a_ubyte process_key(void)
 			break;
 		case R_ARW:
 		case CTRL_KEY('l'):
-			ashe_move_right();
+			if (!accept_suggestion())
+				ashe_move_right();
 			break;
 		case U_ARW:
 		case CTRL_KEY('k'):
@@ -432,7 +1275,7 @@ ASHE_PRIVATE a_ubyte process_key(void)
 			ashe_clear_screen_and_redraw();
 			break;
 		case CTRL_KEY('w'):
-			while (ashe_remove_char());
+			ashe_remove_word();
 			break;
 		case CTRL_KEY('d'):
 			ashe_deletefront();
@@ -443,36 +1286,84 @@ ASHE_PRIVATE a_ubyte process_key(void)
 			ashe_exit(EXIT_SUCCESS);
 			break;
 		case CTRL_KEY('i'):
-			// TODO: glob operator (same as TAB in other shells)
+			ashe_complete();
+			break;
+		case PASTE_START:
+			paste();
+			break;
+		case UTF8_CHAR:
+			ashe_insert_str(A_TKBF.kb_buf + A_TKBF.kb_pos - n, n);
 			break;
 		default:
 			if (isgraph(c) || c == ' ')
-				ashe_insert_char(c, 1);
+				ashe_insert_char(c);
 			break;
 		}
 	}
+	return 1;
+}
+
+/*
+ * Apply every key currently available in the key
+ * buffer and draw the result once, reading from the
+ * terminal only if the buffer has no whole key.
+ * Returns 0 if the input got accepted.
+ */
+ASHE_PRIVATE a_ubyte process_keys(void)
+{
+	a_uint32 n;
+	a_int32 key;
+	a_ubyte reading;
+#ifdef ASHE_DBG_IO
+	struct timespec t0, t1;
+#endif
+
+	while ((n = decode_key(&key)) == 0)
+		fill_keys();
+#ifdef ASHE_DBG_IO
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+#endif
+	do {
+		A_TKBF.kb_pos += n;
+		A_TSTAT.io_keys++;
+		if (!(reading = process_key(key, n)))
+			break;
+	} while ((n = decode_key(&key)) > 0);
+	if (reading)
+		a_term_refresh();
+#ifdef ASHE_DBG_IO
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	A_TSTAT.io_batchns = (t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+#endif
 #ifdef ASHE_DBG_CURSOR
 	debug_cursor();
 #endif
 #ifdef ASHE_DBG_LINES
 	debug_lines();
 #endif
-	return 1;
+#ifdef ASHE_DBG_IO
+	debug_iostat();
+#endif
+	return reading;
 }
 
 ASHE_PRIVATE void a_input_read(void)
 {
-	a_term_sync_cursor(); /* sync once in raw mode */
+	if (!(A_TM.tm_caps & A_TCAP_PROBED)) /* sync once in raw mode */
+		a_term_sync_cursor();
 #ifdef ASHE_DBG_CURSOR
 	debug_cursor();
 #endif
 #ifdef ASHE_DBG_LINES
 	debug_lines();
 #endif
-	while (process_key());
+	while (process_keys());
+	ashe_move_to_end();
+	A_TI.in_done = 1;
+	a_term_refresh();
+	ibf_gapto(a_arr_len(A_IBF)); /* make input contiguous */
 	a_arr_char_push(&A_IBF, '\0');
 	resethistcurrent();
-	while (ashe_move_right());
 }
 
 ASHE_PUBLIC void a_input_clear(void)
@@ -483,9 +1374,20 @@ ASHE_PUBLIC void a_input_clear(void)
 
 ASHE_PUBLIC void a_term_init(void)
 {
+	a_uint32 i;
+
 	a_arr_char_init_cap(&A_TP, sizeof(ASHE_PROMPT));
+	a_arr_cell_init_cap(&A_TPC, sizeof(ASHE_PROMPT));
+	a_usertmpl_init(&A_TPT, ASHE_PROMPT);
+	a_screen_init(&A_TSCR);
+	for (i = 0; i < HL_CNT; i++)
+		A_THLATTR[i] = a_screen_attr(&A_TSCR, a_syntax_sgr(i));
 	a_input_init();
 	a_arr_char_init_cap(&A_TDBF, 8);
+	A_TKBF.kb_pos = A_TKBF.kb_len = 0;
+	memset(&A_TSTAT, 0, sizeof(A_TSTAT));
+	A_TM.tm_caps = 0;
+	A_TROW = A_TCOL = 1;
 	ashe_tcgetattr(&A_TIODFL); /* init default termios */
 	init_rawterm(&A_TIORAW); /* init raw mode */
 	a_term_sync_dimensions();
@@ -495,44 +1397,126 @@ ASHE_PUBLIC void a_term_init(void)
 
 ASHE_PUBLIC void a_term_read(void)
 {
-	ashe_mask_signals(SIG_BLOCK);
 	a_input_clear();
-	ashe_draw_prompt_unsafe();
+	a_pathcache_invalidate(&ashe.sh_path);
 	A_TM.tm_reading = 1;
-	ashe_tcsetattr(TCSAFLUSH, &A_TIORAW);
+	/* pending input is kept, it was typed ahead */
+	ashe_tcsetattr(TCSADRAIN, &A_TIORAW);
+	A_TSTAT.io_ioctls++;
+	read_typeahead();
+	dbf_pushlit(a_csi_paste_on);
+	prompt_sp();
+	ashe_draw_prompt_unsafe();
 	a_input_read();
-	ashe_tcsetattr(TCSAFLUSH, &A_TIODFL);
+	dbf_pushlit(a_csi_paste_off);
+	ashe_move_below_input_unsafe();
+	/* keys left in the key buffer are typeahead,
+	 * they start the next input line */
+	ashe_tcsetattr(TCSADRAIN, &A_TIODFL);
+	A_TSTAT.io_ioctls++;
 	A_TM.tm_reading = 0;
-	ashe_print("\n", stderr);
 }
 
-ASHE_PUBLIC void a_term_sync_cursor(void)
+ASHE_PUBLIC a_ubyte a_term_typedahead(void)
 {
-	char buf[ASHE_MAXINT16STR * 2 + sizeof(A_CSI ";")]; /* A_ESC [ Pn ; Pn R */
-	a_ssize nread;
+	return (A_TKBF.kb_pos < A_TKBF.kb_len);
+}
+
+/*
+ * Find cursor position report 'ESC [ row ; col R'
+ * in the key buffer, on success the report is removed
+ * from the buffer.
+ */
+ASHE_PRIVATE a_ubyte find_cursor_report(a_uint32 *row, a_uint32 *col)
+{
+	struct a_keybuf *kb;
+	a_uint32 i, j, n[2], k;
+
+	kb = &A_TKBF;
+	for (i = kb->kb_pos; i + 1 < kb->kb_len; i++) {
+		if (kb->kb_buf[i] != ESCAPE || kb->kb_buf[i + 1] != '[')
+			continue;
+		j = i + 2;
+		for (k = 0; k < 2; k++) {
+			n[k] = 0;
+			if (j >= kb->kb_len || !isdigit(kb->kb_buf[j]))
+				break;
+			while (j < kb->kb_len && isdigit(kb->kb_buf[j]))
+				n[k] = n[k] * 10 + (kb->kb_buf[j++] - '0');
+			if (j >= kb->kb_len || kb->kb_buf[j++] != (k == 0 ? ';' : 'R'))
+				break;
+		}
+		if (k < 2)
+			continue;
+		memmove(kb->kb_buf + i, kb->kb_buf + j, kb->kb_len - j);
+		kb->kb_len -= j - i;
+		*row = n[0];
+		*col = n[1];
+		return 1;
+	}
+	return 0;
+}
+
+ASHE_PUBLIC a_ubyte a_term_sync_cursor(void)
+{
+	struct a_keybuf *kb;
+	struct pollfd pfd;
 	a_uint32 srow, scol;
-	a_uint16 i;
-	char c;
+	a_ssize nread;
+	a_int32 timeout, n;
+	a_ubyte found;
+
+	if ((A_TM.tm_caps & A_TCAP_PROBED) && !(A_TM.tm_caps & A_TCAP_DSR))
+		return 0;
+
+	/* don't wait forever on terminals that never answer */
+	timeout = (A_TM.tm_caps & A_TCAP_DSR) ? -1 : 1000;
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	kb = &A_TKBF;
 
-	i = 0;
 	draw_lit(a_csi_cursor_position);
-	while (i < sizeof(buf) && (nread = read(STDIN_FILENO, &c, 1)) == 1) {
-		if (c == 'R')
+	while (!(found = find_cursor_report(&srow, &scol))) {
+		if (kb->kb_pos > 0) { /* make room */
+			kb->kb_len -= kb->kb_pos;
+			memmove(kb->kb_buf, kb->kb_buf + kb->kb_pos, kb->kb_len);
+			kb->kb_pos = 0;
+		}
+		if (a_unlikely(kb->kb_len == A_KBUFSIZE))
 			break;
-		buf[i++] = c;
+		if ((n = poll(&pfd, 1, timeout)) < 0) {
+			if (a_unlikely(errno != EINTR))
+				ashe_panic_libcall(poll);
+			continue;
+		} else if (n == 0) {
+			break;
+		}
+		nread = read(STDIN_FILENO, kb->kb_buf + kb->kb_len, A_KBUFSIZE - kb->kb_len);
+		A_TSTAT.io_reads++;
+		if (nread < 0) {
+			if (a_unlikely(errno != EINTR))
+				ashe_panic_libcall(read);
+			continue;
+		} else if (nread == 0) {
+			break;
+		}
+		kb->kb_len += nread;
 	}
 
-	if (a_unlikely(sscanf(buf, "\033[%u;%u", &srow, &scol) != 2))
-		ashe_panic_libcall(sscanf);
-
+	A_TM.tm_caps |= A_TCAP_PROBED;
+	if (a_unlikely(!found))
+		return 0;
+	A_TM.tm_caps |= A_TCAP_DSR;
 	A_TROW = srow;
 	A_TCOL = scol;
+	return 1;
 }
 
 ASHE_PUBLIC void a_term_sync_dimensions(void)
 {
 	struct winsize ws;
 
+	A_TSTAT.io_ioctls++;
 	if (a_unlikely(ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) < 0 || ws.ws_col == 0)) {
 		get_winsize_fallback();
 		return;
@@ -541,157 +1525,211 @@ ASHE_PUBLIC void a_term_sync_dimensions(void)
 	A_TCOLMAX = ws.ws_col;
 }
 
+
 ASHE_PUBLIC void a_term_free(void)
 {
+	if (A_TM.tm_reading) { /* exiting while reading */
+		draw_lit(a_csi_paste_off);
+		ashe_tcsetattr(TCSADRAIN, &A_TIODFL);
+	}
 	a_arr_char_free(&A_TP, NULL);
+	a_arr_cell_free(&A_TPC, NULL);
+	a_usertmpl_free(&A_TPT);
+	a_screen_free(&A_TSCR);
 	a_input_free();
 	a_arr_char_free(&A_TDBF, NULL);
 }
 
-ASHE_PUBLIC a_ubyte ashe_insert_char(a_ubyte c, a_ubyte hidecur)
+ASHE_PUBLIC a_uint32 ashe_insert_str(const char *str, a_uint32 len)
 {
-	struct a_line newline;
-	a_uint32 idx;
-	a_ubyte relink;
+	struct a_line *lines, *line;
+	const char *p, *nl, *end;
+	a_uint32 n, row, after, start, off, pold, pnew, vary, tailvary;
 
-	/* return if input limit would be exceeded */
-	if (a_unlikely(a_arr_len(A_IBF) >= MAXCMDSIZE))
+	if (a_unlikely(len == 0))
 		return 0;
+	layout_sync();
 
-	/* update state and input buffer */
-	idx = A_IBFIDX;
-	relink = (a_arr_len(A_IBF) >= a_arr_cap(A_IBF));
-	a_arr_char_insert(&A_IBF, idx, c);
-	A_ILINE.len++;
-	if (a_unlikely(relink))
-		relink_lines();
-
-	/* draw */
-	shift_lines_from(A_IROW + 1, 1, +); /* shift right */
-	if (hidecur) dbf_pushlit(a_csi_cursor_hide);
-	dbf_pushlit(a_csi_clear_line_right a_csi_clear_down);
-	if (c == '\n' && A_TCOL < A_TCOLMAX) { /* inside of 'ashe_i_cr()' ? */
-		dbf_pushc('\n');
-		idx++;
-	}
-	dbf_pushlit(a_csi_cursor_save);
-	dbf_push_len(a_arr_char_index(&A_IBF, idx), a_arr_len(A_IBF) - idx);
-	dbf_pushlit(a_csi_cursor_load);
-	if (hidecur) dbf_pushlit(a_csi_cursor_show);
-	dbf_flush();
-
-	if (c == '\n') {
-		newline.start = A_ILINE.start + A_ICOL + 1;
-		newline.len = A_ILINE.len - A_ICOL - 1;
-		newline.trow = A_TROW < A_TROWMAX ? ++A_TROW : A_TROW;
-		newline.flags = 0;
-		a_arr_line_insert(&A_ILINES, A_IROW + 1, newline);
-
-		A_ILINE.len = A_ICOL + 1;
-		A_IBFIDX++;
-		A_IROW++;
-		A_ICOL = 0;
-		A_TCOL = 1;
-		return 1;
+	/* update input buffer */
+	ibf_insert(A_IBFIDX, str, len);
+	start = A_IBFIDX;
+	A_IBFIDX += len;
+
+	end = str + len;
+	for (n = 0, p = str; (nl = memchr(p, '\n', end - p)); p = nl + 1)
+		n++;
+	line = &A_ILINE;
+	off = line_off(A_IROW);
+	after = line->len - A_ICOL;
+	if (n == 0) { /* stays within the cursor line */
+		vary = 0;
+		pold = off + A_IX;
+		pnew = measure(start, A_IBFIDX, pold, &vary);
+		line->width += (line->vary > 0 ? reflow(A_IBFIDX, A_IBFIDX + after, pold, pnew, 0) :
+						 (a_int32)(pnew - pold));
+		line->vary += vary;
+		line->len += len;
+		A_ICOL += len;
+		A_IX = pnew - off;
+		rows_update(A_IROW, len);
+		return len;
 	}
 
-	ashe_move_right();
-	if (A_TROW > A_TROWMAX) {
-		ashe_assert(A_IBFIDX == A_IBF.len);
-		A_TROW--;
-		draw_lit("\n");
+	/* split into lines, rest of the cursor line goes after the last '\n' */
+	tailvary = 0;
+	span_width(A_IBFIDX, A_IBFIDX + after, &tailvary);
+	a_arr_line_ensure(&A_ILINES, n);
+	lines = a_arr_ptr(A_ILINES);
+	memmove(lines + A_IROW + 1 + n, lines + A_IROW + 1,
+		(a_arr_len(A_ILINES) - A_IROW - 1) * sizeof(*lines));
+	a_arr_len(A_ILINES) += n;
+	row = A_IROW;
+	lines[row].len = A_ICOL;
+	lines[row].vary -= tailvary;
+	pold = off + A_IX;
+	for (p = str; (nl = memchr(p, '\n', end - p)); p = nl + 1) {
+		vary = 0;
+		lines[row].width = measure(start + (p - str), start + (nl + 1 - str), pold, &vary) -
+				   line_off(row);
+		lines[row].vary += vary;
+		lines[row++].len += nl - p + 1;
+		lines[row] = (struct a_line){ .len = 0, .width = 0, .vary = 0 };
+		pold = 0;
 	}
+	A_IROW = row;
+	A_ICOL = end - p;
+	vary = 0;
+	A_IX = measure(start + (p - str), A_IBFIDX, 0, &vary);
+	lines[row].width = measure(A_IBFIDX, A_IBFIDX + after, A_IX, &vary);
+	lines[row].vary = vary;
+	lines[row].len = A_ICOL + after;
+	rows_invalidate();
+	return len;
+}
 
-	/* TODO: fix input that is located in scroll area */
-	return 1;
+ASHE_PUBLIC a_ubyte ashe_insert_char(a_ubyte c)
+{
+	return ashe_insert_str((const char *)&c, 1) > 0;
 }
 
 ASHE_PUBLIC a_ubyte ashe_remove_char(void)
 {
-	struct a_line *l;
-	a_ubyte coalesce;
+	struct a_line *line, old;
+	a_uint32 b, n, off, pold, pnew;
+	a_ubyte w;
 
 	if (A_IBFIDX <= 0)
 		return 0;
-	a_arr_char_remove(&A_IBF, A_IBFIDX - 1);
-	shift_lines_from(A_IROW + 1, 1, -); /* shift left */
-	A_ILINE.len -= !(coalesce = (A_ICOL == 0));
-	l = &A_ILINE; /* cache current line */
-	ashe_move_left();
-	if (coalesce) {
-		ashe_assert(A_ILINES.len > 1);
-		A_ILINE.len--; /* '\n' */
-		A_ILINE.len += l->len;
-		a_arr_line_remove(&A_ILINES, A_IROW + 1);
+	layout_sync();
+	line = &A_ILINE;
+	if (A_ICOL > 0) { /* whole character before the cursor */
+		b = char_prev(A_IBFIDX);
+		n = A_IBFIDX - b;
+		w = A_IWAT(b);
+		off = line_off(A_IROW);
+		pold = off + A_IX;
+		pnew = pold - (w & W_COLS);
+		line->vary -= ((w & W_VARY) != 0);
+		ibf_remove(b, n);
+		A_IBFIDX = b;
+		A_ICOL -= n;
+		A_IX = pnew - off;
+		line->len -= n;
+		line->width += (line->vary > 0 ?
+					reflow(b, b + line->len - A_ICOL, pold, pnew, 0) :
+					(a_int32)(pnew - pold));
+		rows_update(A_IROW, -(a_int32)n);
+	} else { /* removed '\n', coalesce with the line above */
+		ashe_assert(A_IROW > 0);
+		ibf_remove(A_IBFIDX - 1, 1);
+		A_IBFIDX--;
+		old = *line;
+		a_arr_line_remove(&A_ILINES, A_IROW);
+		A_IROW--;
+		line = &A_ILINE;
+		off = line_off(A_IROW);
+		A_ICOL = line->len - 1;
+		A_IX = line->width;
+		pnew = off + A_IX;
+		line->len += old.len - 1;
+		line->width = old.width - off +
+			      (old.vary > 0 ? (a_uint32)reflow(A_IBFIDX, A_IBFIDX + old.len, 0, pnew, 0) :
+					      pnew);
+		line->vary += old.vary;
+		rows_invalidate();
 	}
-	dbf_pushlit(a_csi_cursor_hide a_csi_clear_line_right a_csi_clear_down a_csi_cursor_save);
-	dbf_push_len(a_arr_char_index(&A_IBF, A_IBFIDX), a_arr_len(A_IBF) - A_IBFIDX);
-	dbf_pushlit(a_csi_cursor_load a_csi_cursor_show);
-	dbf_flush();
 	return 1;
 }
 
-/*
- * TODO: needs testing, probably doesn't work, I don't
- * even use it, cba.
- */
 ASHE_PUBLIC a_uint32 ashe_remove_bytes(a_ssize len)
 {
 	struct a_line *line;
-	a_uint32 bufflen, toremove, rmlines, i;
-	a_ssize leftover;
+	a_uint32 leftover, end, total, row, lines, p, w, vary;
 
-	bufflen = a_arr_len(A_IBF);
-	leftover = bufflen - A_IBFIDX;
-	if (bufflen == 0 || len > leftover)
+	leftover = a_arr_len(A_IBF) - A_IBFIDX;
+	if (len < 0)
+		len = leftover;
+	if (len == 0 || (a_uint32)len > leftover)
 		return 0;
-	if (len < 0 || len == leftover) {
-		toremove = leftover;
-		a_arr_len(A_ILINES) = A_IROW + 1;
-		a_arr_len(A_IBF) = A_IBFIDX + 1;
-		A_ILINE.len = A_ICOL;
-		return toremove;
-	}
-
-	toremove = len;
-	leftover = toremove - (A_ILINE.len - A_ICOL);
-	A_ILINE.len = A_ICOL;
-	rmlines = 0;
-
-	for (i = A_IROW + 1; i < a_arr_len(A_ILINES); i++) {
-		line = a_arr_line_index(&A_ILINES, i);
-		if ((leftover -= line->len) <= 0) {
-			leftover += line->len;
-			break;
-		}
-		rmlines++;
-	}
+	layout_sync();
 
-	if (rmlines > 0)
-		a_arr_line_remove_n(&A_ILINES, A_IROW + 1, rmlines);
-
-	if (leftover >= 0 && A_IROW < a_arr_len(A_ILINES)) { /* coalesce ? */
-		line = a_arr_line_index(&A_ILINES, A_IROW + 1);
-		A_ILINE.len += line->len;
-		A_ILINE.len -= leftover;
-		a_arr_line_remove(&A_ILINES, A_IROW + 1);
-		shift_lines_from(A_IROW + 1, toremove, -);
+	/* find the line where the removed range ends */
+	lines = a_arr_len(A_ILINES);
+	line = &A_ILINE;
+	end = A_ICOL + len;
+	total = line->len;
+	for (row = A_IROW; end >= total && row + 1 < lines;)
+		total += a_arr_line_index(&A_ILINES, ++row)->len;
+
+	/* what is left from the last line joins the cursor line */
+	p = line_off(A_IROW) + A_IX;
+	vary = 0;
+	if (row > A_IROW) {
+		span_width(A_IBFIDX, A_IBFIDX + line->len - A_ICOL, &vary);
+		line->vary -= vary;
+		a_arr_line_remove_n(&A_ILINES, A_IROW + 1, row - A_IROW);
+		line = &A_ILINE;
+		line->len = total - len;
+		ibf_remove(A_IBFIDX, len);
+		vary = 0;
+		line->width = measure(A_IBFIDX, A_IBFIDX + line->len - A_ICOL, p, &vary) -
+			      line_off(A_IROW);
+		line->vary += vary;
+		rows_invalidate();
+	} else {
+		w = span_width(A_IBFIDX, A_IBFIDX + len, &vary);
+		line->vary -= vary;
+		line->len = total - len;
+		ibf_remove(A_IBFIDX, len);
+		line->width += (line->vary > 0 ?
+					reflow(A_IBFIDX, A_IBFIDX + line->len - A_ICOL, p + w, p, 0) :
+					-(a_int32)w);
+		rows_update(A_IROW, -(a_int32)len);
 	}
+	return len;
+}
 
-	a_arr_char_remove_n(&A_IBF, A_IBFIDX, toremove);
+ASHE_PUBLIC a_ubyte ashe_remove_word(void)
+{
+	a_uint32 idx;
 
-	/* reflect changes on the terminal screen */
-	dbf_pushlit(a_csi_cursor_hide a_csi_clear_line_right a_csi_clear_down a_csi_cursor_save);
-	dbf_push_len(a_arr_char_index(&A_IBF, A_IBFIDX), a_arr_len(A_IBF) - A_IBFIDX);
-	dbf_pushlit(a_csi_cursor_load a_csi_cursor_show);
-	dbf_flush();
-	return 1;
+	idx = A_IBFIDX;
+	while (idx > 0 && isspace((a_ubyte)A_IBFAT(idx - 1)))
+		idx--;
+	while (idx > 0 && !isspace((a_ubyte)A_IBFAT(idx - 1)))
+		idx--;
+	if (idx == A_IBFIDX)
+		return 0;
+	idx = A_IBFIDX - idx;
+	ashe_move_to_index(A_IBFIDX - idx);
+	return ashe_remove_bytes(idx) > 0;
 }
 
 ASHE_PUBLIC a_ubyte ashe_cr(void)
 {
+	ibf_gapto(A_IBFIDX); /* input before the cursor is contiguous */
 	if (ashe_isescaped(a_arr_ptr(A_IBF), A_IBFIDX) || ashe_indq(a_arr_ptr(A_IBF), A_IBFIDX)) {
-		ashe_insert_char('\n', 1);
+		ashe_insert_char('\n');
 		return 1;
 	}
 	return 0;
@@ -700,11 +1738,6 @@ ASHE_PUBLIC a_ubyte ashe_cr(void)
 /*
  * Prompt must not have newline or else it
  * will mess up cursor navigation.
- * Additionally tabs are removed also because
- * the shell doesn't support tabs (yet).
- *
- * TODO: add support for tabs by adding separate array
- * of graphical bytes for each line.
  */
 ASHE_PRIVATE void sanitize_prompt(void)
 {
@@ -715,7 +1748,6 @@ ASHE_PRIVATE void sanitize_prompt(void)
 		switch (c) {
 		case '\n':
 		case '\r':
-		case '\t':
 		case '\v':
 		case '\f':
 			*p = ' ';
@@ -727,237 +1759,141 @@ ASHE_PRIVATE void sanitize_prompt(void)
 	}
 }
 
-ASHE_PUBLIC a_ubyte ashe_draw_prompt_unsafe(void)
+
+/* Expand the prompt, returns 1 if it changed. */
+ASHE_PRIVATE a_ubyte expand_prompt(void)
 {
-	a_arr_len(A_TP) = 0;
-	parse_placeholders(&A_TP, ASHE_PROMPT);
+	if (!a_usertmpl_expand(&A_TPT, &A_TP)) /* prompt cells are up to date */
+		return 0;
 	sanitize_prompt();
 	if (a_unlikely(a_arr_len(A_TP) >= ASHE_USERSTR_MAX)) {
 		a_arr_len(A_TP) = ASHE_USERSTR_MAX - 1;
 		a_arr_char_push(&A_TP, '\0');
 	}
-	ashe_print(a_arr_ptr(A_TP), stderr);
+	a_arr_len(A_TPC) = 0;
+	a_screen_cells(&A_TSCR, &A_TPC, a_arr_ptr(A_TP));
 	return 1;
 }
 
+ASHE_PUBLIC a_ubyte ashe_draw_prompt_unsafe(void)
+{
+	a_usertmpl_prepare(&A_TPT);
+	expand_prompt();
+	a_screen_invalidate(&A_TSCR);
+	a_term_refresh();
+	return 1;
+}
+
+ASHE_PUBLIC void ashe_update_prompt(void)
+{
+	if (A_TM.tm_reading && expand_prompt())
+		a_term_refresh(); /* only changed cells are drawn */
+}
+
 ASHE_PUBLIC void ashe_redraw_prompt(void)
 {
-	ashe_move_to_end();
+	A_TI.in_done = 1; /* abandoned input keeps no suggestion */
+	a_term_refresh();
+	ashe_move_below_input_unsafe();
 	a_input_clear();
-	ashe_print("\r\n", stderr);
 	ashe_draw_prompt_unsafe();
-	a_term_sync_cursor();
 }
 
 ASHE_PUBLIC a_ubyte ashe_move_left(void)
 {
-	if (A_ICOL > 0) {
-		A_ICOL--;
-		if (A_TCOL == 1) {
-			A_TCOL = A_TCOLMAX;
-			goto lineuptocol;
-		} else {
-			A_TCOL--;
-			draw_lit(a_csi_cursor_left(1));
-		}
+	a_uint32 b;
+
+	layout_sync();
+	if (A_ICOL > 0) { /* skip characters taking no columns */
+		b = A_IBFIDX;
+		do {
+			b = char_prev(b);
+			A_IX -= wcols(b);
+		} while (b > A_IBFIDX - A_ICOL && wcols(b) == 0);
+		A_ICOL -= A_IBFIDX - b;
+		A_IBFIDX = b;
 	} else if (A_IROW > 0) {
 		A_IROW--;
-		A_ICOL = A_ILINE.len - 1;
-		A_TCOL = tcol(A_ILINE.len + ((A_IROW == 0) * A_TPLEN));
-lineuptocol:
-		A_TROW--;
-		dbf_pushlit(a_csi_cursor_up(1));
-		dbf_push_movecol(A_TCOL);
-		dbf_flush();
+		A_ICOL = A_ILINE.len - 1; /* on '\n' */
+		A_IX = line_width(A_IROW);
+		A_IBFIDX--;
 	} else {
 		return 0;
 	}
-	A_IBFIDX--;
 	return 1;
 }
 
 ASHE_PUBLIC a_ubyte ashe_move_right(void)
 {
-	if (A_ICOL < A_ILINE.len - (A_IROW < A_ILINES.len - 1)) {
-		A_ICOL++;
-		if (A_TCOL < A_TCOLMAX) {
-			A_TCOL++;
-			draw_lit(a_csi_cursor_right(1));
-		} else {
-			goto firstcoldown;
-		}
-	} else if (A_IROW < (A_ILINES.len - 1)) {
+	a_uint32 b, end;
+
+	layout_sync();
+	end = A_IBFIDX - A_ICOL + line_bytes(A_IROW);
+	if (A_IBFIDX < end) {
+		b = A_IBFIDX;
+		do {
+			A_IX += wcols(b);
+			b = char_next(b);
+		} while (b < end && wcols(b) == 0);
+		A_ICOL += b - A_IBFIDX;
+		A_IBFIDX = b;
+	} else if (A_IROW < a_arr_len(A_ILINES) - 1) {
 		A_IROW++;
 		A_ICOL = 0;
-firstcoldown:
-		A_TROW++;
-		A_TCOL = 1;
-		draw_lit(a_csi_cursor_down(1) a_csi_cursor_col(1));
+		A_IX = 0;
+		A_IBFIDX++;
 	} else {
 		return 0;
 	}
-	A_IBFIDX++;
 	return 1;
 }
 
 ASHE_PUBLIC a_ubyte ashe_move_down(void)
 {
-	ashe_assert(A_ILINES.len > 0);
-	a_uint32 extra = (A_IROW == 0) * A_TPLEN;
-	a_ubyte notlastrow = (A_IROW < A_ILINES.len - 1);
-	a_uint32 linewraps = (A_ILINE.len != 0) * trowdiffx(A_ILINE.len + extra - notlastrow);
-	a_uint32 colwraps = (A_ICOL != 0) * trowdiffx(A_ICOL + extra);
-	a_ssize wraps = linewraps - colwraps;
-	a_ubyte temp;
-
-	if (wraps > 0) {
-		if (wraps > 1 || A_ICOL + extra + A_TCOLMAX <= A_ILINE.len + extra - 1) {
-			A_ICOL += A_TCOLMAX;
-			A_IBFIDX += A_TCOLMAX;
-			goto down;
-		} else {
-			temp = (A_IROW < A_ILINES.len - 1);
-			A_IBFIDX += A_ILINE.len - A_ICOL - temp;
-			A_ICOL = A_ILINE.len - temp;
-			A_TCOL = tcol(A_ILINE.len + extra + !temp);
-			goto downtocol;
-		}
-	} else if (A_IROW < A_ILINES.len - 1) {
-		A_IBFIDX += A_ILINE.len - A_ICOL; /* start of new line */
-		A_IROW++;
-		if (A_ILINE.len >= A_TCOLMAX || A_ILINE.len >= tcol(A_ICOL + 1 + extra)) {
-			A_IBFIDX += A_TCOL - 1;
-			A_ICOL = A_TCOL - 1;
-down:
-			dbf_pushlit(a_csi_cursor_down(1));
-			goto flush;
-		} else {
-			temp = (A_IROW != A_ILINES.len - 1);
-			A_IBFIDX += A_ILINE.len - temp;
-			A_ICOL = A_ILINE.len - temp;
-			A_TCOL = A_ILINE.len + !temp;
-downtocol:
-			dbf_pushlit(a_csi_cursor_down(1));
-			dbf_push_movecol(A_TCOL);
-flush:
-			dbf_flush();
-		}
-		A_TROW++;
-		return 1;
-	}
-	return 0;
+	a_uint32 row;
+
+	if ((row = cursor_row()) + 1 >= input_rows())
+		return 0;
+	move_to_row(row + 1, cursor_col());
+	return 1;
 }
 
 ASHE_PUBLIC a_ubyte ashe_move_up(void)
 {
-	a_uint32 extra = ((A_IROW == 0) * A_TPLEN);
-	a_uint32 len = A_ICOL + 1 + extra;
-	a_uint32 pwraps = (A_TPLEN != 0) * ((A_TPLEN - 1) / A_TCOLMAX);
-	a_uint32 lwraps = (len - 1) / A_TCOLMAX;
-	a_uint32 temp;
-
-	temp = lwraps - pwraps;
+	a_uint32 row;
 
-	if (A_IROW == 0 && (temp == 0 || (temp < 2 && len % A_TCOLMAX == 0)))
+	if ((row = cursor_row()) <= trowdiffx(A_TPLEN))
 		return 0;
-
-	if (A_IROW == 0) {
-		if (temp == 1 && (temp = tcol(A_TPLEN)) >= tcol(len)) {
-start:
-			A_ICOL = 0;
-			A_IBFIDX = 0;
-			A_TCOL = temp;
-			goto uptocol_draw;
-		} else {
-			goto up;
-		}
-	} else if (lwraps == 0) {
-		A_IBFIDX -= A_ICOL + 1; /* end of the line above */
-		A_IROW--;
-		extra = (A_IROW == 0) * A_TPLEN;
-		len = A_ILINE.len + extra;
-		lwraps = (len - 1) / A_TCOLMAX;
-		if ((temp = tcol(len)) <= A_ICOL + 1) {
-			A_ICOL = A_ILINE.len - 1;
-			A_TCOL = temp;
-			goto uptocol_draw;
-		} else {
-			temp = tcol(A_ICOL + 1);
-			if (A_IROW == 0 && lwraps - pwraps == 0 && tcol(A_TPLEN) >= temp) {
-				temp = tcol(A_TPLEN + 1);
-				goto start;
-			}
-			temp = tcol(len) - temp;
-			A_ICOL = A_ILINE.len - temp - 1;
-			A_IBFIDX -= temp;
-			goto up_draw;
-		}
-	} else { /* lwraps > 0 */
-up:
-		A_ICOL -= A_TCOLMAX;
-		A_IBFIDX -= A_TCOLMAX;
-up_draw:
-		dbf_pushlit(a_csi_cursor_up(1));
-		goto flush;
-	}
-uptocol_draw:
-	dbf_pushlit(a_csi_cursor_up(1));
-	dbf_push_movecol(A_TCOL);
-flush:
-	dbf_flush();
-	A_TROW--;
+	move_to_row(row - 1, cursor_col());
 	return 1;
 }
 
 ASHE_PUBLIC a_ubyte ashe_move_to_eol(void)
 {
-	a_uint32 extra = (A_IROW == 0) * A_TPLEN;
-	a_uint32 col = A_ICOL + extra;
-	a_uint32 len = A_ILINE.len + extra;
-	a_uint32 temp;
-	a_ubyte isnotlastrow = !(A_ILINES.len == 1 || A_IROW == A_ILINES.len - 1);
-
-	if (A_ILINE.len > 0 &&
-	    ((temp = tcol(col + 1)) != A_TCOLMAX || A_ICOL != A_ILINE.len - isnotlastrow)) {
-		ashe_assert(A_ILINE.len != 0);
-		if (trowdiffx(col) < trowdiffx(len)) {
-			A_TCOL = A_TCOLMAX;
-			A_ICOL += A_TCOLMAX - temp;
-			A_IBFIDX += A_TCOLMAX - temp;
-		} else {
-			A_TCOL = tcol(len) + !isnotlastrow;
-			A_IBFIDX += A_ILINE.len - A_ICOL - isnotlastrow;
-			A_ICOL = A_ILINE.len - isnotlastrow;
-		}
-		dbf_push_movecol(A_TCOL);
-		dbf_flush();
-		return 1;
-	}
-	return 0;
+	a_uint32 start, b, x;
+
+	start = A_IBFIDX - A_ICOL;
+	b = seek(A_IROW, start, (trowdiffx(cursor_pos()) + 1) * A_TCOLMAX - 1, &x);
+	if (b == A_IBFIDX)
+		return 0;
+	A_ICOL = b - start;
+	A_IBFIDX = b;
+	A_IX = x;
+	return 1;
 }
 
 ASHE_PUBLIC a_ubyte ashe_move_to_sol(void)
 {
-	a_uint32 extra = (A_IROW == 0) * A_TPLEN;
-	a_uint32 col = A_ICOL + extra;
-	a_ssize temp;
-
-	if (A_ICOL != 0 && (temp = tcol(col + 1)) != 1) {
-		if (col < A_TCOLMAX) {
-			A_IBFIDX -= A_ICOL;
-			A_ICOL = 0;
-			A_TCOL = extra + 1;
-		} else {
-			A_IBFIDX -= temp - 1;
-			A_ICOL -= temp - 1;
-			col = A_ICOL + extra;
-			A_TCOL = tcol(col + 1);
-		}
-		dbf_push_movecol(A_TCOL);
-		dbf_flush();
-		return 1;
-	}
-	return 0;
+	a_uint32 start, b, x;
+
+	start = A_IBFIDX - A_ICOL;
+	b = seek(A_IROW, start, trowdiffx(cursor_pos()) * A_TCOLMAX, &x);
+	if (b == A_IBFIDX)
+		return 0;
+	A_ICOL = b - start;
+	A_IBFIDX = b;
+	A_IX = x;
+	return 1;
 }
 
 ASHE_PUBLIC void ashe_clear_screen_unsafe(void)
@@ -967,73 +1903,58 @@ ASHE_PUBLIC void ashe_clear_screen_unsafe(void)
 
 ASHE_PUBLIC void ashe_clear_screen_and_redraw(void)
 {
-	ashe_clear_screen_unsafe();
+	/* flushed together with the prompt */
+	dbf_pushlit(a_csi_cursor_home a_csi_clear_all);
+	A_TROW = A_TCOL = 1;
 	ashe_draw_prompt_unsafe();
-	ashe_redraw_input_unsafe();
-	a_term_sync_cursor();
-}
-
-/* Only draws to the terminal screen. */
-ASHE_PUBLIC void ashe_redraw_input_unsafe(void)
-{
-	dbf_pushlit(a_csi_cursor_hide);
-	dbf_push_len(a_arr_ptr(A_IBF), A_IBFIDX);
-	dbf_pushlit(a_csi_cursor_save);
-	dbf_push_len(a_arr_ptr(A_IBF) + A_IBFIDX, a_arr_len(A_IBF) - A_IBFIDX);
-	dbf_pushlit(a_csi_cursor_load a_csi_cursor_show);
-	dbf_flush();
 }
 
 ASHE_PUBLIC a_ubyte ashe_move_to_start(void)
 {
-	a_int32 up;
-
 	if (A_IBFIDX == 0) /* already at start ? */
 		return 0;
-
-	/* update input buffer */
-	up = first_row_diff(0);
-	A_TROW -= up;
-	A_TCOL = tcol(A_TPLEN + 1);
 	A_IBFIDX = 0;
 	A_ICOL = 0;
+	A_IX = 0;
 	A_IROW = 0;
+	return 1;
+}
 
-	/* update terminal cursor */
-	dbf_pushlit(a_csi_cursor_hide);
-	if (up > 0) dbf_push_moveup(up);
-	dbf_push_movecol(A_TCOL);
-	dbf_pushlit(a_csi_cursor_show);
-	dbf_flush();
+ASHE_PUBLIC a_ubyte ashe_move_to_index(a_uint32 idx)
+{
+	a_uint32 start, row, end, vary;
 
+	idx = a_min(idx, a_arr_len(A_IBF));
+	if (idx == A_IBFIDX)
+		return 0;
+	row = A_IROW;
+	start = idx;
+	A_IROW = line_find(&start);
+	start = idx - start; /* start of the new cursor line */
+	/* walk from the closest character with known column */
+	vary = 0;
+	end = start + line_bytes(A_IROW);
+	if (row == A_IROW && idx > A_IBFIDX)
+		A_IX += span_width(A_IBFIDX, idx, &vary);
+	else if (row == A_IROW)
+		A_IX -= span_width(idx, A_IBFIDX, &vary);
+	else if (idx - start <= end - idx)
+		A_IX = span_width(start, idx, &vary);
+	else
+		A_IX = line_width(A_IROW) - span_width(idx, end, &vary);
+	A_ICOL = idx - start;
+	A_IBFIDX = idx;
 	return 1;
 }
 
 ASHE_PUBLIC a_ubyte ashe_move_to_end(void)
 {
-	struct a_line *line;
-	a_uint32 lines, down;
-
 	if (A_IBFIDX == a_arr_len(A_IBF)) /* already at end ? */
 		return 0;
-
-	/* update input buffer */
-	down = last_row_diff();
-	lines = a_arr_len(A_ILINES);
-	line = a_arr_line_last(&A_ILINES);
 	A_IBFIDX = a_arr_len(A_IBF);
-	A_IROW = lines - (lines == 0);
-	A_ICOL = line->len + (lines == 0) * A_TPLEN;
-	A_IROW += down;
-	A_TCOL = tcol(A_ICOL);
-
-	/* update terminal cursor */
-	dbf_pushlit(a_csi_cursor_hide);
-	dbf_push_movedown(down);
-	dbf_push_movecol(tcol(A_ICOL));
-	dbf_pushlit(a_csi_cursor_show);
-	dbf_flush();
-
+	A_IROW = a_arr_len(A_ILINES) - 1;
+	A_ICOL = A_ILINE.len;
+	A_IX = line_width(A_IROW);
 	return 1;
 }
 
@@ -1043,20 +1964,11 @@ ASHE_PUBLIC a_ubyte ashe_move_to_end(void)
  */
 ASHE_PUBLIC void sigwinch_redraw(void)
 {
-	a_int32 up;
-
-	up = first_row_diff(1);
+	A_TROW -= a_min(A_TSCR.sc_row, A_TROW - 1);
+	A_TCOL = 1;
+	a_screen_home(&A_TSCR, &A_TDBF);
+	dbf_pushlit(a_csi_clear_down);
 	a_term_sync_dimensions();
-	up -= A_TCOLMAX == 1;
-	dbf_pushlit(a_csi_cursor_hide);
-	if (up > 0)
-		dbf_push_moveup(up);
-	dbf_pushlit(a_csi_cursor_col(1) a_csi_clear_line_right a_csi_clear_down);
-	dbf_push_len(a_arr_ptr(A_TP), A_TPLEN);
-	dbf_push_len(a_arr_ptr(A_IBF), A_IBFIDX);
-	dbf_pushlit(a_csi_cursor_save);
-	dbf_push_len(a_arr_char_index(&A_IBF, A_IBFIDX), a_arr_len(A_IBF) - A_IBFIDX);
-	dbf_pushlit(a_csi_cursor_load a_csi_cursor_show);
-	dbf_flush();
-	a_term_sync_cursor();
+	a_screen_invalidate(&A_TSCR);
+	a_term_refresh();
 }
@@ -20,6 +20,9 @@
 #include "acommon.h"
 #include "aarray.h"
 #include "atoken.h"
+#include "ascreen.h"
+#include "asyntax.h"
+#include "auserstr.h"
 
 #include <termios.h>
 
@@ -28,7 +31,10 @@
 
 /* terminal members */
 #define A_TP	  A_TM.tm_prompt
-#define A_TPLEN	  (a_arr_len(A_TM.tm_prompt) - 1)
+#define A_TPC	  A_TM.tm_pcells
+#define A_TPT	  A_TM.tm_ptmpl
+#define A_TPLEN	  a_arr_len(A_TM.tm_pcells)
+#define A_TSCR	  A_TM.tm_screen
 #define A_TDBF	  A_TM.tm_dbf
 #define A_TIODFL  A_TM.tm_dfltermios
 #define A_TIORAW  A_TM.tm_rawtermios
@@ -36,6 +42,9 @@
 #define A_TCOLMAX A_TM.tm_columns
 #define A_TCOL	  A_TM.tm_col
 #define A_TROW	  A_TM.tm_row
+#define A_TKBF	  A_TM.tm_kbf
+#define A_TSTAT	  A_TM.tm_stat
+#define A_THLATTR A_TM.tm_hlattr
 
 /* input */
 #define A_TI A_TM.tm_input
@@ -43,54 +52,144 @@
 /* input members */
 #define A_IBF	 A_TI.in_ibf
 #define A_IBFIDX A_TI.in_ibfidx
+#define A_IGAP	 A_TI.in_gap
 #define A_ILINES A_TI.in_lines
 #define A_ICOL	 A_TI.in_col
+#define A_IX	 A_TI.in_x
 #define A_IROW	 A_TI.in_row
 #define A_ILINE	 a_arr_ptr(A_ILINES)[A_IROW]
 #define A_ISROW	 A_TI.in_startrow
 #define A_ISCOL	 A_TI.in_startcol
+#define A_ITOP	 A_TI.in_top
+#define A_ISYN	 A_TI.in_syntax
 
-struct a_line { /* input line */
-	char *start;
-	a_memmax len;
+/* size of the gap in the input buffer */
+#define A_IGAPLEN (a_arr_cap(A_IBF) - a_arr_len(A_IBF))
 
-	/* TODO: implement line flags and trow in order to move
-	 * cursor up properly up after terminal scrolls down. */
-	a_uint32 trow;
-#define ALF_SCROLLWIN 0x01 /* last char will scroll window */
-	a_ubyte flags;
+/* input byte at index 'i' (skipping the gap) */
+#define A_IBFAT(i) (a_arr_ptr(A_IBF)[(i) < A_IGAP ? (i) : (i) + A_IGAPLEN])
+
+/* display width of the input byte at index 'i' */
+#define A_IWAT(i) (A_TI.in_wbf[(i) < A_IGAP ? (i) : (i) + A_IGAPLEN])
+
+struct a_line { /* input line, starts where the previous line ends */
+	a_memmax len; /* including '\n' (if not the last line) */
+	a_uint32 width; /* columns taken by the characters */
+	a_uint32 vary; /* characters with width depending on their column */
 };
 
 ARRAY_NEW(a_arr_line, struct a_line)
 
 /* terminal input */
 struct a_input {
-	/* input buffer and current cursor index within it */
+	/*
+	 * Input buffer and current cursor index within it.
+	 * Buffer is a gap buffer, 'len' is the length of the
+	 * input and the gap (unused capacity) starts at
+	 * 'in_gap'. When the input is accepted the gap is
+	 * moved to the end making the buffer contiguous.
+	 */
 	a_arr_char in_ibf;
 	a_uint32 in_ibfidx;
+	a_uint32 in_gap;
+
+	/*
+	 * Display width of each byte in the input buffer,
+	 * it has the same capacity and gap as 'in_ibf'.
+	 * Width is kept in the first byte of a character
+	 * (see 'W_*' in ainput.c), this way moving the
+	 * cursor never decodes the input.
+	 */
+	a_ubyte *in_wbf;
 
 	/* input lines */
 	a_arr_line in_lines;
-	a_uint32 in_col;
+	a_uint32 in_col; /* byte offset of the cursor in its line */
+	a_uint32 in_x; /* column of the cursor in its line (prompt excluded) */
 	a_uint32 in_row;
 
 	/* terminal row and col where the input starts */
 	a_uint32 in_startrow;
 	a_uint32 in_startcol;
+
+	/*
+	 * Terminal rows taken by each line and prefix sums
+	 * of them (Fenwick tree), rebuilt when lines are
+	 * added or removed, when terminal width changes or
+	 * when the prompt width changes.
+	 * Prefix sums of line lengths are kept the same way.
+	 */
+	a_arr_uint32 in_lrows;
+	a_arr_uint32 in_rowsum;
+	a_arr_uint32 in_lensum;
+	a_uint32 in_rowscols; /* terminal columns of the index */
+	a_uint32 in_rowsoff; /* prompt width of the index */
+	a_ubyte in_rowsdirty;
+
+	/* first input row inside the viewport (drawn rows) */
+	a_uint32 in_top;
+
+	/* tokens for syntax highlighting */
+	struct a_syntax in_syntax;
+
+	/* set when the input is accepted (no suggestion is drawn) */
+	a_ubyte in_done;
 };
 
 void a_input_clear(void);
 
+/* terminal capabilities */
+#define A_TCAP_PROBED 0x01 /* capabilities were probed */
+#define A_TCAP_DSR    0x02 /* terminal reports cursor position */
+
+/* size of the terminal key buffer */
+#define A_KBUFSIZE 4096
+
+/* bytes read from the terminal that are not yet decoded */
+struct a_keybuf {
+	a_uint32 kb_pos; /* first undecoded byte */
+	a_uint32 kb_len; /* bytes in 'kb_buf' */
+	char kb_buf[A_KBUFSIZE];
+};
+
+/* terminal io counters */
+struct a_iostat {
+	a_uint64 io_keys; /* decoded keys */
+	a_uint64 io_frames; /* flushed frames */
+	a_uint64 io_reads;
+	a_uint64 io_writes;
+	a_uint64 io_ioctls;
+	a_uint64 io_batchns; /* time spent on the last key batch */
+};
+
 struct a_term {
 	/* prompt buffer */
 	a_arr_char tm_prompt;
 
+	/* compiled prompt ('ASHE_PROMPT') */
+	struct a_usertmpl tm_ptmpl;
+
+	/* prompt cells (without escape sequences) */
+	a_arr_cell tm_pcells;
+
+	/* contents of the terminal screen */
+	struct a_screen tm_screen;
+
+	/* screen attribute of each highlight class */
+	a_ubyte tm_hlattr[HL_CNT];
+
 	/* terminal input */
 	struct a_input tm_input;
 
 	/* terminal draw buffer */
 	a_arr_char tm_dbf;
 
+	/* terminal key buffer */
+	struct a_keybuf tm_kbf;
+
+	/* terminal io counters */
+	struct a_iostat tm_stat;
+
 	/* terminal io */
 	struct termios tm_dfltermios;
 	struct termios tm_rawtermios;
@@ -99,10 +198,14 @@ struct a_term {
 	a_uint32 tm_rows;
 	a_uint32 tm_columns;
 
-	/* cursor position in terminal */
+	/* cursor position in terminal (1-based), tracked
+	 * from the output instead of querying the terminal */
 	a_uint32 tm_col;
 	a_uint32 tm_row;
 
+	/* terminal capabilities (A_TCAP_*) */
+	a_ubyte tm_caps;
+
 	/* set if reading input */
 	a_ubyte tm_reading;
 };
@@ -116,12 +219,34 @@ void a_term_free(void);
 /* Update terminal dimensions. */
 void a_term_sync_dimensions(void);
 
-/* Update terminal cursor position. */
-void a_term_sync_cursor(void);
+/*
+ * Query the terminal for the cursor position (DSR).
+ * Reply is waited on only if the terminal is known to
+ * answer or if it was not probed yet, bytes read along
+ * with the reply are kept as input.
+ * Returns 0 if the position is unknown.
+ */
+a_ubyte a_term_sync_cursor(void);
 
 /* Start reading from terminal. */
 void a_term_read(void);
 
+/* Return 1 if keys of the next input line were already read. */
+a_ubyte a_term_typedahead(void);
+
+/*
+ * Redraw prompt and input, only the difference
+ * between what is on the terminal screen and the
+ * current state of the input gets drawn.
+ */
+void a_term_refresh(void);
+
+/*
+ * Expand the prompt again (async placeholder values
+ * arrived), redraws it if it changed while reading.
+ */
+void ashe_update_prompt(void);
+
 /*
  * Invoked on SIGWINCH, fixes how input
  * and prompt look by redrawing them correctly.
@@ -132,13 +257,18 @@ void sigwinch_redraw(void); // TODO: test
  * Insert character 'c' under the cursor into the
  * input buffer and update cursor.
  *
- * If the input size limit is reached, character
- * won't get inserted and return value will be 0.
- *
- * If 'hidecur' is true, then cursor will be hidden
- * until screen is redrawn.
+ * Editing and cursor movement functions only update
+ * the input, changes are drawn by 'a_term_refresh()'.
+ */
+a_ubyte ashe_insert_char(a_ubyte c);
+
+/*
+ * Insert 'len' bytes of 'str' under the cursor into
+ * the input buffer and move the cursor after them.
+ * Input is split into lines in a single pass.
+ * Returns the number of inserted bytes.
  */
-a_ubyte ashe_insert_char(a_ubyte c, a_ubyte hidecur);
+a_uint32 ashe_insert_str(const char *str, a_uint32 len);
 
 /*
  * Remove character under the cursor from the
@@ -152,22 +282,26 @@ a_ubyte ashe_remove_char(void);
 
 /*
  * Remove 'len' bytes from the input buffer
- * starting from the cursor to the end of the
- * buffer.
- * If buffer is already empty return value is 0.
+ * starting at the cursor, cursor doesn't move.
+ * Returns the amount of bytes removed.
  *
  * If 'len' is negative, then all of the bytes
  * from the current position of the cursor up
  * to the end of the input buffer are removed.
- * In this case total amount of bytes removed
- * is returned.
  *
  * If 'len' is greater than the buffer size
  * calculated from the current cursor position
  * to the end of the input buffer, return value
  * is 0 and removal is not performed.
  */
-a_uint32 ashe_remove_bytes(a_ssize len); // TODO: test
+a_uint32 ashe_remove_bytes(a_ssize len);
+
+/*
+ * Remove the word before the cursor together
+ * with the whitespace between it and the cursor.
+ * If there is nothing to remove 0 is returned.
+ */
+a_ubyte ashe_remove_word(void);
 
 /*
  * Insert new line under the cursor and move the
@@ -256,6 +390,14 @@ a_ubyte ashe_move_to_start(void);
  */
 a_ubyte ashe_move_to_end(void);
 
+/*
+ * Moves cursor to the byte at 'idx' in the input
+ * buffer, 'idx' is clamped to the input length.
+ *
+ * If the cursor was already there this returns 0.
+ */
+a_ubyte ashe_move_to_index(a_uint32 idx);
+
 /*
  * Moves cursor to the start of the input buffer
  * and clears the whole buffer.
@@ -268,8 +410,13 @@ void ashe_clearinput(void);
 void ashe_deletefront(void);
 
 
+/*
+ * Moves terminal cursor to the start of the row
+ * below the prompt and input, input is not modified.
+ */
+void ashe_move_below_input_unsafe(void);
+
 a_ubyte ashe_draw_prompt_unsafe(void);
-void ashe_redraw_input_unsafe(void);
 void ashe_clear_screen_unsafe(void);
 
 #endif
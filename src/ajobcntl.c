@@ -20,6 +20,7 @@
 #include "ainput.h"
 #include "ajobcntl.h"
 #include "ashell.h"
+#include "auserstr.h"
 #include "autils.h"
 
 #include <signal.h>
@@ -357,6 +358,7 @@ ASHE_PUBLIC void a_jobcntl_add_job(struct a_jobcntl *jobcntl, struct a_job *job)
 {
 	job->id = Joblist_id(jobcntl);
 	a_arr_job_push(&jobcntl->jobs, *job);
+	ashe_plhinvalidate(A_PLH_JOBS);
 }
 
 /*
@@ -365,6 +367,7 @@ ASHE_PUBLIC void a_jobcntl_add_job(struct a_jobcntl *jobcntl, struct a_job *job)
  */
 ASHE_PRIVATE inline struct a_job a_jobcntl_remove(struct a_jobcntl *jobcntl, a_uint32 i)
 {
+	ashe_plhinvalidate(A_PLH_JOBS);
 	return a_arr_job_remove(&jobcntl->jobs, i);
 }
 
@@ -453,13 +456,10 @@ ASHE_PRIVATE void a_jobcntl_update(struct a_jobcntl *jobcntl)
 ASHE_PUBLIC void a_jobcntl_update_and_notify(struct a_jobcntl *jobcntl)
 {
 	struct a_term *term = &ashe.sh_term;
-	a_uint32 col, row, idx;
 	a_memmax jobcnt, i;
 	struct a_job *job, out;
 	a_ubyte completed;
 
-	col = row = idx = 0; /* avoid compiler warnings */
-
 	if ((jobcnt = a_jobcntl_jobs(jobcntl)) == 0)
 		return;
 
@@ -480,25 +480,14 @@ ASHE_PUBLIC void a_jobcntl_update_and_notify(struct a_jobcntl *jobcntl)
 			continue;
 		} else if (a_job_is_stopped(job) && !job->notified) {
 notify:
-			if (term->tm_reading) { /* in signal handler ? */
-				col = A_ICOL;
-				row = A_IROW;
-				idx = A_IBFIDX;
-				ashe_move_to_end();
-				ashe_print("\r\n", stderr);
-			}
+			if (term->tm_reading) /* in signal handler ? */
+				ashe_move_below_input_unsafe();
 
 			ashe_pinfo("[%n] '%s' %s", job->pgid, job->input,
 				   (completed ? "<completed>" : "<stopped>"));
-			ashe_draw_prompt_unsafe();
-
-			if (term->tm_reading) {
-				A_ICOL = col;
-				A_IROW = row;
-				A_IBFIDX = idx;
-				ashe_redraw_input_unsafe();
-				a_term_sync_cursor();
-			}
+
+			if (term->tm_reading)
+				ashe_draw_prompt_unsafe();
 
 			if (completed) {
 				a_job_free(job);
@@ -92,46 +92,65 @@ ASHE_PRIVATE a_int32 all_chars_are_digits(const char *str, a_memmax *n)
 	return 0;
 }
 
-/* Gets a string, expands environmental variables and unescapes it. */
-ASHE_PRIVATE struct a_token a_token_string(struct a_lexer *lexer)
+/*
+ * Advance over a string, stops at whitespace or at
+ * the start of another token unless inside double quotes.
+ * String continues in state 'cut' (A_LEX_DQ, A_LEX_ESC).
+ * Returns the state it stopped in, A_LEX_DQ is set if
+ * double quote is left unterminated.
+ */
+ASHE_PRIVATE a_ubyte skip_string(struct a_lexer *lexer, a_ubyte cut)
 {
-	struct a_token token = { 0 };
-	a_arr_char buffer;
-	a_memmax n, klen;
-	char *ptr;
-	a_int32 c, code;
+	a_int32 c;
 	a_ubyte dq, esc;
 
-	a_arr_char_init(&buffer);
-	token.type = TK_WORD;
-	token.start = lexer->current;
-	dq = esc = 0;
-
+	dq = ((cut & A_LEX_DQ) != 0);
+	esc = ((cut & A_LEX_ESC) != 0);
 	while ((c = peek(lexer, 0))) {
 		if (!dq && (isspace(c) || (!esc && has_precedence(c))))
 			break;
 		dq ^= (!esc && c == '"');
 		esc ^= (c == '\\' || esc);
-		a_arr_char_push(&buffer, c);
 		advance(lexer);
 	}
+	return (dq ? A_LEX_DQ : 0) | (esc ? A_LEX_ESC : 0);
+}
+
+/* Return 1 if string from 'start' up to 'end' is 'key=value'. */
+ASHE_PRIVATE a_ubyte is_kvpair(const char *start, const char *end)
+{
+	a_memmax klen;
+
+	klen = strspn(start, ENV_VAR_CHARS);
+	return (klen > 0 && start + klen < end && start[klen] == '=');
+}
+
+/* Gets a string, expands environmental variables and unescapes it. */
+ASHE_PRIVATE struct a_token a_token_string(struct a_lexer *lexer)
+{
+	struct a_token token = { 0 };
+	a_arr_char buffer;
+	a_memmax n;
+	a_int32 code;
+	a_ubyte dq;
+
+	a_arr_char_init(&buffer);
+	token.type = TK_WORD;
+	token.start = lexer->current;
+	dq = (skip_string(lexer, 0) & A_LEX_DQ);
 	token.end = lexer->current;
+	a_arr_char_push_str(&buffer, token.start, token.end - token.start);
 	a_arr_char_push(&buffer, '\0');
 
-	if (a_unlikely(c == '\0' && dq)) {
+	if (a_unlikely(dq)) {
 		a_arr_char_free(&buffer, NULL);
 		token.u.error = "expected '\"', instead got 'EOL'";
 		token.type = TK_ERROR;
+		return token;
 	}
 
-	ptr = a_arr_ptr(buffer);
-	if (*ptr != '=' && (ptr = strstr(ptr, "=")) != NULL) {
-		*ptr = '\0';
-		klen = strlen(a_arr_ptr(buffer));
-		if (strspn(a_arr_ptr(buffer), ENV_VAR_CHARS) == klen)
-			token.type = TK_KVPAIR;
-		*ptr = '=';
-	}
+	if (is_kvpair(token.start, token.end))
+		token.type = TK_KVPAIR;
 
 	ashe_escape(&buffer);
 
@@ -152,26 +171,17 @@ ASHE_PRIVATE struct a_token a_token_string(struct a_lexer *lexer)
 	return token;
 }
 
-/* Skip whitespace characters and comments */
-ASHE_PRIVATE void skipws(struct a_lexer *lexer)
+/* Skip whitespace characters. */
+ASHE_PRIVATE void skipspace(struct a_lexer *lexer)
 {
-	a_int32 c;
-
-	c = peek(lexer, 0);
 	for (;;) {
-		switch (c) {
-		case '#':
-			advance(lexer);
-			while ((c = peek(lexer, 0)) != '\n' && c != '\v')
-				advance(lexer);
-			break;
+		switch (peek(lexer, 0)) {
 		case '\n':
 		case '\r':
 		case ' ':
 		case '\t':
 		case '\v':
 			advance(lexer);
-			c = peek(lexer, 0);
 			break;
 		default:
 			return;
@@ -179,30 +189,53 @@ ASHE_PRIVATE void skipws(struct a_lexer *lexer)
 	}
 }
 
-ASHE_PRIVATE inline struct a_token a_token_new(enum a_toktype type, const char *start)
+/* Skip up to the end of line. */
+ASHE_PRIVATE void skipline(struct a_lexer *lexer)
+{
+	a_int32 c;
+
+	while ((c = peek(lexer, 0)) != '\n' && c != '\v' && c != '\0')
+		advance(lexer);
+}
+
+/* Skip comment up to the end of line, 'lexer' is at '#'. */
+ASHE_PRIVATE void skipcomment(struct a_lexer *lexer)
+{
+	advance(lexer);
+	skipline(lexer);
+}
+
+/* Skip whitespace characters and comments */
+ASHE_PRIVATE void skipws(struct a_lexer *lexer)
+{
+	for (;;) {
+		skipspace(lexer);
+		if (peek(lexer, 0) != '#')
+			return;
+		skipcomment(lexer);
+	}
+}
+
+ASHE_PRIVATE inline struct a_token a_token_new(struct a_lexer *lexer, enum a_toktype type,
+					      const char *start)
 {
 	struct a_token token;
 	token.type = type;
 	token.start = start;
-	token.end = ashe.sh_lexer.current;
+	token.end = lexer->current;
 	return token;
 }
 
-ASHE_PUBLIC struct a_token a_lexer_next(struct a_lexer *lexer)
+/*
+ * Advance over the operator at the start of the token.
+ * Returns TK_WORD without advancing if the token is
+ * a string instead.
+ */
+ASHE_PRIVATE enum a_toktype skip_operator(struct a_lexer *lexer)
 {
-	a_int32 c;
 	enum a_toktype type;
-	const char *start;
-
-	skipws(lexer);
-
-	start = lexer->current;
-	if ((c = peek(lexer, 0)) == '\0') {
-		advance(lexer);
-		return a_token_new(TK_EOL, start);
-	}
 
-	switch (c) {
+	switch (peek(lexer, 0)) {
 	case '<': {
 		switch (peek(lexer, 1)) {
 		case '&':
@@ -272,7 +305,7 @@ ASHE_PUBLIC struct a_token a_lexer_next(struct a_lexer *lexer)
 	}
 	case '-':
 		if (!isspace(peek(lexer, 1)))
-			return a_token_string(lexer);
+			return TK_WORD;
 		type = TK_MINUS;
 		break;
 	case ';':
@@ -285,9 +318,57 @@ ASHE_PUBLIC struct a_token a_lexer_next(struct a_lexer *lexer)
 		type = TK_RPAREN;
 		break;
 	default:
-		return a_token_string(lexer);
+		return TK_WORD;
 	}
 
 	advance(lexer);
-	return a_token_new(type, start);
+	return type;
+}
+
+ASHE_PUBLIC struct a_token a_lexer_next(struct a_lexer *lexer)
+{
+	enum a_toktype type;
+	const char *start;
+
+	skipws(lexer);
+
+	start = lexer->current;
+	if (peek(lexer, 0) == '\0') {
+		advance(lexer);
+		return a_token_new(lexer, TK_EOL, start);
+	}
+
+	if ((type = skip_operator(lexer)) == TK_WORD)
+		return a_token_string(lexer);
+	return a_token_new(lexer, type, start);
+}
+
+ASHE_PUBLIC struct a_token a_lexer_scan(struct a_lexer *lexer)
+{
+	struct a_token token = { 0 };
+
+	skipspace(lexer);
+
+	token.start = lexer->current;
+	if (peek(lexer, 0) == '\0') {
+		token.type = TK_EOL;
+	} else if (peek(lexer, 0) == '#') {
+		skipcomment(lexer);
+		token.type = TK_COMMENT;
+	} else if ((token.type = skip_operator(lexer)) == TK_WORD) {
+		if (skip_string(lexer, 0) & A_LEX_DQ)
+			token.type = TK_ERROR;
+		else if (is_kvpair(token.start, lexer->current))
+			token.type = TK_KVPAIR;
+	}
+	token.end = lexer->current;
+	return token;
+}
+
+ASHE_PUBLIC a_ubyte a_lexer_scan_rest(struct a_lexer *lexer, a_ubyte cut)
+{
+	if (!(cut & A_LEX_COMMENT))
+		return skip_string(lexer, cut);
+	skipline(lexer);
+	return A_LEX_COMMENT;
 }
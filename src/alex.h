@@ -43,4 +43,28 @@ struct a_lexer {
 void a_lexer_init(struct a_lexer *lexer, const char *start);
 struct a_token a_lexer_next(struct a_lexer *lexer);
 
+/*
+ * Scan the next token without building its value, only
+ * 'type', 'start' and 'end' are set and 'lexer' only
+ * needs 'current' to be set.
+ * Strings are TK_WORD, TK_KVPAIR or TK_ERROR (unterminated
+ * double quote), comments are TK_COMMENT and TK_EOL is
+ * returned without advancing.
+ */
+struct a_token a_lexer_scan(struct a_lexer *lexer);
+
+/* state of a string or comment cut before its end */
+#define A_LEX_DQ      0x01 /* inside double quotes */
+#define A_LEX_ESC     0x02 /* after a backslash */
+#define A_LEX_COMMENT 0x04 /* comment instead of a string */
+
+/*
+ * Continue scanning a string or a comment cut right
+ * before 'lexer->current' in state 'cut' (A_LEX_*),
+ * a string from its start is continued in state 0.
+ * Stops where the token ends or at '\0' and returns
+ * the state scanning stopped in.
+ */
+a_ubyte a_lexer_scan_rest(struct a_lexer *lexer, a_ubyte cut);
+
 #endif
@@ -111,7 +111,8 @@ ASHE_PUBLIC a_pid ashe_waitpid(a_pid pid, a_int32 *status, a_int32 opts)
 ASHE_PUBLIC void ashe_setpgid(a_pid pid, a_pid pgid)
 {
 	errno = 0;
-	if (a_unlikely(setpgid(pid, pgid) < 0))
+	/* EACCES, child already ran 'execve()' after setting its group itself */
+	if (a_unlikely(setpgid(pid, pgid) < 0 && errno != EACCES))
 		ashe_panic_libcall(setpgid);
 }
 
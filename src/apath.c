@@ -0,0 +1,499 @@
+/* ----------------------------------------------------------------------------------------------
+ * Copyright (C) 2023-2024 Jure Bagić
+ *
+ * This file is part of ashe.
+ * ashe is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * ashe is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ashe.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------------------------*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aalloc.h"
+#include "aconf.h"
+#include "apath.h"
+#include "autils.h"
+
+/* minimum size of the hash table */
+#define MINTABLE 64
+
+/* name at offset 'off' */
+#define name_at(pc, off) (a_arr_ptr((pc)->pc_names) + (off))
+
+/* name of the entry 'e' */
+#define entname(pc, e) name_at(pc, (e)->name - 1)
+
+/* cache file header, followed by PATH, directories and names */
+struct cachehdr {
+	char magic[8];
+	a_uint32 pathlen; /* including '\0' */
+	a_uint32 ndirs;
+	a_uint32 nameslen;
+};
+
+/* bumped when the cached names change meaning (older caches get rebuilt) */
+#define CACHEMAGIC "ashepc2"
+
+/* FNV-1a hash of 'len' bytes of 'name' */
+ASHE_PRIVATE a_uint32 hash_name(const char *name, a_uint32 len)
+{
+	a_uint32 hash;
+
+	hash = 2166136261u;
+	while (len--) {
+		hash ^= (a_ubyte)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Return slot holding 'name' or an empty slot where it belongs. */
+ASHE_PRIVATE struct a_pathent *find_slot(struct a_pathcache *pc, const char *name, a_uint32 len,
+					 a_uint32 hash)
+{
+	struct a_pathent *e;
+	a_uint32 mask, i;
+
+	mask = a_arr_len(pc->pc_table) - 1;
+	for (i = hash & mask;; i = (i + 1) & mask) {
+		e = a_arr_pathent_index(&pc->pc_table, i);
+		if (e->name == 0)
+			return e;
+		if (e->hash == hash && strncmp(entname(pc, e), name, len) == 0 &&
+		    entname(pc, e)[len] == '\0')
+			return e;
+	}
+}
+
+/* Resize hash table to 'size' slots (power of 2) and clear it. */
+ASHE_PRIVATE void table_reset(struct a_pathcache *pc, a_uint32 size)
+{
+	a_arr_len(pc->pc_table) = 0;
+	a_arr_pathent_ensure(&pc->pc_table, size);
+	memset(a_arr_ptr(pc->pc_table), 0, size * sizeof(struct a_pathent));
+	a_arr_len(pc->pc_table) = size;
+}
+
+/* Double the hash table keeping the entries. */
+ASHE_PRIVATE void table_grow(struct a_pathcache *pc)
+{
+	a_arr_pathent old;
+	struct a_pathent *e;
+	a_uint32 mask, i, j;
+
+	old = pc->pc_table;
+	a_arr_pathent_init(&pc->pc_table);
+	table_reset(pc, a_arr_len(old) * 2);
+	mask = a_arr_len(pc->pc_table) - 1;
+	for (i = 0; i < a_arr_len(old); i++) {
+		e = a_arr_pathent_index(&old, i);
+		if (e->name == 0)
+			continue;
+		for (j = e->hash & mask; a_arr_ptr(pc->pc_table)[j].name != 0; j = (j + 1) & mask)
+			;
+		a_arr_ptr(pc->pc_table)[j] = *e;
+	}
+	a_arr_pathent_free(&old, NULL);
+}
+
+/* Add name at offset 'off' unless an earlier directory has it. */
+ASHE_PRIVATE void add_name(struct a_pathcache *pc, a_uint32 off)
+{
+	struct a_pathent *e;
+	const char *name;
+	a_uint32 hash, len;
+
+	if ((pc->pc_count + 1) * 2 > a_arr_len(pc->pc_table))
+		table_grow(pc);
+	name = name_at(pc, off);
+	len = strlen(name);
+	hash = hash_name(name, len);
+	e = find_slot(pc, name, len, hash);
+	if (e->name != 0)
+		return;
+	e->hash = hash;
+	e->name = off + 1;
+	a_arr_pathname_push(&pc->pc_sorted, off);
+	pc->pc_count++;
+}
+
+/* names the sort comparison refers to */
+ASHE_PRIVATE const char *sortnames;
+
+ASHE_PRIVATE int cmp_names(const void *a, const void *b)
+{
+	return strcmp(sortnames + *(const a_uint32 *)a, sortnames + *(const a_uint32 *)b);
+}
+
+/* Rebuild hash table and sorted names from the directories. */
+ASHE_PRIVATE void build_index(struct a_pathcache *pc)
+{
+	struct a_pathdir *dir;
+	a_uint32 i, off;
+
+	table_reset(pc, MINTABLE);
+	a_arr_len(pc->pc_sorted) = 0;
+	pc->pc_count = 0;
+	for (i = 0; i < a_arr_len(pc->pc_dirs); i++) {
+		dir = a_arr_pathdir_index(&pc->pc_dirs, i);
+		for (off = dir->names; off < dir->end; off += strlen(name_at(pc, off)) + 1)
+			add_name(pc, off);
+	}
+	sortnames = a_arr_ptr(pc->pc_names);
+	if (pc->pc_count > 0)
+		qsort(a_arr_ptr(pc->pc_sorted), pc->pc_count, sizeof(a_uint32), cmp_names);
+}
+
+/*
+ * Copy the next directory in 'path' into 'dir', empty
+ * entry is the current directory.
+ * Returns the rest of 'path' or NULL after the last one.
+ */
+ASHE_PRIVATE const char *next_dir(const char *path, a_arr_char *dir)
+{
+	const char *end;
+
+	if ((end = strchr(path, ':')) == NULL)
+		end = path + strlen(path);
+	a_arrp_len(dir) = 0;
+	if (end == path)
+		a_arr_char_push(dir, '.');
+	else
+		a_arr_char_push_str(dir, path, end - path);
+	a_arr_char_push(dir, '\0');
+	return (*end == ':' ? end + 1 : NULL);
+}
+
+ASHE_PRIVATE void dir_mtime(const char *dir, struct a_pathdir *out)
+{
+	struct stat st;
+
+	out->sec = out->nsec = 0;
+	if (stat(dir, &st) == 0) {
+		out->sec = st.st_mtim.tv_sec;
+		out->nsec = st.st_mtim.tv_nsec;
+	}
+}
+
+/*
+ * Push names of the commands in directory 'dir' into 'names',
+ * only executable regular files (or symlinks to them) count.
+ */
+ASHE_PRIVATE void scan_dir(a_arr_char *names, const char *dir)
+{
+	struct dirent *ent;
+	struct stat st;
+	DIR *dp;
+
+	if ((dp = opendir(dir)) == NULL)
+		return;
+	while ((ent = readdir(dp)) != NULL) {
+		if (ent->d_name[0] == '.' || ent->d_type == DT_DIR)
+			continue;
+		if (fstatat(dirfd(dp), ent->d_name, &st, 0) == 0 && S_ISREG(st.st_mode) &&
+		    (st.st_mode & 0111))
+			a_arr_char_push_str(names, ent->d_name, strlen(ent->d_name) + 1);
+	}
+	closedir(dp);
+}
+
+/* Return directory with the path 'path' or NULL. */
+ASHE_PRIVATE struct a_pathdir *find_dir(struct a_pathcache *pc, const char *path)
+{
+	struct a_pathdir *dir;
+	a_uint32 i;
+
+	for (i = 0; i < a_arr_len(pc->pc_dirs); i++) {
+		dir = a_arr_pathdir_index(&pc->pc_dirs, i);
+		if (strcmp(name_at(pc, dir->start), path) == 0)
+			return dir;
+	}
+	return NULL;
+}
+
+/* Return 1 if any of the directories got modified. */
+ASHE_PRIVATE a_ubyte dirs_changed(struct a_pathcache *pc)
+{
+	struct a_pathdir mtime, *dir;
+	a_uint32 i;
+
+	for (i = 0; i < a_arr_len(pc->pc_dirs); i++) {
+		dir = a_arr_pathdir_index(&pc->pc_dirs, i);
+		dir_mtime(name_at(pc, dir->start), &mtime);
+		if (dir->sec != mtime.sec || dir->nsec != mtime.nsec)
+			return 1;
+	}
+	return 0;
+}
+
+ASHE_PRIVATE void cache_filepath(a_arr_char *buffer)
+{
+	a_arr_char_push_str(buffer, ASHE_PATHCACHEFILEPATH, SS(ASHE_PATHCACHEFILEPATH));
+	a_arr_char_push(buffer, '\0');
+	ashe_expandvars(buffer);
+}
+
+/* Write the cache file, failures are ignored. */
+ASHE_PRIVATE void save(struct a_pathcache *pc)
+{
+	struct cachehdr hdr;
+	a_arr_char filepath, tmppath;
+	FILE *fp;
+	a_ubyte ok;
+
+	if (SS(ASHE_PATHCACHEFILEPATH) == 0)
+		return;
+	a_arr_char_init(&filepath);
+	a_arr_char_init(&tmppath);
+	cache_filepath(&filepath);
+	a_arr_char_push_str(&tmppath, a_arr_ptr(filepath), a_arr_len(filepath) - 1);
+	a_arr_char_push_strf(&tmppath, ".%n", (a_ssize)getpid());
+	a_arr_char_push(&tmppath, '\0');
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CACHEMAGIC, sizeof(CACHEMAGIC));
+	hdr.pathlen = a_arr_len(pc->pc_path);
+	hdr.ndirs = a_arr_len(pc->pc_dirs);
+	hdr.nameslen = a_arr_len(pc->pc_names);
+	if ((fp = fopen(a_arr_ptr(tmppath), "w")) != NULL) {
+		ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+		      fwrite(a_arr_ptr(pc->pc_path), 1, hdr.pathlen, fp) == hdr.pathlen &&
+		      fwrite(a_arr_ptr(pc->pc_dirs), sizeof(struct a_pathdir), hdr.ndirs, fp) ==
+			      hdr.ndirs &&
+		      fwrite(a_arr_ptr(pc->pc_names), 1, hdr.nameslen, fp) == hdr.nameslen);
+		ok = (fclose(fp) == 0 && ok);
+		/* replaced at once, other shells never read a partial file */
+		if (!ok || rename(a_arr_ptr(tmppath), a_arr_ptr(filepath)) < 0)
+			unlink(a_arr_ptr(tmppath));
+	}
+	a_arr_char_free(&filepath, NULL);
+	a_arr_char_free(&tmppath, NULL);
+}
+
+/* Return 1 if directories read from the cache file are valid. */
+ASHE_PRIVATE a_ubyte valid_dirs(struct a_pathcache *pc)
+{
+	struct a_pathdir *dir;
+	const char *names;
+	a_uint32 i, len;
+
+	names = a_arr_ptr(pc->pc_names);
+	len = a_arr_len(pc->pc_names);
+	if (a_arr_len(pc->pc_path) == 0 || a_arr_ptr(pc->pc_path)[a_arr_len(pc->pc_path) - 1] != '\0')
+		return 0;
+	for (i = 0; i < a_arr_len(pc->pc_dirs); i++) {
+		dir = a_arr_pathdir_index(&pc->pc_dirs, i);
+		if (!(dir->start < dir->names && dir->names <= dir->end && dir->end <= len) ||
+		    names[dir->names - 1] != '\0' || (dir->end > dir->names && names[dir->end - 1] != '\0'))
+			return 0;
+	}
+	return 1;
+}
+
+/* Read the cache file, returns 0 if it is missing or invalid. */
+ASHE_PRIVATE a_ubyte load(struct a_pathcache *pc)
+{
+	struct cachehdr hdr;
+	struct stat st;
+	a_arr_char filepath;
+	FILE *fp;
+	a_ubyte ok;
+
+	if (SS(ASHE_PATHCACHEFILEPATH) == 0)
+		return 0;
+	a_arr_char_init(&filepath);
+	cache_filepath(&filepath);
+	fp = fopen(a_arr_ptr(filepath), "r");
+	a_arr_char_free(&filepath, NULL);
+	if (fp == NULL)
+		return 0;
+	ok = (fstat(fileno(fp), &st) == 0 && fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+	      memcmp(hdr.magic, CACHEMAGIC, sizeof(CACHEMAGIC)) == 0 &&
+	      (a_uint64)st.st_size == sizeof(hdr) + (a_uint64)hdr.pathlen +
+					      (a_uint64)hdr.ndirs * sizeof(struct a_pathdir) +
+					      hdr.nameslen);
+	if (ok) {
+		a_arr_len(pc->pc_path) = a_arr_len(pc->pc_dirs) = a_arr_len(pc->pc_names) = 0;
+		a_arr_char_ensure(&pc->pc_path, hdr.pathlen);
+		a_arr_pathdir_ensure(&pc->pc_dirs, hdr.ndirs);
+		a_arr_char_ensure(&pc->pc_names, hdr.nameslen);
+		ok = (fread(a_arr_ptr(pc->pc_path), 1, hdr.pathlen, fp) == hdr.pathlen &&
+		      fread(a_arr_ptr(pc->pc_dirs), sizeof(struct a_pathdir), hdr.ndirs, fp) ==
+			      hdr.ndirs &&
+		      fread(a_arr_ptr(pc->pc_names), 1, hdr.nameslen, fp) == hdr.nameslen);
+		a_arr_len(pc->pc_path) = hdr.pathlen;
+		a_arr_len(pc->pc_dirs) = hdr.ndirs;
+		a_arr_len(pc->pc_names) = hdr.nameslen;
+		ok = (ok && valid_dirs(pc));
+	}
+	fclose(fp);
+	if (!ok) {
+		a_arr_len(pc->pc_path) = a_arr_len(pc->pc_dirs) = a_arr_len(pc->pc_names) = 0;
+		return 0;
+	}
+	build_index(pc);
+	return 1;
+}
+
+/*
+ * Rebuild the cache for 'path', names of directories
+ * that did not change are taken over from the old cache.
+ */
+ASHE_PRIVATE void refresh(struct a_pathcache *pc, const char *path)
+{
+	struct a_pathdir new, *old;
+	a_arr_char names, dir;
+	a_arr_pathdir dirs;
+	const char *p;
+	a_ubyte scanned;
+
+	a_arr_char_init(&names);
+	a_arr_char_init(&dir);
+	a_arr_pathdir_init(&dirs);
+	scanned = 0;
+	for (p = path; p != NULL;) {
+		p = next_dir(p, &dir);
+		dir_mtime(a_arr_ptr(dir), &new);
+		new.start = a_arr_len(names);
+		a_arr_char_push_str(&names, a_arr_ptr(dir), a_arr_len(dir));
+		new.names = a_arr_len(names);
+		old = find_dir(pc, a_arr_ptr(dir));
+		if (old && old->sec == new.sec && old->nsec == new.nsec) {
+			a_arr_char_push_str(&names, name_at(pc, old->names), old->end - old->names);
+		} else {
+			scan_dir(&names, a_arr_ptr(dir));
+			scanned = 1;
+		}
+		new.end = a_arr_len(names);
+		a_arr_pathdir_push(&dirs, new);
+	}
+	a_arr_char_free(&dir, NULL);
+	a_arr_char_free(&pc->pc_names, NULL);
+	a_arr_pathdir_free(&pc->pc_dirs, NULL);
+	pc->pc_names = names;
+	pc->pc_dirs = dirs;
+	a_arr_len(pc->pc_path) = 0;
+	a_arr_char_push_str(&pc->pc_path, path, strlen(path) + 1);
+	build_index(pc);
+	if (scanned)
+		save(pc);
+}
+
+/* Make sure the cache is up to date with PATH. */
+ASHE_PRIVATE void update(struct a_pathcache *pc)
+{
+	const char *path;
+	a_ubyte missing;
+
+	if ((path = getenv("PATH")) == NULL)
+		path = "";
+	missing = 0;
+	if (!pc->pc_built) {
+		missing = !load(pc);
+		pc->pc_built = 1;
+		pc->pc_stale = 1;
+	}
+	if (missing || strcmp(path, a_arr_ptr(pc->pc_path)) != 0 ||
+	    (pc->pc_stale && dirs_changed(pc)))
+		refresh(pc, path);
+	pc->pc_stale = 0;
+}
+
+ASHE_PUBLIC void a_pathcache_init(struct a_pathcache *pc)
+{
+	a_arr_pathent_init(&pc->pc_table);
+	a_arr_pathname_init(&pc->pc_sorted);
+	a_arr_char_init(&pc->pc_names);
+	a_arr_char_init(&pc->pc_path);
+	a_arr_pathdir_init(&pc->pc_dirs);
+	pc->pc_count = 0;
+	pc->pc_stale = 0;
+	pc->pc_built = 0;
+}
+
+ASHE_PUBLIC void a_pathcache_free(struct a_pathcache *pc)
+{
+	a_arr_pathent_free(&pc->pc_table, NULL);
+	a_arr_pathname_free(&pc->pc_sorted, NULL);
+	a_arr_char_free(&pc->pc_names, NULL);
+	a_arr_char_free(&pc->pc_path, NULL);
+	a_arr_pathdir_free(&pc->pc_dirs, NULL);
+}
+
+ASHE_PUBLIC void a_pathcache_invalidate(struct a_pathcache *pc)
+{
+	pc->pc_stale = 1;
+}
+
+ASHE_PUBLIC a_ubyte a_pathcache_has(struct a_pathcache *pc, const char *name, a_uint32 len)
+{
+	update(pc);
+	return (find_slot(pc, name, len, hash_name(name, len))->name != 0);
+}
+
+ASHE_PUBLIC a_ubyte a_pathcache_exec(struct a_pathcache *pc, const char *name)
+{
+	struct a_pathdir *dir;
+	a_arr_char file;
+	a_uint32 i;
+	a_ubyte found;
+
+	if (a_pathcache_has(pc, name, strlen(name)))
+		return 1;
+	a_arr_char_init(&file);
+	found = 0;
+	for (i = 0; i < a_arr_len(pc->pc_dirs) && !found; i++) {
+		dir = a_arr_pathdir_index(&pc->pc_dirs, i);
+		a_arr_len(file) = 0;
+		a_arr_char_push_str(&file, name_at(pc, dir->start), dir->names - dir->start - 1);
+		a_arr_char_push(&file, '/');
+		a_arr_char_push_str(&file, name, strlen(name) + 1);
+		found = (access(a_arr_ptr(file), X_OK) == 0);
+	}
+	a_arr_char_free(&file, NULL);
+	return found;
+}
+
+ASHE_PUBLIC a_uint32 a_pathcache_complete(struct a_pathcache *pc, const char *prefix, a_uint32 len,
+					  a_uint32 *first)
+{
+	a_uint32 lo, hi, mid, end;
+
+	update(pc);
+	lo = 0;
+	hi = pc->pc_count;
+	while (lo < hi) { /* first name not less than 'prefix' */
+		mid = lo + (hi - lo) / 2;
+		if (strncmp(a_pathcache_name(pc, mid), prefix, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*first = lo;
+	end = pc->pc_count;
+	while (lo < end) { /* first name not starting with 'prefix' */
+		mid = lo + (end - lo) / 2;
+		if (strncmp(a_pathcache_name(pc, mid), prefix, len) == 0)
+			lo = mid + 1;
+		else
+			end = mid;
+	}
+	return lo - *first;
+}
+
+ASHE_PUBLIC const char *a_pathcache_name(struct a_pathcache *pc, a_uint32 i)
+{
+	return name_at(pc, a_arr_ptr(pc->pc_sorted)[i]);
+}
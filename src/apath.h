@@ -0,0 +1,97 @@
+/* ----------------------------------------------------------------------------------------------
+ * Copyright (C) 2023-2024 Jure Bagić
+ *
+ * This file is part of ashe.
+ * ashe is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * ashe is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ashe.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------------------------*/
+
+#ifndef APATH_H
+#define APATH_H
+
+#include "acommon.h"
+#include "aarray.h"
+#include "atoken.h"
+
+/* command name in the hash table */
+struct a_pathent {
+	a_uint32 hash;
+	a_uint32 name; /* offset into 'pc_names' + 1 (0 if slot is empty) */
+};
+
+ARRAY_NEW(a_arr_pathent, struct a_pathent)
+
+/* offset of a name in 'pc_names' */
+ARRAY_NEW(a_arr_pathname, a_uint32)
+
+/*
+ * Directory in PATH, its path and the names it holds
+ * are kept in 'pc_names' as '\0' terminated strings.
+ */
+struct a_pathdir {
+	a_int64 sec; /* modification time */
+	a_int64 nsec;
+	a_uint32 start; /* directory path */
+	a_uint32 names; /* first name */
+	a_uint32 end; /* end of the last name */
+};
+
+ARRAY_NEW(a_arr_pathdir, struct a_pathdir)
+
+/*
+ * In-memory index of command names found in PATH
+ * directories, this way checking if a command exists
+ * or completing its name does not touch the filesystem.
+ * Only directories that were modified (or that are new
+ * in PATH) are read again, directories are checked only
+ * once after 'a_pathcache_invalidate()'.
+ * Index is saved into 'ASHE_PATHCACHEFILEPATH' whenever
+ * a directory gets read, new shells start from it.
+ */
+struct a_pathcache {
+	a_arr_pathent pc_table; /* open addressing hash table */
+	a_arr_pathname pc_sorted; /* names in 'pc_table' sorted */
+	a_arr_char pc_names;
+	a_arr_char pc_path; /* PATH the cache was built from */
+	a_arr_pathdir pc_dirs;
+	a_uint32 pc_count; /* names in 'pc_table' */
+	a_ubyte pc_stale; /* set if directories should be checked */
+	a_ubyte pc_built; /* set if cache was built */
+};
+
+void a_pathcache_init(struct a_pathcache *pc);
+void a_pathcache_free(struct a_pathcache *pc);
+
+/* Check PATH directories for changes on the next lookup. */
+void a_pathcache_invalidate(struct a_pathcache *pc);
+
+/* Return 1 if command 'name' of 'len' bytes is in PATH. */
+a_ubyte a_pathcache_has(struct a_pathcache *pc, const char *name, a_uint32 len);
+
+/*
+ * Return 1 if 'name' is an executable in a PATH directory,
+ * directories are searched only if the cache misses it
+ * (e.g. directory that can't be listed).
+ */
+a_ubyte a_pathcache_exec(struct a_pathcache *pc, const char *name);
+
+/*
+ * Find command names starting with 'len' bytes of 'prefix',
+ * sets 'first' to the sorted index of the first one.
+ * Returns the number of names found.
+ */
+a_uint32 a_pathcache_complete(struct a_pathcache *pc, const char *prefix, a_uint32 len,
+			      a_uint32 *first);
+
+/* Return command name at sorted index 'i'. */
+const char *a_pathcache_name(struct a_pathcache *pc, a_uint32 i);
+
+#endif
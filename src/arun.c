@@ -17,6 +17,7 @@
 #include "aalloc.h"
 #include "abuiltin.h"
 #include "acommon.h"
+#include "acomplete.h"
 #include "ajobcntl.h"
 #include "autils.h"
 #include "aparser.h"
@@ -24,9 +25,11 @@
 #include "ashell.h"
 #include "aasync.h"
 #include "alibc.h"
+#include "auserstr.h"
 
 #include <fcntl.h>
 #include <memory.h>
+#include <string.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -35,6 +38,8 @@
 #define PIPE_R 0 /* Read end of a pipe */
 #define PIPE_W 1 /* Write end of a pipe */
 
+#define EXIT_NOTFOUND 127 /* Exit status of a command that was not found */
+
 #define N_OR(n, dflt) ((n) == -1 ? (dflt) : (n))
 
 #define reset_dirtyfd() memset(ashe.sh_dirtyfd, 0, sizeof(ashe.sh_dirtyfd))
@@ -42,14 +47,15 @@
 /* Instructs forked process which pipe stream to dup() and close. */
 struct a_pipectx {
 	a_int32 pipefd[2];
-	a_int32 closefd;
+	a_int32 closefd[2]; /* unused ends of the pipes */
 };
 
 ASHE_PRIVATE inline void a_pipectx_init(struct a_pipectx *restrict ctx)
 {
 	ctx->pipefd[0] = STDIN_FILENO;
 	ctx->pipefd[1] = STDOUT_FILENO;
-	ctx->closefd = -1;
+	ctx->closefd[0] = -1;
+	ctx->closefd[1] = -1;
 }
 
 ASHE_PRIVATE void conf_pipe(a_int32 *restrict pipes, a_memmax len, a_memmax i,
@@ -61,17 +67,18 @@ ASHE_PRIVATE void conf_pipe(a_int32 *restrict pipes, a_memmax len, a_memmax i,
 		poffset = pipes;
 		ashe_pipe(poffset);
 		ctx->pipefd[PIPE_W] = poffset[PIPE_W];
-		ctx->closefd = poffset[PIPE_R];
+		ctx->closefd[PIPE_R] = poffset[PIPE_R];
 	} else if (i != len - 1) {
 		poffset = &pipes[i * 2];
 		ashe_pipe(poffset);
 		ctx->pipefd[PIPE_R] = poffset[-2];
 		ctx->pipefd[PIPE_W] = poffset[PIPE_W];
-		ctx->closefd = poffset[PIPE_R];
+		ctx->closefd[PIPE_R] = poffset[PIPE_R];
+		ctx->closefd[PIPE_W] = poffset[-1];
 	} else {
 		poffset = &pipes[--i * 2];
 		ctx->pipefd[PIPE_R] = poffset[PIPE_R];
-		ctx->closefd = poffset[PIPE_W];
+		ctx->closefd[PIPE_W] = poffset[PIPE_W];
 	}
 }
 
@@ -297,8 +304,12 @@ ASHE_PRIVATE inline void extrafds_close(a_int32 fd1, a_int32 fd2, a_int32 fd3)
 }
 
 /* This runs a built-in command or puts
- * environment variables into 'environ' or both. */
-ASHE_PRIVATE a_int32 run_scmd_nofork(struct a_simple_cmd *restrict scmd, enum a_builtin_type type)
+ * environment variables into 'environ' or both.
+ * If 'unknown' is not NULL the command is not in PATH,
+ * only the redirections are done and 'unknown' error
+ * is printed. */
+ASHE_PRIVATE a_int32 run_scmd_nofork(struct a_simple_cmd *restrict scmd, enum a_builtin_type type,
+				     const char *unknown)
 {
 	a_int32 status;
 	a_int32 in, out, err;
@@ -314,6 +325,10 @@ ASHE_PRIVATE a_int32 run_scmd_nofork(struct a_simple_cmd *restrict scmd, enum a_
 	if (resolve_redirections(&scmd->sc_rds, type == TBI_EXEC) < 0) {
 		reset_dirtyfd();
 		status = -1;
+	} else if (unknown) {
+		ashe_eprintf("%s", unknown);
+		rm_envs(&scmd->sc_env);
+		status = -EXIT_NOTFOUND;
 	} else if (ARGC(scmd) > 0) {
 		status = ashe_runbin(scmd, type);
 		rm_envs(&scmd->sc_env);
@@ -341,12 +356,68 @@ ASHE_PRIVATE void reset_signal_handling(void)
 	ashe_mask_signals(SIG_UNBLOCK);
 }
 
+/*
+ * Connect the pipe ends and close all of the originals,
+ * a stage holding the write end of its own input would
+ * never read the end of it.
+ */
 ASHE_PRIVATE inline void connect_pipe(struct a_pipectx *restrict ctx)
 {
 	ashe_dup2(ctx->pipefd[PIPE_R], STDIN_FILENO);
 	ashe_dup2(ctx->pipefd[PIPE_W], STDOUT_FILENO);
-	if (ctx->closefd != -1)
-		ashe_close(ctx->closefd);
+	if (ctx->pipefd[PIPE_R] != STDIN_FILENO)
+		ashe_close(ctx->pipefd[PIPE_R]);
+	if (ctx->pipefd[PIPE_W] != STDOUT_FILENO)
+		ashe_close(ctx->pipefd[PIPE_W]);
+	if (ctx->closefd[PIPE_R] != -1)
+		ashe_close(ctx->closefd[PIPE_R]);
+	if (ctx->closefd[PIPE_W] != -1)
+		ashe_close(ctx->closefd[PIPE_W]);
+}
+
+/*
+ * Return 1 and push the error naming the nearest commands
+ * into 'msg' if 'scmd' runs a command that is not in PATH.
+ * This is checked before forking, this way no lone command
+ * is forked and no pipeline stage tries 'execvp()' just to
+ * fail, the error is printed after the redirections.
+ * Commands with a path or run with their own PATH
+ * are left for 'execvp()' to resolve.
+ */
+ASHE_PRIVATE a_ubyte unknown_cmd(struct a_simple_cmd *restrict scmd, a_arr_char *restrict msg)
+{
+	a_arr_ccharp near;
+	const char *name;
+	a_uint32 i;
+
+	if (ARGC(scmd) == 0)
+		return 0;
+	name = ARGV(scmd, 0);
+	if (*name == '\0' || strchr(name, '/') || ashe_isbin(name) >= 0)
+		return 0;
+	for (i = 0; i < a_arr_len(scmd->sc_env); i++)
+		if (strncmp(a_arr_ptr(scmd->sc_env)[i], "PATH=", SS("PATH=")) == 0)
+			return 0;
+	if (a_pathcache_exec(&ashe.sh_path, name))
+		return 0;
+	a_arr_ccharp_init(&near);
+	ashe_nearest_commands(&near, name);
+	a_arr_char_push_strlit(msg, "unknown command '");
+	a_arr_char_push_str(msg, name, strlen(name));
+	a_arr_char_push(msg, '\'');
+	for (i = 0; i < a_arr_len(near); i++) {
+		if (i == 0)
+			a_arr_char_push_strlit(msg, ", did you mean '");
+		else
+			a_arr_char_push_strlit(msg, ", '");
+		a_arr_char_push_str(msg, a_arr_ptr(near)[i], strlen(a_arr_ptr(near)[i]));
+		a_arr_char_push(msg, '\'');
+	}
+	if (a_arr_len(near) > 0)
+		a_arr_char_push(msg, '?');
+	a_arr_char_push(msg, '\0');
+	a_arr_ccharp_free(&near, NULL);
+	return 1;
 }
 
 ASHE_PRIVATE inline a_int32 scmd_exec(struct a_simple_cmd *restrict scmd)
@@ -358,21 +429,27 @@ ASHE_PRIVATE inline a_int32 scmd_exec(struct a_simple_cmd *restrict scmd)
 	argv[ARGC(scmd)] = NULL;
 
 	if (execvp(argv[0], argv) < 0) {
-		if (errno == ENOENT)
+		if (errno == ENOENT) {
 			ashe_eprintf("unknown command '%s'", argv[0]);
-		else
-			ashe_perrno("execvp");
+			ashe_free(argv);
+			return EXIT_NOTFOUND;
+		}
+		ashe_perrno("execvp");
 		ashe_free(argv);
-		return -1;
+		return EXIT_FAILURE;
 	}
 
 	return 0;
 }
 
-/* 'pipes' are passed just to cleanup them up in fork if possible */
+/*
+ * 'pipes' are passed just to cleanup them up in fork if possible,
+ * if 'unknown' is not NULL the fork prints it after redirections
+ * and exits, the rest of the pipeline runs.
+ */
 ASHE_PRIVATE a_int32 run_scmd_fork(struct a_simple_cmd *restrict scmd,
 				   struct a_pipectx *restrict ctx, struct a_job *restrict job,
-				   a_int32 *restrict pipes)
+				   a_int32 *restrict pipes, const char *unknown)
 {
 	a_arr_ccharp *aargv = &scmd->sc_argv;
 	a_arr_ccharp *aenv = &scmd->sc_env;
@@ -427,7 +504,13 @@ ASHE_PRIVATE a_int32 run_scmd_fork(struct a_simple_cmd *restrict scmd,
 		ashe_exit(ashe_runbin(scmd, type));
 	}
 
-	if (scmd_exec(scmd) < 0) {
+	if (unknown) {
+		ashe_eprintf("%s", unknown);
+		status = EXIT_NOTFOUND;
+		goto cleanup;
+	}
+
+	if ((status = scmd_exec(scmd)) != 0) {
 cleanup:
 		if (pipes)
 			ashe_free(pipes);
@@ -451,22 +534,29 @@ ASHE_PRIVATE a_int32 a_run_simple_cmd(struct a_simple_cmd *restrict scmd,
 {
 	struct a_process proc;
 	struct a_pipectx ctx;
-	a_int32 type;
+	a_arr_char msg;
+	const char *unknown;
+	a_int32 type, status;
 	a_pid pid;
 
 	type = -1;
 	a_pipectx_init(&ctx);
+	a_arr_char_init(&msg);
+	unknown = (unknown_cmd(scmd, &msg) ? a_arr_ptr(msg) : NULL);
 
 	if (cmdcnt > 1) {
 		ashe_assert(pipes != NULL);
 		conf_pipe(pipes, cmdcnt, i, &ctx);
 	} else if (job->foreground &&
-		   (ARGC(scmd) == 0 || (type = ashe_isbin(ARGV(scmd, 0))) >= 0)) {
+		   (ARGC(scmd) == 0 || unknown || (type = ashe_isbin(ARGV(scmd, 0))) >= 0)) {
 		a_job_free(job);
-		return run_scmd_nofork(scmd, type);
+		status = run_scmd_nofork(scmd, type, unknown);
+		a_arr_char_free(&msg, NULL);
+		return status;
 	}
 
-	pid = run_scmd_fork(scmd, &ctx, job, pipes);
+	pid = run_scmd_fork(scmd, &ctx, job, pipes, unknown);
+	a_arr_char_free(&msg, NULL);
 	a_process_init(&proc, pid);
 	a_job_add_process(job, proc);
 
@@ -504,6 +594,7 @@ ASHE_PRIVATE a_int32 a_run_pipeline(struct a_pipeline *restrict pipeline)
 
 	pipes = NULL;
 	cmds = &pipeline->pl_cmds;
+
 	a_job_init(&job, ashe_dupstr(pipeline->pl_input), pipeline->pl_bg);
 
 	ashe_assert(job.foreground == !pipeline->pl_bg);
@@ -530,6 +621,7 @@ ASHE_PRIVATE a_int32 a_run_pipeline(struct a_pipeline *restrict pipeline)
 
 	if (job.foreground) {
 		stopped = 0;
+		ashe_plhprefetch(); /* next prompt gets ready while waiting */
 		status = a_job_move_to_foreground(&job, 0, &stopped);
 		if (!stopped) /* job done ? */
 			a_job_free(&job);
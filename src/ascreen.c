@@ -0,0 +1,447 @@
+/* ----------------------------------------------------------------------------------------------
+ * Copyright (C) 2023-2024 Jure Bagić
+ *
+ * This file is part of ashe.
+ * ashe is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * ashe is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ashe.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "acommon.h"
+#include "ascreen.h"
+#include "autf8.h"
+#include "autils.h"
+
+
+/* synchronized output (terminals that do not support it ignore it) */
+#define a_csi_sync_begin A_ESC(?2026h)
+#define a_csi_sync_end	 A_ESC(?2026l)
+
+
+/* misc control sequences */
+#define a_csi_cursor_hide	A_ESC(?25l)
+#define a_csi_cursor_show	A_ESC(?25h)
+#define a_csi_clear_down	A_ESC(0J)
+#define a_csi_clear_line_right	A_ESC(0K)
+#define a_csi_sgr_reset		A_ESC(0m)
+
+
+/* terminal cursor column is not known */
+#define COL_UNKNOWN UINT32_MAX
+
+
+/* cells are equal */
+#define cell_eq(a, b) (memcmp((a).c, (b).c, A_CELLBYTES) == 0 && (a).attr == (b).attr)
+
+
+/* cell is covered by the wide character on its left */
+#define cell_covered(cell) ((cell).c[0] == '\0')
+
+
+/* frame row/cell access */
+#define frame_rows(fr)	     a_arr_len((fr)->fr_rowlen)
+#define frame_rowlen(fr, r)  (*a_arr_uint32_index(&(fr)->fr_rowlen, r))
+#define frame_row(fr, r)     a_arr_cell_index(&(fr)->fr_cells, (r) * (fr)->fr_cols)
+
+
+ASHE_PRIVATE void a_frame_init(struct a_frame *fr)
+{
+	a_arr_cell_init(&fr->fr_cells);
+	a_arr_uint32_init(&fr->fr_rowlen);
+	fr->fr_cols = 0;
+	fr->fr_row = 0;
+	fr->fr_col = 0;
+}
+
+ASHE_PRIVATE void a_frame_free(struct a_frame *fr)
+{
+	a_arr_cell_free(&fr->fr_cells, NULL);
+	a_arr_uint32_free(&fr->fr_rowlen, NULL);
+}
+
+ASHE_PUBLIC void a_screen_init(struct a_screen *sc)
+{
+	a_frame_init(&sc->sc_old);
+	a_frame_init(&sc->sc_new);
+	a_arr_attr_init(&sc->sc_attrs);
+	a_arr_char_init(&sc->sc_attrbuf);
+	/* default rendition */
+	a_arr_attr_push(&sc->sc_attrs, (struct a_attr){ .start = 0, .len = 0 });
+	a_screen_invalidate(sc);
+}
+
+ASHE_PUBLIC void a_screen_free(struct a_screen *sc)
+{
+	a_frame_free(&sc->sc_old);
+	a_frame_free(&sc->sc_new);
+	a_arr_attr_free(&sc->sc_attrs, NULL);
+	a_arr_char_free(&sc->sc_attrbuf, NULL);
+}
+
+ASHE_PUBLIC void a_screen_invalidate(struct a_screen *sc)
+{
+	sc->sc_row = 0;
+	sc->sc_col = 0;
+	sc->sc_attr = 0;
+	sc->sc_valid = 0;
+}
+
+/*
+ * Return index of the rendition 'seq', rendition
+ * is added if it wasn't seen before.
+ * In case there are no more free indices, default
+ * rendition is returned.
+ */
+ASHE_PRIVATE a_ubyte intern_attr(struct a_screen *sc, const char *seq, a_uint32 len)
+{
+	struct a_attr *attr;
+	a_uint32 i;
+
+	if (len == 0)
+		return 0;
+	for (i = 1; i < a_arr_len(sc->sc_attrs); i++) {
+		attr = a_arr_attr_index(&sc->sc_attrs, i);
+		if (attr->len == len &&
+		    memcmp(a_arr_char_index(&sc->sc_attrbuf, attr->start), seq, len) == 0)
+			return i;
+	}
+	if (a_unlikely(i > UINT8_MAX))
+		return 0;
+	a_arr_attr_push(&sc->sc_attrs,
+			(struct a_attr){ .start = a_arr_len(sc->sc_attrbuf), .len = len });
+	a_arr_char_push_str(&sc->sc_attrbuf, seq, len);
+	return i;
+}
+
+/* Return length of the character in 'cell'. */
+ASHE_PRIVATE a_uint32 cell_len(const struct a_cell *cell)
+{
+	const char *end;
+
+	end = memchr(cell->c, '\0', A_CELLBYTES);
+	return (end ? (a_uint32)(end - cell->c) : A_CELLBYTES);
+}
+
+/* Join 'n' bytes of zero width character 's' with 'cell'. */
+ASHE_PRIVATE void cell_join(struct a_cell *cell, const char *s, a_uint32 n)
+{
+	a_uint32 len;
+
+	len = cell_len(cell);
+	if (len + n <= A_CELLBYTES) /* otherwise it is not drawn */
+		memcpy(cell->c + len, s, n);
+}
+
+/* Push cells of the character at 'str', returns its length. */
+ASHE_PRIVATE a_uint32 push_char(a_arr_cell *out, const char *str, a_uint32 start, a_ubyte attr)
+{
+	struct a_cell cell = { .attr = attr };
+	a_uint32 n, cp, i;
+	a_int32 w;
+
+	if (*str == '\t') {
+		cell.c[0] = ' ';
+		for (i = A_TABSTOP - (a_arrp_len(out) - start) % A_TABSTOP; i > 0; i--)
+			a_arr_cell_push(out, cell);
+		return 1;
+	}
+	if ((n = a_utf8_decode(str, 4, &cp)) == 0 || (w = a_utf8_width(cp)) < 0) {
+		cell.c[0] = '?';
+		a_arr_cell_push(out, cell);
+		return (n > 0 ? n : 1);
+	}
+	if (w == 0) {
+		if (a_arrp_len(out) > start)
+			cell_join(a_arr_cell_last(out), str, n);
+		return n;
+	}
+	memcpy(cell.c, str, n);
+	a_arr_cell_push(out, cell);
+	if (w == 2)
+		a_arr_cell_push(out, (struct a_cell){ .attr = attr });
+	return n;
+}
+
+ASHE_PUBLIC void a_screen_cells(struct a_screen *sc, a_arr_cell *out, const char *str)
+{
+	a_arr_char seq; /* renditions since the last reset */
+	const char *end;
+	a_uint32 start;
+	a_ubyte attr;
+
+	a_arr_char_init(&seq);
+	start = a_arrp_len(out);
+	attr = 0;
+	while (*str) {
+		if (*str != '\033' || (end = strchr(str, 'm')) == NULL) {
+			str += push_char(out, str, start, attr);
+			continue;
+		}
+		end++;
+		if (strncmp(str, A_ESC(m), end - str) == 0 ||
+		    strncmp(str, a_csi_sgr_reset, end - str) == 0)
+			a_arr_len(seq) = 0;
+		else
+			a_arr_char_push_str(&seq, str, end - str);
+		attr = intern_attr(sc, a_arr_ptr(seq), a_arr_len(seq));
+		str = end;
+	}
+	a_arr_char_free(&seq, NULL);
+}
+
+ASHE_PUBLIC a_ubyte a_screen_attr(struct a_screen *sc, const char *seq)
+{
+	return intern_attr(sc, seq, strlen(seq));
+}
+
+ASHE_PRIVATE void frame_newrow(struct a_frame *fr)
+{
+	a_arr_uint32_push(&fr->fr_rowlen, 0);
+	a_arr_cell_ensure(&fr->fr_cells, fr->fr_cols);
+	a_arr_len(fr->fr_cells) += fr->fr_cols;
+}
+
+ASHE_PUBLIC void a_frame_begin(struct a_screen *sc, a_uint32 cols)
+{
+	struct a_frame *fr = &sc->sc_new;
+
+	ashe_assert(cols > 0);
+	a_arr_len(fr->fr_cells) = 0;
+	a_arr_len(fr->fr_rowlen) = 0;
+	fr->fr_cols = cols;
+	fr->fr_row = 0;
+	fr->fr_col = 0;
+	frame_newrow(fr);
+}
+
+ASHE_PUBLIC void a_frame_put(struct a_screen *sc, struct a_cell cell)
+{
+	struct a_frame *fr = &sc->sc_new;
+	a_uint32 *len;
+
+	if (*a_arr_uint32_last(&fr->fr_rowlen) == fr->fr_cols)
+		frame_newrow(fr);
+	len = a_arr_uint32_last(&fr->fr_rowlen);
+	*a_arr_cell_index(&fr->fr_cells, (frame_rows(fr) - 1) * fr->fr_cols + *len) = cell;
+	(*len)++;
+}
+
+ASHE_PUBLIC void a_frame_putc(struct a_screen *sc, const char *s, a_uint32 n, a_uint32 width,
+			      a_ubyte attr)
+{
+	struct a_frame *fr = &sc->sc_new;
+	struct a_cell cell = { .attr = attr }, *prev;
+	a_uint32 len;
+
+	if (width == 0) {
+		if ((len = *a_arr_uint32_last(&fr->fr_rowlen)) == 0)
+			return; /* nothing to join with */
+		prev = a_arr_cell_index(&fr->fr_cells, (frame_rows(fr) - 1) * fr->fr_cols + len - 1);
+		if (cell_covered(*prev) && len > 1)
+			prev--;
+		cell_join(prev, s, n);
+		return;
+	}
+	if (width == 2 && fr->fr_cols > 1 && *a_arr_uint32_last(&fr->fr_rowlen) == fr->fr_cols - 1) {
+		cell.c[0] = ' ';
+		a_frame_put(sc, cell);
+	}
+	memset(cell.c, 0, A_CELLBYTES);
+	memcpy(cell.c, s, a_min(n, A_CELLBYTES));
+	a_frame_put(sc, cell);
+	if (width == 2)
+		a_frame_put(sc, (struct a_cell){ .attr = attr });
+}
+
+ASHE_PUBLIC void a_frame_newline(struct a_screen *sc)
+{
+	struct a_frame *fr = &sc->sc_new;
+
+	if (*a_arr_uint32_last(&fr->fr_rowlen) == fr->fr_cols)
+		frame_newrow(fr);
+	frame_newrow(fr);
+}
+
+ASHE_PUBLIC void a_frame_cursor(struct a_screen *sc)
+{
+	struct a_frame *fr = &sc->sc_new;
+
+	if (*a_arr_uint32_last(&fr->fr_rowlen) == fr->fr_cols)
+		frame_newrow(fr);
+	fr->fr_row = frame_rows(fr) - 1;
+	fr->fr_col = *a_arr_uint32_last(&fr->fr_rowlen);
+}
+
+/*
+ * Move terminal cursor to 'row' and 'col'.
+ * Moving down is done with line feeds, this way
+ * terminal scrolls if the frame grows past the
+ * bottom of the screen.
+ */
+ASHE_PRIVATE void moveto(struct a_screen *sc, a_arr_char *out, a_uint32 row, a_uint32 col)
+{
+	a_uint32 n;
+
+	if (row < sc->sc_row) {
+		a_arr_char_push_strf(out, A_CSI "%nA", (a_ssize)(sc->sc_row - row));
+	} else if (row > sc->sc_row) {
+		if (col == 0) { /* explicit '\r\n', output is not post-processed */
+			a_arr_char_push(out, '\r');
+			sc->sc_col = 0;
+		} else {
+			sc->sc_col = COL_UNKNOWN;
+		}
+		for (n = row - sc->sc_row; n--;)
+			a_arr_char_push(out, '\n');
+	}
+	sc->sc_row = row;
+	if (col != sc->sc_col) {
+		if (col == 0)
+			a_arr_char_push(out, '\r');
+		else
+			a_arr_char_push_strf(out, A_CSI "%nG", (a_ssize)col + 1);
+		sc->sc_col = col;
+	}
+}
+
+ASHE_PRIVATE void setattr(struct a_screen *sc, a_arr_char *out, a_ubyte attr)
+{
+	struct a_attr *a;
+
+	a_arr_char_push_strlit(out, a_csi_sgr_reset);
+	a = a_arr_attr_index(&sc->sc_attrs, attr);
+	a_arr_char_push_str(out, a_arr_char_index(&sc->sc_attrbuf, a->start), a->len);
+	sc->sc_attr = attr;
+}
+
+ASHE_PRIVATE void putcells(struct a_screen *sc, a_arr_char *out, const struct a_cell *cells,
+			   a_uint32 n)
+{
+	a_uint32 i;
+
+	for (i = 0; i < n; i++) {
+		if (cell_covered(cells[i])) /* terminal already moved past it */
+			continue;
+		if (cells[i].attr != sc->sc_attr)
+			setattr(sc, out, cells[i].attr);
+		if (cells[i].c[1] == '\0') /* single byte */
+			a_arr_char_push(out, cells[i].c[0]);
+		else
+			a_arr_char_push_str(out, cells[i].c, cell_len(&cells[i]));
+	}
+	sc->sc_col += n; /* 'fr_cols' if wrap is pending */
+}
+
+ASHE_PUBLIC void a_screen_update(struct a_screen *sc, a_arr_char *out)
+{
+	struct a_frame *old = &sc->sc_old;
+	struct a_frame *new = &sc->sc_new;
+	struct a_frame temp;
+	struct a_cell *oc, *nc;
+	a_uint32 oldrows, newrows, r, ol, nl, first, end;
+	a_uint32 begin;
+	a_ubyte hidden;
+
+	ashe_assert(!sc->sc_valid || old->fr_cols == new->fr_cols);
+
+	begin = a_arrp_len(out);
+	a_arr_char_push_strlit(out, a_csi_sync_begin);
+	oldrows = sc->sc_valid ? frame_rows(old) : 0;
+	newrows = frame_rows(new);
+	hidden = 0;
+
+	for (r = 0; r < newrows; r++) {
+		nc = frame_row(new, r);
+		nl = frame_rowlen(new, r);
+		oc = NULL;
+		ol = 0;
+		if (r < oldrows) {
+			oc = frame_row(old, r);
+			ol = frame_rowlen(old, r);
+		}
+		for (first = 0; first < a_min(ol, nl) && cell_eq(oc[first], nc[first]); first++)
+			;
+		if (first == nl && nl == ol) /* row unchanged */
+			continue;
+		/* wide characters are redrawn whole */
+		while (first > 0 && ((first < nl && cell_covered(nc[first])) ||
+				     (first < ol && cell_covered(oc[first]))))
+			first--;
+		end = nl;
+		if (nl == ol)
+			while (end > first && cell_eq(oc[end - 1], nc[end - 1]))
+				end--;
+		while (end < nl && (cell_covered(nc[end]) || (end < ol && cell_covered(oc[end]))))
+			end++;
+		if (!hidden) {
+			a_arr_char_push_strlit(out, a_csi_cursor_hide);
+			hidden = 1;
+		}
+		moveto(sc, out, r, first);
+		putcells(sc, out, nc + first, end - first);
+		if (ol > nl) {
+			moveto(sc, out, r, nl);
+			a_arr_char_push_strlit(out, a_csi_clear_line_right);
+		}
+	}
+
+	if (oldrows > newrows) {
+		if (!hidden) {
+			a_arr_char_push_strlit(out, a_csi_cursor_hide);
+			hidden = 1;
+		}
+		moveto(sc, out, newrows, 0);
+		a_arr_char_push_strlit(out, a_csi_clear_down);
+	}
+
+	if (sc->sc_attr != 0)
+		setattr(sc, out, 0);
+	moveto(sc, out, new->fr_row, new->fr_col);
+	if (hidden)
+		a_arr_char_push_strlit(out, a_csi_cursor_show);
+
+	if (a_arrp_len(out) == begin + SS(a_csi_sync_begin))
+		a_arrp_len(out) = begin; /* nothing changed */
+	else
+		a_arr_char_push_strlit(out, a_csi_sync_end);
+
+	/* new frame is now on the terminal */
+	temp = *old;
+	*old = *new;
+	*new = temp;
+	sc->sc_valid = 1;
+}
+
+ASHE_PUBLIC void a_screen_home(struct a_screen *sc, a_arr_char *out)
+{
+	moveto(sc, out, 0, 0);
+}
+
+ASHE_PUBLIC a_uint32 a_screen_leave(struct a_screen *sc, a_arr_char *out)
+{
+	struct a_frame *old = &sc->sc_old;
+	a_uint32 rows, moved;
+
+	moved = 0;
+	if (sc->sc_valid) {
+		/* trailing empty row (cursor row) is reused */
+		rows = frame_rows(old);
+		if (rows > 1 && frame_rowlen(old, rows - 1) == 0)
+			rows--;
+		if (sc->sc_attr != 0)
+			setattr(sc, out, 0);
+		moved = rows - sc->sc_row;
+		moveto(sc, out, rows, 0);
+	}
+	a_screen_invalidate(sc);
+	return moved;
+}
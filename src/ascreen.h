@@ -0,0 +1,146 @@
+/* ----------------------------------------------------------------------------------------------
+ * Copyright (C) 2023-2024 Jure Bagić
+ *
+ * This file is part of ashe.
+ * ashe is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * ashe is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ashe.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------------------------*/
+
+#ifndef ASCREEN_H
+#define ASCREEN_H
+
+#include "acommon.h"
+#include "aarray.h"
+#include "atoken.h"
+
+/* control sequence introducer */
+#define A_CSI	   "\033["
+#define A_ESC(seq) A_CSI #seq
+
+/* columns between tab stops */
+#define A_TABSTOP 8
+
+/* bytes of a character (with combining characters) in a cell */
+#define A_CELLBYTES 8
+
+/* screen cell */
+struct a_cell {
+	/* UTF-8 character, '\0' padded (empty if cell is
+	 * covered by the wide character on its left) */
+	char c[A_CELLBYTES];
+	a_ubyte attr; /* index into 'sc_attrs' (0 is default) */
+};
+
+ARRAY_NEW(a_arr_cell, struct a_cell)
+ARRAY_NEW(a_arr_uint32, a_uint32)
+
+/* graphic rendition (SGR sequence) */
+struct a_attr {
+	a_uint32 start; /* offset into 'sc_attrbuf' */
+	a_uint32 len;
+};
+
+ARRAY_NEW(a_arr_attr, struct a_attr)
+
+/*
+ * Rendered frame (prompt + input).
+ * Row 'n' occupies cells from 'n * fr_cols' up to
+ * 'n * fr_cols + fr_rowlen[n]'.
+ */
+struct a_frame {
+	a_arr_cell fr_cells;
+	a_arr_uint32 fr_rowlen;
+	a_uint32 fr_cols; /* terminal columns when frame was built */
+	a_uint32 fr_row; /* cursor row */
+	a_uint32 fr_col; /* cursor column */
+};
+
+/*
+ * Virtual screen, 'sc_old' is the frame currently
+ * visible on the terminal and 'sc_new' is the frame
+ * being built.
+ * Rows and columns are relative to the frame origin,
+ * which is the first column of the terminal row where
+ * the prompt starts.
+ */
+struct a_screen {
+	struct a_frame sc_old;
+	struct a_frame sc_new;
+	a_arr_attr sc_attrs;
+	a_arr_char sc_attrbuf;
+	a_uint32 sc_row; /* terminal cursor row */
+	a_uint32 sc_col; /* terminal cursor column ('fr_cols' if wrap is pending) */
+	a_ubyte sc_attr; /* active rendition */
+	a_ubyte sc_valid; /* set if 'sc_old' is on the terminal */
+};
+
+void a_screen_init(struct a_screen *sc);
+void a_screen_free(struct a_screen *sc);
+
+/*
+ * Forget the frame on the terminal, next update
+ * draws the whole frame assuming terminal cursor
+ * is at the frame origin.
+ */
+void a_screen_invalidate(struct a_screen *sc);
+
+/*
+ * Convert 'str' into cells, SGR escape sequences
+ * are stripped and applied as cell attributes.
+ * Wide characters take two cells and tabs are
+ * expanded up to the next tab stop.
+ */
+void a_screen_cells(struct a_screen *sc, a_arr_cell *out, const char *str);
+
+/*
+ * Return attribute for cells rendered with SGR
+ * sequence 'seq' (0 if 'seq' is empty).
+ */
+a_ubyte a_screen_attr(struct a_screen *sc, const char *seq);
+
+/* Start building new frame 'cols' wide. */
+void a_frame_begin(struct a_screen *sc, a_uint32 cols);
+
+/* Append cell, wraps into the next row when the row is full. */
+void a_frame_put(struct a_screen *sc, struct a_cell cell);
+
+/*
+ * Append character of 'n' bytes at 's' taking 'width'
+ * columns. Wide character that doesn't fit into the
+ * row goes into the next one and character taking
+ * no columns is joined with the cell before it.
+ */
+void a_frame_putc(struct a_screen *sc, const char *s, a_uint32 n, a_uint32 width, a_ubyte attr);
+
+/* Continue building from the start of the next row. */
+void a_frame_newline(struct a_screen *sc);
+
+/* Place the cursor at the current build position. */
+void a_frame_cursor(struct a_screen *sc);
+
+/*
+ * Push into 'out' the minimal amount of control
+ * sequences and cells transforming the frame on the
+ * terminal into the newly built frame.
+ */
+void a_screen_update(struct a_screen *sc, a_arr_char *out);
+
+/* Move the terminal cursor to the frame origin. */
+void a_screen_home(struct a_screen *sc, a_arr_char *out);
+
+/*
+ * Move the terminal cursor onto the row below the
+ * frame and invalidate the screen.
+ * Returns the number of rows the cursor moved down.
+ */
+a_uint32 a_screen_leave(struct a_screen *sc, a_arr_char *out);
+
+#endif
@@ -98,6 +98,8 @@ get_terminal:
 	ashe_tcsetpgrp(sh_pgid);
 
 	a_jobcntl_init(&sh->sh_jobcntl);
+	a_pathcache_init(&sh->sh_path);
+	a_complete_init(&sh->sh_complete);
 	a_term_init();
 	ashe_init_sighandlers();
 	ashe_pwelcome();
@@ -106,9 +108,12 @@ get_terminal:
 ASHE_PUBLIC void a_shell_free(struct a_shell *sh)
 {
 	a_jobcntl_free(&sh->sh_jobcntl);
+	a_pathcache_free(&sh->sh_path);
+	a_complete_free(&sh->sh_complete);
 	a_term_free();
 	a_arr_ccharp_free(&sh->sh_strings, ashe_free_ccharp);
 	a_arr_char_free(&sh->sh_welcome, NULL);
+	ashe_plhfree();
 	a_arr_char_free(&sh->sh_status, NULL);
 	a_block_free(&sh->sh_block);
 }
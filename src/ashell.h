@@ -22,6 +22,8 @@
 #include "ainput.h"
 #include "ajobcntl.h"
 #include "ahist.h"
+#include "apath.h"
+#include "acomplete.h"
 
 #include <signal.h>
 #include <setjmp.h>
@@ -57,8 +59,9 @@ struct a_shell {
 	struct a_jmpbuf sh_buf;
 	struct a_flags sh_flags;
 	struct a_settings sh_settings;
-	volatile sig_atomic_t sh_int; /* set if we got interrupted */
 	struct a_histlist sh_history;
+	struct a_pathcache sh_path; /* commands in PATH */
+	struct a_complete sh_complete;
 	a_ubyte sh_dirtyfd[3]; /* fd flags */
 };
 
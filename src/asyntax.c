@@ -0,0 +1,441 @@
+/* ----------------------------------------------------------------------------------------------
+ * Copyright (C) 2023-2024 Jure Bagić
+ *
+ * This file is part of ashe.
+ * ashe is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * ashe is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ashe.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "abuiltin.h"
+#include "ainput.h"
+#include "alex.h"
+#include "apath.h"
+#include "ashell.h"
+#include "asyntax.h"
+
+/* input bytes copied for lexing at once, doubled for longer tokens */
+#define WINSIZE 256
+
+/*
+ * Words and comments longer than 'WINMAX' are split into
+ * pieces of about 'PIECE' bytes (not highlighted), each
+ * keeps the lexer state at its start, this way an edit
+ * inside of one re-lexes only a piece or two of it.
+ */
+#define WINMAX 4096
+#define PIECE  512
+
+/* token continues a long word or comment */
+#define HLS_PART 0x04
+
+/* lexer state (A_LEX_*) a piece continues in */
+#define HLS_CUT(state)	  ((state) >> 3)
+#define HLS_PIECE(cut)	  (HLS_PART | ((cut) << 3))
+#define HLS_OUTER(state) ((state) & (A_HLS_CMD | A_HLS_REDIR))
+
+static const char *const sgr[HL_CNT] = {
+	[HL_NONE] = "",
+	[HL_CMD] = ASHE_HL_CMD,
+	[HL_NOCMD] = ASHE_HL_NOCMD,
+	[HL_STRING] = ASHE_HL_STRING,
+	[HL_KVPAIR] = ASHE_HL_KVPAIR,
+	[HL_REDIR] = ASHE_HL_REDIR,
+	[HL_OPERATOR] = ASHE_HL_OPERATOR,
+	[HL_COMMENT] = ASHE_HL_COMMENT,
+	[HL_ERROR] = ASHE_HL_ERROR,
+	[HL_SUGGEST] = ASHE_HL_SUGGEST,
+};
+
+/* number of tokens */
+#define ntoks(sy) a_arr_len((sy)->sy_toks)
+
+/* number of unused slots in the token array */
+#define gaplen(sy) (a_arr_cap((sy)->sy_toks) - a_arr_len((sy)->sy_toks))
+
+/* token 'i' */
+#define tok(sy, i) (&a_arr_ptr((sy)->sy_toks)[(i) < (sy)->sy_gap ? (i) : (i) + gaplen(sy)])
+
+/* input index where token 'i' starts */
+#define tokstart(sy, i) \
+	((i) < (sy)->sy_gap ? tok(sy, i)->start : (sy)->sy_textlen - tok(sy, i)->start)
+
+/* drop the first token after the gap */
+#define tokdrop(sy) (a_arr_len((sy)->sy_toks)--)
+
+/* Return where input index 'i' ends up after the edit. */
+#define shift(i, pos, removed, inserted) \
+	((i) >= (pos) + (removed) ? (i) - (removed) + (inserted) : a_min(i, pos))
+
+/* Move the gap in front of token 'i'. */
+ASHE_PRIVATE void gapto(struct a_syntax *sy, a_uint32 i)
+{
+	struct a_hltok *toks;
+	a_uint32 glen;
+
+	toks = a_arr_ptr(sy->sy_toks);
+	glen = gaplen(sy);
+	for (; sy->sy_gap > i; sy->sy_gap--) {
+		toks[sy->sy_gap - 1 + glen] = toks[sy->sy_gap - 1];
+		toks[sy->sy_gap - 1 + glen].start = sy->sy_textlen - toks[sy->sy_gap - 1].start;
+	}
+	for (; sy->sy_gap < i; sy->sy_gap++) {
+		toks[sy->sy_gap] = toks[sy->sy_gap + glen];
+		toks[sy->sy_gap].start = sy->sy_textlen - toks[sy->sy_gap + glen].start;
+	}
+}
+
+/* Insert token in front of the gap. */
+ASHE_PRIVATE void tokpush(struct a_syntax *sy, struct a_hltok tok)
+{
+	a_uint32 oldcap, after;
+
+	if (gaplen(sy) == 0) { /* grow, tokens after the gap go to the end */
+		oldcap = a_arr_cap(sy->sy_toks);
+		after = ntoks(sy) - sy->sy_gap;
+		a_arr_hltok_ensure(&sy->sy_toks, 1);
+		memmove(a_arr_ptr(sy->sy_toks) + a_arr_cap(sy->sy_toks) - after,
+			a_arr_ptr(sy->sy_toks) + oldcap - after, after * sizeof(tok));
+	}
+	a_arr_ptr(sy->sy_toks)[sy->sy_gap++] = tok;
+	ntoks(sy)++;
+}
+
+/* Return index of the first token starting at or after 'pos'. */
+ASHE_PRIVATE a_uint32 lower_bound(struct a_syntax *sy, a_uint32 pos)
+{
+	a_uint32 lo, hi, mid;
+
+	lo = 0;
+	hi = ntoks(sy);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (tokstart(sy, mid) < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Copy at most 'n' input bytes starting at 'from'
+ * into the lexing window.
+ * Returns the number of bytes copied.
+ */
+ASHE_PRIVATE a_uint32 fill(struct a_syntax *sy, a_uint32 from, a_uint32 n)
+{
+	a_uint32 k;
+
+	n = a_min(n, sy->sy_textlen - from);
+	a_arr_len(sy->sy_win) = 0;
+	a_arr_char_ensure(&sy->sy_win, n + 1);
+	k = (from < A_IGAP ? a_min(n, A_IGAP - from) : 0);
+	a_arr_char_push_str(&sy->sy_win, a_arr_ptr(A_IBF) + from, k);
+	a_arr_char_push_str(&sy->sy_win, a_arr_ptr(A_IBF) + from + k + A_IGAPLEN, n - k);
+	a_arr_char_push(&sy->sy_win, '\0');
+	return n;
+}
+
+/* Return 1 if command 'name' of 'len' bytes exists. */
+ASHE_PRIVATE a_ubyte cmd_exists(char *name, a_uint32 len)
+{
+	struct stat st;
+	a_ubyte found;
+	char c;
+
+	c = name[len];
+	name[len] = '\0';
+	if (memchr(name, '/', len) != NULL)
+		found = (stat(name, &st) == 0 && !S_ISDIR(st.st_mode) && access(name, X_OK) == 0);
+	else
+		found = (ashe_isbin(name) >= 0 || a_pathcache_has(&ashe.sh_path, name, len));
+	name[len] = c;
+	return found;
+}
+
+/* Return class of the string 'token' and update lexer 'state'. */
+ASHE_PRIVATE a_ubyte classify_string(struct a_token *token, a_ubyte *state)
+{
+	a_uint32 len;
+	a_ubyte hl;
+
+	len = token->end - token->start;
+	hl = (memchr(token->start, '"', len) != NULL ? HL_STRING : HL_NONE);
+	if (token->type == TK_ERROR)
+		hl = HL_ERROR;
+	if (*state & A_HLS_REDIR) {
+		*state &= ~A_HLS_REDIR;
+		return hl;
+	}
+	if (!(*state & A_HLS_CMD))
+		return hl;
+	if (token->type == TK_KVPAIR) /* command still follows */
+		return HL_KVPAIR;
+	*state &= ~A_HLS_CMD;
+	/* can't tell what expands into */
+	if (hl != HL_NONE || memchr(token->start, '$', len) != NULL ||
+	    memchr(token->start, '\\', len) != NULL)
+		return hl;
+	return (cmd_exists((char *)token->start, len) ? HL_CMD : HL_NOCMD);
+}
+
+/* Return class of 'token' and update lexer 'state'. */
+ASHE_PRIVATE a_ubyte classify(struct a_token *token, a_ubyte *state)
+{
+	switch (token->type) {
+	case TK_WORD:
+	case TK_KVPAIR:
+	case TK_ERROR:
+		return classify_string(token, state);
+	case TK_LESS_AND:
+	case TK_GREATER_AND:
+	case TK_GREATER_PIPE:
+	case TK_GREATER_GREATER:
+	case TK_AND_GREATER:
+	case TK_AND_GREATER_GREATER:
+	case TK_LESS_GREATER:
+	case TK_LESS:
+	case TK_GREATER:
+		*state |= A_HLS_REDIR;
+		return HL_REDIR;
+	case TK_MINUS: /* closes fd after '<&' or '>&' */
+		*state &= ~A_HLS_REDIR;
+		return HL_NONE;
+	case TK_COMMENT:
+		return HL_COMMENT;
+	case TK_RPAREN:
+		*state = 0;
+		return HL_OPERATOR;
+	default: /* ';', '|', '||', '&', '&&', '(' */
+		*state = A_HLS_CMD;
+		return HL_OPERATOR;
+	}
+}
+
+ASHE_PUBLIC void a_syntax_init(struct a_syntax *sy)
+{
+	a_arr_hltok_init(&sy->sy_toks);
+	a_arr_char_init(&sy->sy_win);
+	a_syntax_clear(sy);
+}
+
+ASHE_PUBLIC void a_syntax_free(struct a_syntax *sy)
+{
+	a_arr_hltok_free(&sy->sy_toks, NULL);
+	a_arr_char_free(&sy->sy_win, NULL);
+}
+
+ASHE_PUBLIC void a_syntax_clear(struct a_syntax *sy)
+{
+	a_arr_len(sy->sy_toks) = 0;
+	sy->sy_gap = 0;
+	sy->sy_textlen = 0;
+	sy->sy_lo = sy->sy_hi = 0;
+	sy->sy_dirty = 0;
+	sy->sy_state = A_HLS_CMD;
+}
+
+ASHE_PUBLIC void a_syntax_edit(struct a_syntax *sy, a_uint32 pos, a_uint32 removed, a_uint32 inserted)
+{
+	/* tokens after the gap follow the end of input */
+	gapto(sy, lower_bound(sy, pos));
+	while (sy->sy_gap < ntoks(sy) && tokstart(sy, sy->sy_gap) < pos + removed)
+		tokdrop(sy);
+	sy->sy_textlen = sy->sy_textlen - removed + inserted;
+	if (!sy->sy_dirty) {
+		sy->sy_lo = pos;
+		sy->sy_hi = pos + inserted;
+		sy->sy_dirty = 1;
+	} else {
+		sy->sy_lo = a_min(shift(sy->sy_lo, pos, removed, inserted), pos);
+		sy->sy_hi = a_max(shift(sy->sy_hi, pos, removed, inserted), pos + inserted);
+	}
+}
+
+/*
+ * Drop old tokens starting before 'start'.
+ * Returns 1 if the old token at 'start' past the dirty
+ * range was lexed in the same 'state', rest of the tokens
+ * is the same then.
+ */
+ASHE_PRIVATE a_ubyte resync(struct a_syntax *sy, a_uint32 start, a_ubyte state)
+{
+	while (sy->sy_gap < ntoks(sy) && tokstart(sy, sy->sy_gap) < start)
+		tokdrop(sy);
+	if (sy->sy_gap < ntoks(sy) && tokstart(sy, sy->sy_gap) == start) {
+		if (start >= sy->sy_hi && tok(sy, sy->sy_gap)->state == state)
+			return 1;
+		tokdrop(sy);
+	}
+	return 0;
+}
+
+/*
+ * Lex the next piece of a long token at 'pos' in 'state'.
+ * Piece ends where the next old token starts if it is near,
+ * edits a piece away resync right there.
+ * Returns the end of the piece.
+ */
+ASHE_PRIVATE a_uint32 lex_piece(struct a_syntax *sy, a_uint32 pos, a_ubyte *state)
+{
+	struct a_lexer lexer;
+	struct a_hltok new;
+	a_uint32 limit, len, end;
+	a_ubyte cut;
+
+	limit = (sy->sy_gap < ntoks(sy) ? tokstart(sy, sy->sy_gap) : sy->sy_textlen);
+	if (limit - pos > 2 * PIECE)
+		limit = pos + PIECE;
+	len = fill(sy, pos, limit - pos);
+	lexer.current = a_arr_ptr(sy->sy_win);
+	cut = a_lexer_scan_rest(&lexer, HLS_CUT(*state));
+	end = pos + (lexer.current - a_arr_ptr(sy->sy_win));
+	if (end > pos) {
+		new.start = pos;
+		new.len = end - pos;
+		new.state = *state;
+		new.hl = (cut & A_LEX_COMMENT ? HL_COMMENT : HL_NONE);
+		tokpush(sy, new);
+	}
+	*state = HLS_OUTER(*state);
+	if (end > pos && end == pos + len && end < sy->sy_textlen) /* not over yet */
+		*state |= HLS_PIECE(cut);
+	return end;
+}
+
+ASHE_PUBLIC void a_syntax_sync(struct a_syntax *sy)
+{
+	struct a_lexer lexer;
+	struct a_token token;
+	struct a_hltok new;
+	a_uint32 i, pos, winstart, winlen, winsize, start, end;
+	a_ubyte state, cut, piece;
+
+	if (!sy->sy_dirty)
+		return;
+	sy->sy_dirty = 0;
+
+	/*
+	 * Continue from the last token starting before the dirty
+	 * range, it can end right where the range starts.
+	 */
+	pos = 0;
+	state = A_HLS_CMD;
+	if ((i = lower_bound(sy, sy->sy_lo)) > 0) {
+		i--;
+		/* long token could get short, go back to its first piece */
+		while (i > 0 && (tok(sy, i)->state & HLS_PART) && tokstart(sy, i) + WINMAX > sy->sy_lo)
+			i--;
+		pos = tokstart(sy, i);
+		state = tok(sy, i)->state;
+	}
+	gapto(sy, i);
+
+	winsize = WINSIZE;
+	winstart = pos;
+	winlen = fill(sy, winstart, winsize);
+	for (;;) {
+		if (a_unlikely(state & HLS_PART)) {
+			if (resync(sy, pos, state))
+				break;
+			pos = lex_piece(sy, pos, &state);
+			if (!(state & HLS_PART)) {
+				winsize = WINSIZE;
+				winstart = pos;
+				winlen = fill(sy, winstart, winsize);
+			}
+			continue;
+		}
+		lexer.current = a_arr_ptr(sy->sy_win) + (pos - winstart);
+		token = a_lexer_scan(&lexer);
+		start = winstart + (token.start - a_arr_ptr(sy->sy_win));
+		end = winstart + (token.end - a_arr_ptr(sy->sy_win));
+		piece = cut = 0;
+		/* lexer looks at most 2 bytes ahead */
+		if (winstart + winlen < sy->sy_textlen && end + 2 >= winstart + winlen) {
+			if (start > winstart) { /* skip blanks, token starts the window */
+				pos = start;
+			} else if (winsize < WINMAX) {
+				winsize *= 2;
+			} else { /* too long, first piece of it */
+				winlen = fill(sy, start, PIECE);
+				lexer.current = a_arr_ptr(sy->sy_win);
+				cut = a_lexer_scan_rest(&lexer,
+							(token.type == TK_COMMENT ? A_LEX_COMMENT : 0));
+				token.start = a_arr_ptr(sy->sy_win);
+				token.end = lexer.current;
+				end = start + (token.end - token.start);
+				piece = 1;
+			}
+			if (!piece) {
+				winstart = pos;
+				winlen = fill(sy, winstart, winsize);
+				continue;
+			}
+		}
+		if (token.type == TK_EOL) {
+			ntoks(sy) = sy->sy_gap;
+			sy->sy_state = state;
+			break;
+		}
+		if (resync(sy, start, state))
+			break; /* rest of the tokens is the same */
+		new.start = start;
+		new.len = end - start;
+		new.state = state;
+		new.hl = classify(&token, &state);
+		if (piece) {
+			new.hl = (token.type == TK_COMMENT ? HL_COMMENT : HL_NONE);
+			state |= HLS_PIECE(cut);
+		}
+		tokpush(sy, new);
+		pos = end;
+	}
+}
+
+ASHE_PUBLIC a_uint32 a_syntax_find(struct a_syntax *sy, a_uint32 idx)
+{
+	a_uint32 i;
+
+	i = lower_bound(sy, idx + 1);
+	if (i > 0 && tokstart(sy, i - 1) + tok(sy, i - 1)->len > idx)
+		i--;
+	return i;
+}
+
+ASHE_PUBLIC a_ubyte a_syntax_tok(struct a_syntax *sy, a_uint32 i, a_uint32 *start, a_uint32 *end,
+				 a_ubyte *hl)
+{
+	if (i >= ntoks(sy))
+		return 0;
+	*start = tokstart(sy, i);
+	*end = *start + tok(sy, i)->len;
+	*hl = tok(sy, i)->hl;
+	return 1;
+}
+
+ASHE_PUBLIC a_ubyte a_syntax_state(struct a_syntax *sy, a_uint32 idx)
+{
+	a_uint32 i;
+
+	a_syntax_sync(sy);
+	i = lower_bound(sy, idx);
+	return HLS_OUTER(i < ntoks(sy) ? tok(sy, i)->state : sy->sy_state);
+}
+
+ASHE_PUBLIC const char *a_syntax_sgr(enum a_hlclass hl)
+{
+	return sgr[hl];
+}
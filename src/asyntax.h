@@ -0,0 +1,106 @@
+/* ----------------------------------------------------------------------------------------------
+ * Copyright (C) 2023-2024 Jure Bagić
+ *
+ * This file is part of ashe.
+ * ashe is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * ashe is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ashe.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------------------------*/
+
+#ifndef ASYNTAX_H
+#define ASYNTAX_H
+
+#include "acommon.h"
+#include "aarray.h"
+#include "atoken.h"
+
+/* highlight classes */
+enum a_hlclass {
+	HL_NONE = 0, /* argument, whitespace */
+	HL_CMD, /* existing command */
+	HL_NOCMD, /* unknown command */
+	HL_STRING, /* argument with double quotes */
+	HL_KVPAIR, /* key=value */
+	HL_REDIR, /* redirection operator */
+	HL_OPERATOR, /* control operator */
+	HL_COMMENT,
+	HL_ERROR, /* unterminated string */
+	HL_SUGGEST, /* history suggestion after the input */
+	HL_CNT,
+};
+
+/* lexer state before a token */
+#define A_HLS_CMD   0x01 /* next string is a command */
+#define A_HLS_REDIR 0x02 /* next string is a redirection target */
+
+/* highlighted token */
+struct a_hltok {
+	a_uint32 start; /* input index, distance from the end of input if after the gap */
+	a_uint32 len;
+	a_ubyte hl; /* 'enum a_hlclass' */
+	a_ubyte state; /* A_HLS_* */
+};
+
+ARRAY_NEW(a_arr_hltok, struct a_hltok)
+
+/*
+ * Tokens of the input used for highlighting.
+ * Token array is a gap array, tokens before 'sy_gap'
+ * keep their input index and tokens after it keep the
+ * distance from the end of input, this way edits do not
+ * need to update tokens after the edited one.
+ * Edits only mark the range between 'sy_lo' and 'sy_hi'
+ * as dirty, it is re-lexed on 'a_syntax_sync()' starting
+ * from the token before it up to the first old token that
+ * starts in the same place and lexer state.
+ */
+struct a_syntax {
+	a_arr_hltok sy_toks;
+	a_uint32 sy_gap;
+	a_uint32 sy_textlen; /* input length */
+	a_uint32 sy_lo; /* dirty range */
+	a_uint32 sy_hi;
+	a_ubyte sy_dirty;
+	a_ubyte sy_state; /* lexer state after the last token */
+	a_arr_char sy_win; /* lexed part of the input */
+};
+
+void a_syntax_init(struct a_syntax *sy);
+void a_syntax_free(struct a_syntax *sy);
+
+/* Input was cleared. */
+void a_syntax_clear(struct a_syntax *sy);
+
+/* Input bytes were 'removed' and 'inserted' at 'pos'. */
+void a_syntax_edit(struct a_syntax *sy, a_uint32 pos, a_uint32 removed, a_uint32 inserted);
+
+/* Re-lex the dirty range. */
+void a_syntax_sync(struct a_syntax *sy);
+
+/* Return index of the first token ending after input index 'idx'. */
+a_uint32 a_syntax_find(struct a_syntax *sy, a_uint32 idx);
+
+/*
+ * Get input range and class of token 'i'.
+ * Returns 0 if there is no such token.
+ */
+a_ubyte a_syntax_tok(struct a_syntax *sy, a_uint32 i, a_uint32 *start, a_uint32 *end,
+		     a_ubyte *hl);
+
+/*
+ * Return lexer state (A_HLS_*) a word starting at
+ * input index 'idx' would be lexed in.
+ */
+a_ubyte a_syntax_state(struct a_syntax *sy, a_uint32 idx);
+
+/* Return SGR sequence of the class 'hl'. */
+const char *a_syntax_sgr(enum a_hlclass hl);
+
+#endif
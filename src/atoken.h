@@ -45,6 +45,7 @@ enum a_toktype {
 	TK_WORD, /* string */
 	TK_KVPAIR, /* key=value */
 	TK_NUMBER, /* number (integer) */
+	TK_COMMENT, /* '#' up to the end of line (only from 'a_lexer_scan()') */
 };
 
 struct a_token {
@@ -24,17 +24,103 @@
 
 #include <errno.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <sys/sysinfo.h>
 #include <time.h>
 #include <pwd.h>
 
 static char plhbuf[BUFSIZ];
 
+/* number of placeholders (sync and async) */
+#define NSYNC  ASHE_ELEMENTS(placeholders)
+#define NASYNC ASHE_ELEMENTS(asyncplaceholders)
+
+/* max size of async placeholder value */
+#define ASYNC_MAX 128
+
+/*
+ * Worker computing async placeholders, main thread
+ * requests values for the current directory and the
+ * worker posts them back (and signals 'efd').
+ * Members below 'lock' are protected by it.
+ */
+static struct {
+	pthread_t thread;
+	a_int32 efd; /* eventfd, -1 if worker is not running */
+	/* values taken by the main thread */
+	char shown[NASYNC][ASYNC_MAX];
+	a_ubyte shownok[NASYNC]; /* value is for the current directory */
+	char cwd[PATH_MAX]; /* current directory */
+	a_ubyte cwdok;
+	a_uint64 seen; /* last taken generation */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	a_uint64 reqgen; /* generation of the last request */
+	a_uint32 reqmask; /* placeholders requested */
+	char reqcwd[PATH_MAX];
+	a_uint64 resgen; /* generation of the last result */
+	char rescwd[PATH_MAX];
+	char res[NASYNC][ASYNC_MAX];
+	a_ubyte quit;
+} async = { .efd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+/* cached placeholder value */
+struct plhval {
+	a_arr_char val;
+	time_t expires; /* 0 if it doesn't expire */
+	a_ubyte events; /* events invalidating the value */
+	a_ubyte valid;
+	a_ubyte null; /* placeholder returned NULL */
+};
+
+static struct plhval plhvals[ASHE_ELEMENTS(placeholders)];
+
+/* incremented each time any placeholder value changes */
+static a_uint64 plhgen = 1;
+
+/* set by 'ashe_plhcache()', by default values are not cached */
+static time_t plhexpires;
+static a_ubyte plhevents, plhcached;
+
+ASHE_PUBLIC void ashe_plhcache(time_t expires, a_ubyte events)
+{
+	plhexpires = expires;
+	plhevents = events;
+	plhcached = 1;
+}
+
+ASHE_PUBLIC void ashe_plhinvalidate(a_ubyte events)
+{
+	a_uint32 i;
+
+	for (i = 0; i < ASHE_ELEMENTS(plhvals); i++)
+		if (plhvals[i].events & events)
+			plhvals[i].valid = 0;
+	if (events & A_PLH_CWD) { /* async values are for the old directory */
+		async.cwdok = 0;
+		for (i = 0; i < NASYNC; i++) {
+			plhgen += async.shownok[i];
+			async.shownok[i] = 0;
+		}
+	}
+}
+
+/* Return the start of the next minute after time 't'. */
+ASHE_PRIVATE time_t next_minute(time_t t, const struct tm *lt)
+{
+	return t + 60 - lt->tm_sec;
+}
+
 ASHE_PUBLIC const char *ashe_host(void)
 {
 	if (a_unlikely(gethostname(plhbuf, sizeof(plhbuf) - 1) < 0))
 		ashe_panic_libcall(gethostname);
+	ashe_plhcache(0, 0);
 	return plhbuf;
 }
 
@@ -48,6 +134,7 @@ ASHE_PUBLIC const char *ashe_user(void)
 	if (a_unlikely(!(record = getpwuid(uid))))
 		ashe_panic_libcall(getpwuid);
 	ashe_snprintf(plhbuf, sizeof(plhbuf) - 1, "%s", record->pw_name);
+	ashe_plhcache(0, 0);
 	return plhbuf;
 }
 
@@ -56,6 +143,7 @@ ASHE_PUBLIC const char *ashe_jobc(void)
 	a_uint32 jobc = a_jobcntl_jobs(&ashe.sh_jobcntl);
 	const char *fmt = (jobc ? "%u" : "");
 	ashe_snprintf(plhbuf, sizeof(plhbuf) - 1, fmt, jobc);
+	ashe_plhcache(0, A_PLH_JOBS);
 	return plhbuf;
 }
 
@@ -69,6 +157,7 @@ ASHE_PUBLIC const char *ashe_dir(void)
 		ptr++;
 		ashe_snprintf(plhbuf, sizeof(plhbuf) - 1, "%s", ptr);
 	}
+	ashe_plhcache(0, A_PLH_CWD);
 	return plhbuf;
 }
 
@@ -76,6 +165,7 @@ ASHE_PUBLIC const char *ashe_adir(void)
 {
 	if (a_unlikely(!getcwd(plhbuf, BUFSIZ)))
 		ashe_panic_libcall(getcwd);
+	ashe_plhcache(0, A_PLH_CWD);
 	return plhbuf;
 }
 
@@ -89,6 +179,7 @@ ASHE_PUBLIC const char *ashe_time(void)
 	if (a_unlikely((lt = localtime(&t)) == NULL))
 		ashe_panic_libcall(localtime);
 	ashe_snprintf(plhbuf, sizeof(plhbuf) - 1, "%02d:%02d", lt->tm_hour, lt->tm_min);
+	ashe_plhcache(next_minute(t, lt), 0);
 	return plhbuf;
 }
 
@@ -103,48 +194,350 @@ ASHE_PUBLIC const char *ashe_date(void)
 		ashe_panic_libcall(localtime);
 	ashe_snprintf(plhbuf, sizeof(plhbuf) - 1, "%d-%02d-%02d", lt->tm_year + 1900,
 		      lt->tm_mon + 1, lt->tm_mday);
+	ashe_plhcache(next_minute(t, lt) + (23 - lt->tm_hour) * 3600 + (59 - lt->tm_min) * 60, 0);
 	return plhbuf;
 }
 
 ASHE_PUBLIC const char *ashe_uptime(void)
 {
 	struct sysinfo si;
+	time_t t;
 
+	if (a_unlikely(time(&t) < 0))
+		ashe_panic_libcall(time);
 	if (a_unlikely(sysinfo(&si) < 0))
 		ashe_panic_libcall(sysinfo);
 	ashe_snprintf(plhbuf, sizeof(plhbuf) - 1, "%ldh %ldm", (si.uptime / 3600),
 		      (si.uptime / 60) % 60);
+	ashe_plhcache(t + 60 - si.uptime % 60, 0);
 	return plhbuf;
 }
 
-ASHE_PRIVATE void expand_placeholders(a_arr_char *out, const char **ptr)
+/*
+ * Read at most 'size' - 1 bytes of file 'path' into 'buf'
+ * (null terminated), returns the number of bytes read or
+ * -1 if the file can't be read.
+ */
+ASHE_PRIVATE a_ssize read_small(const char *path, char *buf, size_t size)
+{
+	a_ssize n;
+	a_int32 fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	while ((n = read(fd, buf, size - 1)) < 0 && errno == EINTR)
+		;
+	close(fd);
+	if (n >= 0)
+		buf[n] = '\0';
+	return n;
+}
+
+/* Copy 'n' bytes of 's' into 'buf' of 'size' bytes (truncating). */
+ASHE_PRIVATE void copy_value(char *buf, size_t size, const char *s, size_t n)
+{
+	n = (n < size ? n : size - 1);
+	memcpy(buf, s, n);
+	buf[n] = '\0';
+}
+
+ASHE_PUBLIC void ashe_gitbranch(const char *cwd, char *buf, size_t size)
 {
-	const char *p = *ptr;
+	static const char refs[] = "ref: refs/heads/";
+	char path[PATH_MAX], data[PATH_MAX];
+	size_t len, n;
+	a_ssize r;
+
+	buf[0] = '\0';
+	if ((len = strlen(cwd)) == 1) /* root */
+		len = 0;
+	if (len + sizeof("/.git/HEAD") > sizeof(path))
+		return;
+	memcpy(path, cwd, len);
+	for (;;) { /* find '.git' in the directory or any of its parents */
+		memcpy(path + len, "/.git", sizeof("/.git"));
+		if ((r = read_small(path, data, sizeof(data))) >= 0) { /* "gitdir: " file */
+			if (strncmp(data, "gitdir: ", 8) != 0)
+				return;
+			n = strcspn(data + 8, "\n");
+			if (data[8] == '/') /* absolute */
+				len = 0;
+			else
+				path[len++] = '/';
+			if (len + n + sizeof("/HEAD") > sizeof(path))
+				return;
+			memcpy(path + len, data + 8, n);
+			memcpy(path + len + n, "/HEAD", sizeof("/HEAD"));
+			break;
+		}
+		memcpy(path + len, "/.git/HEAD", sizeof("/.git/HEAD"));
+		if (access(path, F_OK) == 0)
+			break;
+		if (len == 0)
+			return;
+		while (len > 0 && path[--len] != '/')
+			;
+	}
+	if (read_small(path, data, sizeof(data)) <= 0)
+		return;
+	n = strcspn(data, "\n");
+	if (strncmp(data, refs, SS(refs)) == 0) /* branch */
+		copy_value(buf, size, data + SS(refs), n - SS(refs));
+	else /* detached, abbreviated commit */
+		copy_value(buf, size, data, (n < 7 ? n : 7));
+}
+
+ASHE_PUBLIC void ashe_loadavg(const char *cwd, char *buf, size_t size)
+{
+	char data[128];
+
+	(void)cwd;
+	buf[0] = '\0';
+	if (read_small("/proc/loadavg", data, sizeof(data)) > 0)
+		copy_value(buf, size, data, strcspn(data, " "));
+}
+
+/* Worker thread computing requested async placeholders. */
+ASHE_PRIVATE void *async_worker(void *arg)
+{
+	static char cwd[PATH_MAX], res[NASYNC][ASYNC_MAX];
+	const a_uint64 one = 1;
+	a_uint64 gen;
+	a_uint32 mask, i;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&async.lock);
+		while (async.reqgen == async.resgen && !async.quit)
+			pthread_cond_wait(&async.cond, &async.lock);
+		if (async.quit) {
+			pthread_mutex_unlock(&async.lock);
+			return NULL;
+		}
+		gen = async.reqgen;
+		mask = async.reqmask;
+		memcpy(cwd, async.reqcwd, sizeof(cwd));
+		pthread_mutex_unlock(&async.lock);
+
+		for (i = 0; i < NASYNC; i++) {
+			res[i][0] = '\0';
+			if (mask & (1u << i))
+				asyncplaceholders[i](cwd, res[i], ASYNC_MAX);
+		}
+
+		pthread_mutex_lock(&async.lock);
+		memcpy(async.res, res, sizeof(res));
+		memcpy(async.rescwd, cwd, sizeof(cwd));
+		async.resgen = gen;
+		pthread_mutex_unlock(&async.lock);
+		while (write(async.efd, &one, sizeof(one)) < 0 && errno == EINTR)
+			;
+	}
+}
+
+/* Request async placeholders in 'mask', starts the worker if needed. */
+ASHE_PRIVATE void async_request(a_uint32 mask)
+{
+	sigset_t set, old;
+
+	if (async.efd < 0) {
+		if (a_unlikely((async.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0))
+			ashe_panic_libcall(eventfd);
+		sigfillset(&set); /* signals are left to the main thread */
+		pthread_sigmask(SIG_SETMASK, &set, &old);
+		if (a_unlikely(pthread_create(&async.thread, NULL, async_worker, NULL) != 0))
+			ashe_panic_libcall(pthread_create);
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+	}
+	if (!async.cwdok) {
+		if (a_unlikely(!getcwd(async.cwd, sizeof(async.cwd))))
+			ashe_panic_libcall(getcwd);
+		async.cwdok = 1;
+	}
+	pthread_mutex_lock(&async.lock);
+	async.reqgen++;
+	async.reqmask = mask;
+	memcpy(async.reqcwd, async.cwd, sizeof(async.cwd));
+	pthread_cond_signal(&async.cond);
+	pthread_mutex_unlock(&async.lock);
+}
+
+ASHE_PUBLIC a_int32 ashe_plhfd(void)
+{
+	return async.efd;
+}
+
+ASHE_PUBLIC a_ubyte ashe_plhcollect(void)
+{
+	a_uint64 n;
+	a_ubyte changed;
+	a_uint32 i;
+
+	if (async.efd < 0)
+		return 0;
+	while (read(async.efd, &n, sizeof(n)) < 0 && errno == EINTR)
+		;
+	changed = 0;
+	pthread_mutex_lock(&async.lock);
+	if (async.resgen != async.seen && async.cwdok && strcmp(async.rescwd, async.cwd) == 0) {
+		async.seen = async.resgen;
+		for (i = 0; i < NASYNC; i++) {
+			if (!(async.reqmask & (1u << i)))
+				continue;
+			if (!async.shownok[i] || strcmp(async.shown[i], async.res[i]) != 0) {
+				memcpy(async.shown[i], async.res[i], ASYNC_MAX);
+				async.shownok[i] = 1;
+				changed = 1;
+			}
+		}
+	}
+	pthread_mutex_unlock(&async.lock);
+	plhgen += changed;
+	return changed;
+}
+
+/* prompt template, its async placeholders are prefetched */
+static struct a_usertmpl *prefetchtmpl;
+
+ASHE_PUBLIC void ashe_plhprefetch(void)
+{
+	if (prefetchtmpl && prefetchtmpl->ut_async)
+		async_request(prefetchtmpl->ut_async);
+}
+
+/* Return set if all async placeholders in 'mask' have values. */
+ASHE_PRIVATE a_ubyte async_ready(a_uint32 mask)
+{
+	a_uint32 i;
+
+	for (i = 0; i < NASYNC; i++)
+		if ((mask & (1u << i)) && !async.shownok[i])
+			return 0;
+	return 1;
+}
+
+/* Return milliseconds elapsed since 'start'. */
+ASHE_PRIVATE a_int64 elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+ASHE_PUBLIC void a_usertmpl_prepare(struct a_usertmpl *ut)
+{
+	struct pollfd pfd;
+	struct timespec start;
+	a_int64 left;
+
+	prefetchtmpl = ut;
+	if (!ut->ut_async)
+		return;
+	async_request(ut->ut_async);
+	ashe_plhcollect(); /* prefetched values */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pfd.fd = async.efd;
+	pfd.events = POLLIN;
+	while (!async_ready(ut->ut_async) && (left = ASHE_PLH_DEADLINE - elapsed_ms(&start)) > 0) {
+		if (poll(&pfd, 1, left) > 0)
+			ashe_plhcollect();
+	}
+}
+
+/*
+ * Return value of the placeholder 'n' (NULL if the placeholder
+ * returned NULL), it is computed again only if the cached one
+ * expired at the time 'now' or got invalidated.
+ */
+ASHE_PRIVATE const char *plh_value(a_uint32 n, time_t now)
+{
+	struct plhval *v = &plhvals[n];
 	const char *res;
-	a_memmax n, prev;
+
+	if (v->valid && (v->expires == 0 || now < v->expires))
+		return (v->null ? NULL : a_arr_ptr(v->val));
+	plhcached = 0;
+	res = placeholders[n]();
+	if (v->null ? res != NULL :
+		      (!res || a_arr_len(v->val) == 0 || strcmp(res, a_arr_ptr(v->val)) != 0))
+		plhgen++;
+	a_arr_len(v->val) = 0;
+	if (!(v->null = (res == NULL)))
+		a_arr_char_push_str(&v->val, res, strlen(res) + 1);
+	v->valid = plhcached;
+	v->expires = plhexpires;
+	v->events = plhevents;
+	return res;
+}
+
+/* Return the cached value of the placeholder 'n'. */
+#define plh_cached(n) (plhvals[n].null ? NULL : a_arr_ptr(plhvals[n].val))
+
+/* current time, only if any cached value can expire */
+ASHE_PRIVATE time_t plh_now(void)
+{
+	time_t t;
 	a_uint32 i;
-	a_int32 c;
 
-	if (!isdigit(*++p))
-		goto push_plh_sign;
+	for (i = 0; i < ASHE_ELEMENTS(plhvals); i++) {
+		if (plhvals[i].valid && plhvals[i].expires != 0) {
+			if (a_unlikely(time(&t) < 0))
+				ashe_panic_libcall(time);
+			return t;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Parse the placeholder index at 'p' (after the placeholder
+ * sign), returns -1 if 'p' is not a valid placeholder and
+ * sets 'end' after the index otherwise.
+ */
+ASHE_PRIVATE a_int32 parse_plhidx(const char *p, const char **end)
+{
+	a_memmax n, prev;
+	a_uint32 i;
 
+	if (!isdigit(*p))
+		return -1;
 	n = prev = 0;
-	for (i = 0; i < ASHE_MAXNUMSTR && isdigit((c = *p)); i++, p++) {
-		n = n * 10 + (c - '0');
+	for (i = 0; i < ASHE_MAXNUMSTR && isdigit(*p); i++, p++) {
+		n = n * 10 + (*p - '0');
 		if (a_unlikely(n < prev))
 			ashe_panic("placeholder index overflowed");
 		prev = n;
 	}
+	if (a_unlikely(n >= NSYNC + NASYNC))
+		return -1;
+	*end = p;
+	return n;
+}
+
+ASHE_PRIVATE void expand_placeholders(a_arr_char *out, const char **ptr)
+{
+	char cwd[PATH_MAX], buf[ASYNC_MAX];
+	const char *res, *end;
+	a_int32 n;
 
-	if (a_unlikely(n >= ASHE_ELEMENTS(placeholders)))
-		goto push_plh_sign;
+	if ((n = parse_plhidx(*ptr + 1, &end)) < 0) {
+		res = NULL;
+	} else if ((a_uint32)n < NSYNC) {
+		res = plh_value(n, plh_now());
+	} else { /* async placeholder is computed right away */
+		if (a_unlikely(!getcwd(cwd, sizeof(cwd))))
+			ashe_panic_libcall(getcwd);
+		buf[0] = '\0';
+		asyncplaceholders[n - NSYNC](cwd, buf, sizeof(buf));
+		res = buf;
+	}
 
-	if (a_likely((res = placeholders[n]()) != NULL)) {
+	if (a_likely(res != NULL)) {
 		a_arr_char_push_str(out, res, strlen(res));
-		*ptr = p;
+		*ptr = end;
 	} else {
-push_plh_sign:
-		a_arr_char_push(out, '%');
+		a_arr_char_push(out, ASHE_PLH_SIGN);
 		*ptr += 1;
 	}
 }
@@ -165,6 +558,99 @@ ASHE_PUBLIC void parse_placeholders(a_arr_char *out, const char *str)
 	a_arr_char_push(out, '\0');
 }
 
+/* Compile 'str' into segments of literal text and placeholders. */
+ASHE_PUBLIC void a_usertmpl_init(struct a_usertmpl *ut, const char *str)
+{
+	struct a_plhseg *seg;
+	const char *end;
+	a_int32 n;
+
+	a_arr_char_init(&ut->ut_lits);
+	a_arr_plhseg_init(&ut->ut_segs);
+	ut->ut_gen = 0;
+	ut->ut_async = 0;
+	seg = NULL;
+	while (*str) {
+		if (*str == ASHE_PLH_SIGN && (n = parse_plhidx(str + 1, &end)) >= 0) {
+			a_arr_plhseg_push(&ut->ut_segs, (struct a_plhseg){ .plh = n });
+			if ((a_uint32)n >= NSYNC)
+				ut->ut_async |= 1u << (n - NSYNC);
+			seg = NULL;
+			str = end;
+			continue;
+		}
+		if (!seg) {
+			a_arr_plhseg_push(&ut->ut_segs, (struct a_plhseg){
+				.start = a_arr_len(ut->ut_lits), .len = 0, .plh = -1 });
+			seg = a_arr_plhseg_last(&ut->ut_segs);
+		}
+		a_arr_char_push(&ut->ut_lits, *str++);
+		seg->len++;
+	}
+}
+
+ASHE_PUBLIC void a_usertmpl_free(struct a_usertmpl *ut)
+{
+	if (prefetchtmpl == ut)
+		prefetchtmpl = NULL;
+	a_arr_char_free(&ut->ut_lits, NULL);
+	a_arr_plhseg_free(&ut->ut_segs, NULL);
+}
+
+ASHE_PUBLIC a_ubyte a_usertmpl_expand(struct a_usertmpl *ut, a_arr_char *out)
+{
+	struct a_plhseg *seg;
+	const char *res;
+	time_t now;
+	a_uint32 i;
+
+	now = plh_now();
+	for (i = 0; i < a_arr_len(ut->ut_segs); i++) /* refresh stale values */
+		if ((seg = a_arr_plhseg_index(&ut->ut_segs, i))->plh >= 0 &&
+		    (a_uint32)seg->plh < NSYNC)
+			plh_value(seg->plh, now);
+	if (ut->ut_gen == plhgen)
+		return 0;
+	a_arr_len(*out) = 0;
+	for (i = 0; i < a_arr_len(ut->ut_segs); i++) {
+		seg = a_arr_plhseg_index(&ut->ut_segs, i);
+		if (seg->plh < 0) {
+			a_arr_char_push_str(out, a_arr_char_index(&ut->ut_lits, seg->start),
+					    seg->len);
+		} else if ((a_uint32)seg->plh >= NSYNC) {
+			res = (async.shownok[seg->plh - NSYNC] ? async.shown[seg->plh - NSYNC] :
+								 ASHE_PLH_PENDING);
+			a_arr_char_push_str(out, res, strlen(res));
+		} else if ((res = plh_cached(seg->plh))) {
+			a_arr_char_push_str(out, res, strlen(res));
+		} else { /* unexpanded placeholder */
+			a_arr_char_push(out, ASHE_PLH_SIGN);
+			a_arr_char_push_strf(out, "%n", (a_ssize)seg->plh);
+		}
+	}
+	a_arr_char_push(out, '\0');
+	ut->ut_gen = plhgen;
+	return 1;
+}
+
+/* Free cached placeholder values. */
+ASHE_PUBLIC void ashe_plhfree(void)
+{
+	a_uint32 i;
+
+	for (i = 0; i < ASHE_ELEMENTS(plhvals); i++)
+		a_arr_char_free(&plhvals[i].val, NULL);
+	if (async.efd >= 0) { /* stop the worker */
+		pthread_mutex_lock(&async.lock);
+		async.quit = 1;
+		pthread_cond_signal(&async.cond);
+		pthread_mutex_unlock(&async.lock);
+		pthread_join(async.thread, NULL);
+		close(async.efd);
+		async.efd = -1;
+	}
+}
+
 /* Prints and parses any arbitrary string. */
 ASHE_PUBLIC void ashe_puserstr(const char *str, a_memmax len)
 {
@@ -17,11 +17,86 @@
 #ifndef APROMPT_H
 #define APROMPT_H
 
+#include <time.h>
+
 #include "acommon.h"
+#include "aarray.h"
 #include "atoken.h"
 
 #define ASHE_USERSTR_MAX 	((MAXCMDSIZE >> 2) ? (MAXCMDSIZE >> 2) : 1024)
 
+/* events invalidating cached placeholder values */
+#define A_PLH_CWD  0x01 /* current directory changed */
+#define A_PLH_JOBS 0x02 /* job was added or removed */
+
+/* segment of a compiled string */
+struct a_plhseg {
+	a_uint32 start; /* offset of the literal text */
+	a_uint32 len; /* length of the literal text */
+	a_int32 plh; /* placeholder index (-1 if literal) */
+};
+
+ARRAY_NEW(a_arr_plhseg, struct a_plhseg)
+
+/*
+ * String with placeholders compiled into segments,
+ * expanding it only looks up cached placeholder values.
+ */
+struct a_usertmpl {
+	a_arr_char ut_lits; /* literal text of all segments */
+	a_arr_plhseg ut_segs;
+	a_uint64 ut_gen; /* placeholder values generation of the last expansion */
+	a_uint32 ut_async; /* bit mask of the async placeholders used */
+};
+
+void a_usertmpl_init(struct a_usertmpl *ut, const char *str);
+void a_usertmpl_free(struct a_usertmpl *ut);
+
+/*
+ * Start computing async placeholders used by 'ut' and wait
+ * for the ones that have no value yet, at most for
+ * 'ASHE_PLH_DEADLINE' milliseconds.
+ */
+void a_usertmpl_prepare(struct a_usertmpl *ut);
+
+/*
+ * Expand 'ut' into 'out' (null terminated) unless none
+ * of its placeholder values changed since it was last
+ * expanded into 'out'. Returns 1 if 'out' was rebuilt.
+ */
+a_ubyte a_usertmpl_expand(struct a_usertmpl *ut, a_arr_char *out);
+
+/*
+ * Called by a placeholder function, its value stays
+ * cached until the time 'expires' (0 if never) or
+ * until any of the 'events' happens.
+ */
+void ashe_plhcache(time_t expires, a_ubyte events);
+
+/* Drop cached placeholder values invalidated by 'events'. */
+void ashe_plhinvalidate(a_ubyte events);
+
+/*
+ * Start computing async placeholders of the next prompt
+ * (if the prompt has any), invoked before waiting for
+ * a foreground job.
+ */
+void ashe_plhprefetch(void);
+
+/*
+ * Return file descriptor that becomes readable when async
+ * placeholder values arrive (-1 if there is no worker).
+ */
+a_int32 ashe_plhfd(void);
+
+/*
+ * Take the async placeholder values that arrived,
+ * returns 1 if any of them changed.
+ */
+a_ubyte ashe_plhcollect(void);
+
+void ashe_plhfree(void);
+
 void ashe_puserstr(const char *str, a_memmax len);
 void ashe_pwelcome(void);
 void parse_placeholders(a_arr_char *out, const char *str);
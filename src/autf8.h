@@ -0,0 +1,48 @@
+/* ----------------------------------------------------------------------------------------------
+ * Copyright (C) 2023-2024 Jure Bagić
+ *
+ * This file is part of ashe.
+ * ashe is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * ashe is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ashe.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------------------------*/
+
+#ifndef AUTF8_H
+#define AUTF8_H
+
+#include "acommon.h"
+
+/*
+ * Return number of bytes in the UTF-8 sequence starting
+ * with byte 'c' (0 if 'c' can't start a sequence).
+ */
+a_uint32 a_utf8_seqlen(a_ubyte c);
+
+/*
+ * Decode character from at most 'len' bytes of 's' into
+ * 'cp', returns the number of bytes it takes or 0 if 's'
+ * does not start with a valid UTF-8 sequence.
+ */
+a_uint32 a_utf8_decode(const char *s, a_uint32 len, a_uint32 *cp);
+
+/*
+ * Return number of terminal columns taken by the character
+ * 'cp' (0, 1 or 2), -1 if it is not printable.
+ */
+a_int32 a_utf8_width(a_uint32 cp);
+
+/*
+ * Return number of terminal columns taken by 'len' bytes
+ * of 's', invalid bytes and characters that are not
+ * printable take a single column.
+ */
+a_uint32 a_utf8_strwidth(const char *s, a_uint32 len);
+
+#endif
@@ -241,43 +241,40 @@ ASHE_PRIVATE a_memmax is_ashe_var(const char *ptr)
 
 ASHE_PUBLIC void ashe_expandvars(a_arr_char *buffer)
 {
-	const char *value;
+	a_arr_char out;
+	const char *value, *start;
 	char *ptr, *end;
-	a_ssize vlen, klen, diff, idx;
+	a_memmax klen;
 	a_byte cached;
 
+	/* expanded input is built in a single pass */
+	a_arr_char_init_cap(&out, a_arrp_len(buffer));
+	start = a_arrp_ptr(buffer); /* not yet copied into 'out' */
 	for (ptr = a_arrp_ptr(buffer); (ptr = strchr(ptr, '$')) != NULL; ptr++) {
-		idx = ptr - a_arrp_ptr(buffer);
-
-		if (ashe_isescaped(a_arrp_ptr(buffer), idx))
+		if (ashe_isescaped(a_arrp_ptr(buffer), ptr - a_arrp_ptr(buffer)))
 			continue;
 
-		klen = strspn(++ptr, ENV_VAR_CHARS);
+		klen = strspn(ptr + 1, ENV_VAR_CHARS);
 
-		if (klen == 0 && (klen = is_ashe_var(ptr)) == 0)
+		if (klen == 0 && (klen = is_ashe_var(ptr + 1)) == 0)
 			continue;
 
-		end = ptr + klen;
+		end = ptr + 1 + klen;
 		cached = *end;
 		*end = '\0';
-		value = getenv(ptr);
+		value = getenv(ptr + 1);
 		*end = cached;
-		--ptr; /* back to '$' */
-		klen++; /* + '$' */
-
-		if (value) {
-			vlen = strlen(value);
-			diff = vlen - klen;
-			if (a_unlikely(diff > 0 && a_arrp_len(buffer) + diff >= MAXCMDSIZE))
-				continue;
-			a_arr_char_remove_n(buffer, idx, klen);
-			a_arr_char_insert_n(buffer, idx, value, vlen);
-			ptr = a_arrp_ptr(buffer) + idx + vlen - 1;
-		} else { /* remove the key + '$' */
-			--ptr; /* back to char before '$' */
-			a_arr_char_remove_n(buffer, idx, klen);
-		}
+
+		/* key + '$' is replaced with the value (or removed) */
+		a_arr_char_push_str(&out, start, ptr - start);
+		if (value)
+			a_arr_char_push_str(&out, value, strlen(value));
+		start = end;
+		ptr = end - 1;
 	}
+	a_arr_char_push_str(&out, start, a_arrp_ptr(buffer) + a_arrp_len(buffer) - start);
+	a_arr_char_free(buffer, NULL);
+	*buffer = out;
 }
 
 ASHE_PUBLIC a_ubyte ashe_indq(const char *restrict str, a_memmax len)